@@ -1,400 +1,3178 @@
+#define _GNU_SOURCE // memrchr
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <signal.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <pthread.h>
 #include "indexer.h"
+#include "protocol.h"
+#include "records.h"
+#include "bloom.h"
+#include "fetch.h"
+#include "csvscan.h"
 
 #define INPUT_PIPE "/tmp/frontend_input"
 #define OUTPUT_PIPE "/tmp/frontend_output"
 #define MAX_LINE_LEN 4096
-#define INITIAL_BUFFER_SIZE 4096 // Empezamos con 4KB, un tamaño inicial razonable
 #define PORT 3550
-#define BACKLOG 8
+#define BACKLOG 1024
+#define MAX_EVENTS 64
+#define MAX_WORKERS 256
 
-int serverfd,clientfd;
+int serverfd;
 
 void cerrar_servidor(int signo) {
     close(serverfd);
-    close(clientfd);
     printf("\nServidor cerrado correctamente.\n");
     fflush(stdout);
     exit(0);
 }
 
-// Lee una línea entera de un archivo, sin importar su longitud.
-char *read_full_line(FILE *stream)
+// Índice secundario de una columna ya mapeado (ver el formato en indexer.h)
+typedef struct {
+    int loaded;
+    long value_count;
+    const ValueSlot *values; // Ordenados por texto
+    const char *strings;
+    const IndexEntry *entries;
+} SecondaryIndex;
+
+// Agregados ya mapeados (ver el formato en indexer.h)
+typedef struct {
+    int loaded;
+    const AggHeader *header;
+    const KeySlot *key_table;
+    const MonthCount *series;
+    const AggPeriod *periods;
+    const TopEntry *top;
+    const ValueSlot *rollup_values; // Los de ItemType y después los de Collection, cada grupo ordenado por texto
+    const char *rollup_strings;
+    const long *rollup_rows;        // Por cada valor, 'row_width' meses desde enero de first_year
+    long row_width;
+} Aggregates;
+
+#define INDEX_MAX_MAPPINGS 16 // header, index, CSV, records, índices secundarios y agregados
+
+// Región mapeada de un archivo del índice, para desmapearla cuando el índice se reemplaza
+typedef struct {
+    const void *data;
+    size_t size;
+} IndexMapping;
+
+// Índice residente en memoria. Los archivos se mapean (o, el filtro de Bloom, se leen) al
+// arrancar el servidor y todas las consultas leen directamente de estas regiones. Cuando los
+// archivos cambian se carga una generación nueva y reemplaza a esta (ver reload_index).
+typedef struct {
+    const KeySlot *key_table;        // header.dat: tabla de claves con el bloque de cada una
+    long table_size;
+    uint64_t *bloom_words;           // bloom.dat leído a memoria (NULL si no se cargó)
+    long bloom_bits;
+    long bloom_hashes;
+    YearManifest *years;             // years.dat: filas por año y mes (NULL si no se cargó)
+    const IndexEntry *index_entries; // index.dat: postings contiguos por clave
+    size_t index_count;
+    const char *csv_data;     // El archivo CSV con los registros
+    size_t csv_size;
+    int has_records;          // 1 si se cargó records.dat; las filas se arman desde sus columnas
+    RecordStore records;
+    SecondaryIndex secondary[SECONDARY_LAST_COLUMN + 1]; // Por columna del CSV; opcionales
+    Aggregates aggregates;                               // Opcionales
+    IndexMapping mappings[INDEX_MAX_MAPPINGS];           // Todo lo que hay que desmapear al liberarlo
+    int mapping_count;
+    int csv_fd;               // El CSV abierto para las lecturas posicionales de fetch.h (-1 si no)
+    unsigned long generation; // Aumenta con cada índice que se carga; es también la de la caché
+    int refs;                 // Solicitudes que la usan, más una mientras es la generación actual
+} MappedIndex;
+
+// Generación del índice que usa la solicitud en curso de cada hilo (ver index_acquire)
+__thread MappedIndex *indice;
+
+// Mapea un archivo completo en memoria de solo lectura y devuelve su tamaño en 'size'.
+// Devuelve NULL si el archivo no existe, está vacío o no se pudo mapear.
+const char *map_file(const char *path, size_t *size)
 {
-    char *line = NULL;
-    size_t buffer_size = 0;
-    size_t line_len = 0;
-    int c;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "Error: el archivo '%s' está vacío o no se pudo leer\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // El mapeo sigue siendo válido después de cerrar el descriptor
+    if (data == MAP_FAILED)
+    {
+        perror("Error al mapear el archivo");
+        return NULL;
+    }
+
+    // Los accesos son aleatorios (un nodo o una línea por consulta), así que no queremos read-ahead
+    madvise(data, st.st_size, MADV_RANDOM);
+    *size = st.st_size;
+    return data;
+}
+
+// Anota una región mapeada como parte del índice
+void index_keep_mapping(MappedIndex *idx, const void *data, size_t size)
+{
+    idx->mappings[idx->mapping_count].data = data;
+    idx->mappings[idx->mapping_count].size = size;
+    idx->mapping_count++;
+}
+
+// Desmapea y libera todo lo que se cargó en 'idx'
+void index_release(MappedIndex *idx)
+{
+    for (int i = 0; i < idx->mapping_count; i++)
+        munmap((void *)idx->mappings[i].data, idx->mappings[i].size);
+    idx->mapping_count = 0;
+    if (idx->csv_fd >= 0)
+        close(idx->csv_fd);
+    idx->csv_fd = -1;
+    free(idx->bloom_words);
+    idx->bloom_words = NULL;
+    free(idx->years);
+    idx->years = NULL;
+}
+
+// 1 si cada posición usada de la tabla de claves apunta a un bloque dentro de [0, limit) y
+// queda alguna libre (sin ninguna, find_key no termina con una clave ausente)
+int key_table_valid(const KeySlot *table, long table_size, long limit)
+{
+    long used = 0;
+    for (long i = 0; i < table_size; i++)
+    {
+        if (table[i].key == KEY_EMPTY)
+            continue;
+        if (table[i].start < 0 || table[i].count < 0 || table[i].start > limit - table[i].count)
+            return 0;
+        used++;
+    }
+    return used < table_size;
+}
+
+// Lee el filtro de Bloom completo a memoria del proceso. Es opcional: si falta o no corresponde
+// al índice, las búsquedas van directo a la tabla de claves.
+void cargar_bloom(MappedIndex *idx, const char *bloom_filepath, const IndexHeader *index_header)
+{
+    idx->bloom_words = NULL;
+    FILE *bloom_file = fopen(bloom_filepath, "rb");
+    if (!bloom_file)
+    {
+        printf("Sin '%s': no se usará el filtro de Bloom (vuelva a ejecutar ./constructor)\n", bloom_filepath);
+        return;
+    }
+
+    BloomHeader header;
+    if (fread(&header, sizeof(header), 1, bloom_file) != 1 || memcmp(header.magic, BLOOM_MAGIC, sizeof(header.magic)) != 0 ||
+        header.bit_count <= 0 || header.bit_count % 64 != 0 || header.hash_count < 1 ||
+        header.hash_count > BLOOM_MAX_HASHES || header.key_count != index_header->key_count ||
+        header.entry_count != index_header->entry_count)
+    {
+        fprintf(stderr, "Aviso: '%s' no es válido o no corresponde al índice; no se usará el filtro de Bloom\n", bloom_filepath);
+        fclose(bloom_file);
+        return;
+    }
+
+    size_t word_count = header.bit_count / 64;
+    uint64_t *words = malloc(word_count * sizeof(uint64_t));
+    if (!words || fread(words, sizeof(uint64_t), word_count, bloom_file) != word_count || fgetc(bloom_file) != EOF)
+    {
+        fprintf(stderr, "Aviso: no se pudo leer '%s'; no se usará el filtro de Bloom\n", bloom_filepath);
+        free(words);
+        fclose(bloom_file);
+        return;
+    }
+    fclose(bloom_file);
+
+    idx->bloom_words = words;
+    idx->bloom_bits = header.bit_count;
+    idx->bloom_hashes = header.hash_count;
+    printf("Filtro de Bloom cargado: %.1f KB, %.4f%% de falsos positivos\n", header.bit_count / 8 / 1024.0,
+           header.fp_rate * 100);
+}
+
+// Lee el manifiesto de años. También es opcional: sin él, los filtros de fecha se resuelven
+// solo con la búsqueda binaria dentro de cada bloque.
+void cargar_manifiesto(MappedIndex *idx, const char *years_filepath, const IndexHeader *index_header)
+{
+    idx->years = NULL;
+    FILE *years_file = fopen(years_filepath, "rb");
+    if (!years_file)
+    {
+        printf("Sin '%s': los filtros de fecha no usarán el manifiesto de años\n", years_filepath);
+        return;
+    }
+    YearManifest *manifest = malloc(sizeof(YearManifest));
+    if (!manifest || fread(manifest, sizeof(YearManifest), 1, years_file) != 1 || fgetc(years_file) != EOF ||
+        memcmp(manifest->magic, YEARS_MAGIC, sizeof(manifest->magic)) != 0 ||
+        manifest->entry_count != index_header->entry_count)
+    {
+        fprintf(stderr, "Aviso: '%s' no es válido o no corresponde al índice; no se usará\n", years_filepath);
+        free(manifest);
+        fclose(years_file);
+        return;
+    }
+    fclose(years_file);
+    idx->years = manifest;
+}
+
+// 1 si el manifiesto dice que no hay ninguna fila en el año (y mes) que pide la consulta,
+// así que la respuesta es vacía sin buscar la clave ni los valores
+int periodo_vacio(const SearchQuery *query)
+{
+    return indice->years && query->year > 0 && manifest_rows(indice->years, query->year, query->month) == 0;
+}
+
+// Carga el índice una sola vez. El almacén binario es opcional: si no existe o no corresponde
+// al CSV, las filas se leen del CSV como antes. Devuelve 0 si todo salió bien y -1 en caso de error.
+int cargar_indice(MappedIndex *idx, const char *header_filepath, const char *index_filepath, const char *bloom_filepath,
+                  const char *years_filepath, const char *csv_filepath, const char *records_filepath)
+{
+    idx->csv_fd = -1;
+    size_t header_size;
+    const char *header_data = map_file(header_filepath, &header_size);
+    if (header_data == NULL)
+        return -1;
+    index_keep_mapping(idx, header_data, header_size);
+    IndexHeader header;
+    memcpy(&header, header_data, header_size < sizeof(header) ? header_size : sizeof(header));
+    if (header_size < sizeof(header) || memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.table_size <= 0 || (header.table_size & (header.table_size - 1)) != 0 ||
+        header_size != sizeof(header) + sizeof(KeySlot) * header.table_size)
+    {
+        fprintf(stderr, "Error: '%s' no tiene el formato esperado, vuelva a ejecutar ./constructor\n", header_filepath);
+        return -1;
+    }
+    idx->key_table = (const KeySlot *)(header_data + sizeof(header));
+    idx->table_size = header.table_size;
+
+    size_t index_size;
+    idx->index_entries = (const IndexEntry *)map_file(index_filepath, &index_size);
+    if (idx->index_entries == NULL)
+        return -1;
+    index_keep_mapping(idx, idx->index_entries, index_size);
+    idx->index_count = index_size / sizeof(IndexEntry);
+    if (header.entry_count != (long)idx->index_count)
+    {
+        fprintf(stderr, "Error: '%s' y '%s' no corresponden, vuelva a ejecutar ./constructor\n", header_filepath, index_filepath);
+        return -1;
+    }
+    // Se revisa una sola vez aquí para que las búsquedas no lean fuera de index.dat
+    if (!key_table_valid(idx->key_table, idx->table_size, (long)idx->index_count))
+    {
+        fprintf(stderr, "Error: '%s' tiene bloques fuera de '%s', vuelva a ejecutar ./constructor\n", header_filepath,
+                index_filepath);
+        return -1;
+    }
+    cargar_bloom(idx, bloom_filepath, &header);
+    cargar_manifiesto(idx, years_filepath, &header);
+
+    idx->csv_data = map_file(csv_filepath, &idx->csv_size);
+    if (idx->csv_data == NULL)
+        return -1;
+    index_keep_mapping(idx, idx->csv_data, idx->csv_size);
+    // El CSV tiene que ser el que se indexó, con o sin filas agregadas después; si se regeneró
+    // sin volver a ejecutar el constructor, los offsets del índice apuntan a otras filas
+    if (header.csv_size > (long)idx->csv_size || tail_hash(idx->csv_data, header.csv_size) != header.csv_tail_hash)
+    {
+        fprintf(stderr, "Error: '%s' no es el CSV que se indexó en '%s', vuelva a ejecutar ./constructor\n", csv_filepath,
+                header_filepath);
+        return -1;
+    }
+    // Lecturas posicionales de filas del CSV; si no se puede abrir, las filas se leen del mapeo
+    idx->csv_fd = open(csv_filepath, O_RDONLY);
+    if (idx->csv_fd < 0)
+        perror(csv_filepath);
+
+    idx->has_records = 0;
+    if (access(records_filepath, R_OK) != 0)
+    {
+        printf("Sin '%s': las filas se leerán del CSV (ejecute ./convertir para generarlo)\n", records_filepath);
+        return 0;
+    }
+    size_t records_size;
+    const char *records_data = map_file(records_filepath, &records_size);
+    if (records_data == NULL || record_store_open(&idx->records, records_data, records_size) < 0 ||
+        idx->records.csv_size != (long)idx->csv_size)
+    {
+        fprintf(stderr, "Aviso: '%s' no es válido o no corresponde a '%s'; vuelva a ejecutar ./convertir. Se usará el CSV.\n",
+                records_filepath, csv_filepath);
+        if (records_data != NULL)
+            munmap((void *)records_data, records_size);
+        return 0;
+    }
+    index_keep_mapping(idx, records_data, records_size);
+    idx->has_records = 1;
+    return 0;
+}
+
+// Mapea los índices secundarios que existan. Son opcionales: sin el de una columna, las
+// consultas por esa columna responden con un error.
+void cargar_indices_secundarios(MappedIndex *idx)
+{
+    for (int column = SECONDARY_FIRST_COLUMN; column <= SECONDARY_LAST_COLUMN; column++)
+    {
+        const char *path = secondary_index_path(column);
+        SecondaryIndex *index = &idx->secondary[column];
+        index->loaded = 0;
+        if (access(path, R_OK) != 0)
+        {
+            printf("Sin '%s': no se podrá consultar por %s (vuelva a ejecutar ./constructor)\n", path, column_name(column));
+            continue;
+        }
+        size_t size;
+        const char *data = map_file(path, &size);
+        if (data == NULL)
+            continue;
+
+        SecondaryHeader header;
+        memcpy(&header, data, size < sizeof(header) ? size : sizeof(header));
+        int valid = size >= sizeof(header) && memcmp(header.magic, SECONDARY_MAGIC, sizeof(header.magic)) == 0 &&
+                    header.column == column && header.value_count >= 0 && header.strings_size >= 0 &&
+                    header.strings_size % 8 == 0 && header.entry_count == (long)idx->index_count &&
+                    size == sizeof(header) + header.value_count * sizeof(ValueSlot) + header.strings_size +
+                                header.entry_count * sizeof(IndexEntry);
+
+        // Los bloques tienen que cubrir las entradas en orden y los nombres caber en el texto
+        const ValueSlot *values = (const ValueSlot *)(data + sizeof(header));
+        long next_start = 0;
+        for (long i = 0; valid && i < header.value_count; i++)
+        {
+            valid = values[i].start == next_start && values[i].count > 0 && values[i].name_offset >= 0 &&
+                    values[i].name_len >= 0 && values[i].name_offset + values[i].name_len <= header.strings_size;
+            next_start += values[i].count;
+        }
+        if (!valid || next_start != header.entry_count)
+        {
+            fprintf(stderr, "Aviso: '%s' no es válido o no corresponde al índice; vuelva a ejecutar ./constructor\n", path);
+            munmap((void *)data, size);
+            continue;
+        }
+
+        index_keep_mapping(idx, data, size);
+        index->values = values;
+        index->value_count = header.value_count;
+        index->strings = (const char *)(values + header.value_count);
+        index->entries = (const IndexEntry *)(index->strings + header.strings_size);
+        index->loaded = 1;
+        printf("Índice de %s cargado: %ld valores distintos\n", column_name(column), header.value_count);
+    }
+}
+
+// Mapea aggregates.dat. Es opcional: sin él no se atienden REQ_SERIES ni REQ_TOP.
+void cargar_agregados(MappedIndex *idx, const char *path)
+{
+    Aggregates *agg = &idx->aggregates;
+    agg->loaded = 0;
+    if (access(path, R_OK) != 0)
+    {
+        printf("Sin '%s': no habrá series ni listas de más prestados (vuelva a ejecutar ./constructor)\n", path);
+        return;
+    }
+    size_t size;
+    const char *data = map_file(path, &size);
+    if (data == NULL)
+        return;
+
+    AggHeader header;
+    memcpy(&header, data, size < sizeof(header) ? size : sizeof(header));
+    long rollup_count = header.rollup_values[0] + header.rollup_values[1];
+    long year_count = header.first_year ? header.last_year - header.first_year + 1 : 0;
+    int valid = size >= sizeof(header) && memcmp(header.magic, AGG_MAGIC, sizeof(header.magic)) == 0 &&
+                header.entry_count == (long)idx->index_count && header.table_size > 0 &&
+                (header.table_size & (header.table_size - 1)) == 0 && year_count >= 0 && header.series_count >= 0 &&
+                header.top_count >= 0 &&
+                header.period_count == 1 + 13 * year_count && header.rollup_values[0] >= 0 &&
+                header.rollup_values[1] >= 0 && header.rollup_strings >= 0 && header.rollup_strings % 8 == 0 &&
+                size == sizeof(header) + header.table_size * sizeof(KeySlot) + header.series_count * sizeof(MonthCount) +
+                            header.period_count * sizeof(AggPeriod) + header.top_count * sizeof(TopEntry) +
+                            rollup_count * sizeof(ValueSlot) + header.rollup_strings +
+                            rollup_count * year_count * 12 * sizeof(long);
+    if (!valid)
+    {
+        fprintf(stderr, "Aviso: '%s' no es válido o no corresponde al índice; vuelva a ejecutar ./constructor\n", path);
+        munmap((void *)data, size);
+        return;
+    }
+
+    agg->header = (const AggHeader *)data;
+    agg->key_table = (const KeySlot *)(agg->header + 1);
+    agg->series = (const MonthCount *)(agg->key_table + header.table_size);
+    agg->periods = (const AggPeriod *)(agg->series + header.series_count);
+    agg->top = (const TopEntry *)(agg->periods + header.period_count);
+    agg->rollup_values = (const ValueSlot *)(agg->top + header.top_count);
+    agg->rollup_strings = (const char *)(agg->rollup_values + rollup_count);
+    agg->rollup_rows = (const long *)(agg->rollup_strings + header.rollup_strings);
+    agg->row_width = year_count * 12;
+
+    // Las series, las listas y los rollups de cada clave, período o valor tienen que caer
+    // dentro de su sección, así las consultas no leen fuera del mapeo
+    valid = key_table_valid(agg->key_table, header.table_size, header.series_count);
+    for (long i = 0; valid && i < header.period_count; i++)
+        valid = agg->periods[i].start >= 0 && agg->periods[i].count >= 0 &&
+                agg->periods[i].start <= header.top_count - agg->periods[i].count;
+    for (long i = 0; valid && i < rollup_count; i++)
+        valid = agg->rollup_values[i].start >= 0 && agg->rollup_values[i].start < rollup_count &&
+                agg->rollup_values[i].name_offset >= 0 && agg->rollup_values[i].name_len >= 0 &&
+                agg->rollup_values[i].name_offset <= header.rollup_strings - agg->rollup_values[i].name_len;
+    if (!valid)
+    {
+        fprintf(stderr, "Aviso: '%s' tiene bloques fuera de sus secciones; vuelva a ejecutar ./constructor\n", path);
+        munmap((void *)data, size);
+        return;
+    }
+    index_keep_mapping(idx, data, size);
+    agg->loaded = 1;
+    printf("Agregados cargados: %ld series mensuales, años %ld a %ld\n", header.series_count, header.first_year,
+           header.last_year);
+}
+
+// Línea que empieza en 'offset' dentro del CSV mapeado, sin copiarla: devuelve dónde empieza y
+// deja en 'len' su largo sin el salto de línea (que la sigue en memoria, salvo en la última
+// línea del archivo). Devuelve NULL si el offset está fuera del archivo.
+const char *mapped_line(long offset, size_t *len)
+{
+    if (offset < 0 || (size_t)offset >= indice->csv_size)
+        return NULL;
+
+    const char *start = indice->csv_data + offset;
+    size_t remaining = indice->csv_size - offset;
+
+    // memchr busca el salto de línea sin recorrer carácter por carácter con fgetc
+    const char *end = memchr(start, '\n', remaining);
+    *len = end ? (size_t)(end - start) : remaining;
+    return start;
+}
+
+// ---------------------- Memoria por solicitud ----------------------
+// Lo que una búsqueda necesita solo mientras se resuelve (las entradas que junta una consulta
+// con predicados, los IDs de un lote, la copia de las métricas...) se toma de una arena del
+// hilo: reservar es mover un puntero dentro de un bloque, y al terminar la solicitud todo se
+// devuelve de una vez. Los bloques se conservan para la siguiente solicitud hasta
+// ARENA_KEEP_SIZE, así que una búsqueda típica no llama a malloc ni a free y los hilos no
+// compiten por el heap.
+
+#define ARENA_BLOCK_SIZE (256 * 1024)
+#define ARENA_KEEP_SIZE (8 * 1024 * 1024) // Bytes que se conservan entre solicitudes
+#define ARENA_ALIGN 16
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size; // Bytes útiles del bloque
+    size_t used;
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *blocks;
+} Arena;
+
+// Los datos de cada bloque empiezan alineados después de su cabecera
+#define ARENA_HEADER ((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+// Reserva 'size' bytes que duran hasta arena_reset. Devuelve NULL si no hay memoria.
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size == 0)
+        size = ARENA_ALIGN;
+
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL && block->size - block->used < size)
+        block = block->next;
+    if (block == NULL)
+    {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(ARENA_HEADER + block_size);
+        if (block == NULL)
+        {
+            perror("Error: Fallo al asignar memoria para la solicitud");
+            return NULL;
+        }
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    void *data = (char *)block + ARENA_HEADER + block->used;
+    block->used += size;
+    return data;
+}
+
+// Libera de una vez todo lo reservado en la solicitud. Se conservan bloques hasta
+// ARENA_KEEP_SIZE; los demás (por ejemplo, uno enorme de una consulta amplia) vuelven al sistema.
+void arena_reset(Arena *arena)
+{
+    size_t kept = 0;
+    ArenaBlock **link = &arena->blocks;
+    while (*link != NULL)
+    {
+        ArenaBlock *block = *link;
+        if (kept + block->size <= ARENA_KEEP_SIZE)
+        {
+            kept += block->size;
+            block->used = 0;
+            link = &block->next;
+        }
+        else
+        {
+            *link = block->next;
+            free(block);
+        }
+    }
+}
+
+#define MAX_DATE_RANGES 256
+
+// Primera posición del bloque cuya fecha es >= t (las entradas están ordenadas por fecha)
+long lower_bound_time(const IndexEntry *bucket, long count, long t)
+{
+    long lo = 0, hi = count;
+    while (lo < hi)
+    {
+        long mid = lo + (hi - lo) / 2;
+        if (bucket[mid].checkout_time < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Traduce los filtros de la consulta a rangos de fechas [from, to) disjuntos y en orden.
+// Un filtro solo de mes produce un rango por cada año presente en el bloque.
+int build_date_ranges(const SearchQuery *query, const IndexEntry *bucket, long count, long ranges[][2])
+{
+    int range_count = 0;
+
+    if (query->year > 0)
+    {
+        month_range(query->year, query->month, &ranges[0][0], &ranges[0][1]);
+        range_count = 1;
+    }
+    else if (query->month > 0)
+    {
+        // Las fechas inválidas (-1) quedan al principio del bloque; las saltamos
+        long first = lower_bound_time(bucket, count, 0);
+        if (first == count)
+            return 0;
+        int first_year = year_from_epoch(bucket[first].checkout_time);
+        int last_year = year_from_epoch(bucket[count - 1].checkout_time);
+        for (int y = first_year; y <= last_year && range_count < MAX_DATE_RANGES; y++)
+        {
+            if (indice->years && manifest_rows(indice->years, y, query->month) == 0)
+                continue; // Ese mes no tiene filas en ningún ID
+            month_range(y, query->month, &ranges[range_count][0], &ranges[range_count][1]);
+            range_count++;
+        }
+    }
+    else
+    {
+        ranges[0][0] = LONG_MIN;
+        ranges[0][1] = LONG_MAX;
+        range_count = 1;
+    }
+
+    // Intersectamos con el rango explícito desde/hasta, si lo hay
+    int kept = 0;
+    for (int i = 0; i < range_count; i++)
+    {
+        long from = ranges[i][0];
+        long to = ranges[i][1];
+        if (query->date_from != 0 && query->date_from > from)
+            from = query->date_from;
+        if (query->date_to != 0 && query->date_to < to)
+            to = query->date_to;
+        if (from < to)
+        {
+            ranges[kept][0] = from;
+            ranges[kept][1] = to;
+            kept++;
+        }
+    }
+    return kept;
+}
+
+// ---------------------- Salida de las conexiones ----------------------
+// Los sockets de los clientes son siempre no bloqueantes. Cada trama se intenta enviar en el
+// momento; lo que el socket no acepta queda en el búfer de salida de la conexión y lo termina de
+// enviar el hilo de eventos cuando epoll avisa que se puede escribir (EPOLLOUT). Así un cliente
+// que no lee sus respuestas no retiene a un hilo del pool: el hilo deja sus solicitudes
+// encoladas para cuando la salida se vacíe. Solo si una misma respuesta llena el búfer el hilo
+// espera a que el cliente lea, y como mucho OUTPUT_STALL_MS en total por respuesta, contados
+// desde la primera vez que se llenó: si para entonces el cliente no leyó lo suficiente, se
+// cierra la conexión. Un cliente que lee de a poco no puede retener al hilo más que eso.
+
+#define OUTPUT_BUFFER_LIMIT (4 * 1024 * 1024) // Bytes pendientes que se guardan sin esperar
+#define OUTPUT_STALL_MS 2000                  // Espera máxima de un hilo por respuesta
+#define OUTPUT_KEEP_CAPACITY (64 * 1024)      // Al vaciarse, un búfer más grande se libera
+
+typedef struct {
+    char *data;
+    size_t start;    // Primer byte sin enviar
+    size_t end;      // Fin de los datos pendientes
+    size_t capacity;
+    int failed;      // 1 si el cliente cerró la conexión o dejó de leer
+    long deadline_ns; // Hasta cuándo puede esperar el hilo en la respuesta en curso (0 = no esperó)
+} OutputBuffer;
+
+long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+size_t output_pending(const OutputBuffer *out)
+{
+    return out->end - out->start;
+}
+
+// Envía sin bloquear todo lo pendiente que el socket acepte. Devuelve -1 si hubo un error.
+int output_flush(int fd, OutputBuffer *out)
+{
+    while (out->start < out->end)
+    {
+        // MSG_NOSIGNAL evita que un cliente que cerró la conexión mate al servidor con SIGPIPE
+        ssize_t sent = send(fd, out->data + out->start, out->end - out->start, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        out->start += sent;
+    }
+    out->start = out->end = 0;
+    if (out->capacity > OUTPUT_KEEP_CAPACITY)
+    {
+        free(out->data);
+        out->data = NULL;
+        out->capacity = 0;
+    }
+    return 0;
+}
+
+// Guarda 'len' bytes al final del búfer de salida. Si el búfer está lleno, primero espera a
+// que el cliente lea; devuelve -1 si hubo un error o se agotó el plazo de la respuesta.
+int output_append(int fd, OutputBuffer *out, const char *data, size_t len)
+{
+    while (output_pending(out) + len > OUTPUT_BUFFER_LIMIT)
+    {
+        long now = now_ns();
+        if (out->deadline_ns == 0)
+            out->deadline_ns = now + OUTPUT_STALL_MS * 1000000L;
+        if (now >= out->deadline_ns)
+        {
+            errno = ETIMEDOUT; // El cliente no lee sus respuestas lo bastante rápido
+            return -1;
+        }
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        int ready = poll(&pfd, 1, (out->deadline_ns - now + 999999) / 1000000);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready < 0 || (ready > 0 && output_flush(fd, out) < 0))
+            return -1;
+    }
+
+    if (out->start > 0)
+    {
+        memmove(out->data, out->data + out->start, out->end - out->start);
+        out->end -= out->start;
+        out->start = 0;
+    }
+    if (out->end + len > out->capacity)
+    {
+        size_t new_capacity = out->capacity ? out->capacity : 4096;
+        while (new_capacity < out->end + len)
+            new_capacity *= 2;
+        char *grown = realloc(out->data, new_capacity);
+        if (grown == NULL)
+            return -1;
+        out->data = grown;
+        out->capacity = new_capacity;
+    }
+    memcpy(out->data + out->end, data, len);
+    out->end += len;
+    return 0;
+}
+
+// Envía 'len' bytes sin bloquear; lo que el socket no acepte queda en el búfer de salida, detrás
+// de lo que ya estaba pendiente. Devuelve -1 y marca el búfer como fallido si hubo un error.
+int output_write(int fd, OutputBuffer *out, const char *data, size_t len)
+{
+    if (out->failed)
+        return -1;
+    if (output_flush(fd, out) < 0)
+    {
+        out->failed = 1;
+        return -1;
+    }
+    while (output_pending(out) == 0 && len > 0)
+    {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            out->failed = 1;
+            return -1;
+        }
+        data += sent;
+        len -= sent;
+    }
+    if (len > 0 && output_append(fd, out, data, len) < 0)
+    {
+        out->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------- Métricas de las consultas ----------------------
+// Cada búsqueda mide cuánto tiempo pasa en cada fase y cuántas entradas y filas toca. Los
+// tiempos se toman con un reloj monotónico solo al cambiar de fase, así que una fila que
+// no cambia de fase no cuesta una lectura del reloj. Al terminar, la medición se suma a
+// los histogramas globales que devuelve REQ_STATS y, si supera el umbral, se anota como lenta.
+
+#define PHASE_NONE -1
+#define PHASE_CACHE 0  // Búsqueda en la caché de resultados
+#define PHASE_LOOKUP 1 // Filtro de Bloom y tabla de claves, o valores de los índices secundarios
+#define PHASE_WALK 2   // Recorrido del bloque de entradas: rangos de fechas y juntar condiciones
+#define PHASE_FETCH 3  // Lectura de las filas del almacén binario o del CSV
+#define PHASE_FILTER 4 // Descarte de entradas: ID de claves por hash y condiciones sobre otras columnas
+#define PHASE_SEND 5   // Envío de las tramas al cliente
+#define PHASE_COUNT 6
+
+#define STATS_BUCKETS 32      // Histogramas en potencias de 2 (microsegundos o entradas)
+#define STATS_RECENT_SLOW 8   // Consultas lentas que se guardan para REQ_STATS
+#define STATS_QUERY_LEN 160
+
+const char *phase_names[PHASE_COUNT] = {"caché", "claves", "recorrido", "lectura", "filtrado", "envío"};
+
+// Medición de la consulta en curso; va dentro del ResponseWriter de cada hilo
+typedef struct {
+    int active;
+    int phase;         // Fase a la que se le está sumando el tiempo
+    long start;        // Nanosegundos al empezar la consulta
+    long mark;         // Nanosegundos del último cambio de fase
+    long phase_ns[PHASE_COUNT];
+    long chain_length; // Entradas del bloque recorrido (con predicados, el de la condición más selectiva)
+    long rows_read;    // Filas leídas del almacén o del CSV
+    long rows_matched; // Solo en las que no vienen de la caché, para compararlas con las leídas
+    long bytes_sent;
+    int cache_hit;
+} QueryTrace;
+
+typedef struct {
+    char query[STATS_QUERY_LEN];
+    long total_ns;
+    long chain_length;
+    long rows_read;
+} SlowQuery;
+
+typedef struct {
+    long queries;
+    long cache_hits;
+    long slow_queries;
+    long slow_threshold_ns; // 0 = no se anotan las consultas lentas
+    long total_ns;
+    long phase_ns[PHASE_COUNT];
+    long total_hist[STATS_BUCKETS];
+    long phase_hist[PHASE_COUNT][STATS_BUCKETS];
+    long chain_hist[STATS_BUCKETS];
+    long rows_read;
+    long rows_matched;
+    long bytes_sent;
+    long max_chain;
+    char max_chain_query[STATS_QUERY_LEN]; // La consulta que recorrió el bloque más largo
+    SlowQuery recent_slow[STATS_RECENT_SLOW];
+    long recent_next;
+    pthread_mutex_t lock;
+} ServerStats;
+
+ServerStats stats = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void trace_start(QueryTrace *trace)
+{
+    memset(trace, 0, sizeof(*trace));
+    trace->active = 1;
+    trace->phase = PHASE_NONE;
+    trace->start = now_ns();
+    trace->mark = trace->start;
+}
+
+// Pasa a la fase 'phase' y devuelve la anterior, para volver a ella después
+int trace_enter(QueryTrace *trace, int phase)
+{
+    if (!trace->active || trace->phase == phase)
+        return trace->phase;
+    long now = now_ns();
+    if (trace->phase != PHASE_NONE)
+        trace->phase_ns[trace->phase] += now - trace->mark;
+    trace->mark = now;
+    int previous = trace->phase;
+    trace->phase = phase;
+    return previous;
+}
+
+// Cubeta del histograma: la 0 es para el 0 y la b para los valores en [2^(b-1), 2^b)
+int stats_bucket(long value)
+{
+    if (value <= 0)
+        return 0;
+    int bucket = 64 - __builtin_clzl((unsigned long)value);
+    return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+// Cota superior del percentil 'q' según el histograma (en las mismas unidades que las cubetas)
+long stats_percentile(const long *hist, long count, double q)
+{
+    if (count == 0)
+        return 0;
+    long seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++)
+    {
+        seen += hist[b];
+        if (seen > 0 && seen >= q * count)
+            return b == 0 ? 0 : 1L << b;
+    }
+    return 1L << (STATS_BUCKETS - 1);
+}
+
+// Termina la medición de la consulta 'description' y la suma a las métricas globales
+void stats_record(QueryTrace *trace, const char *description)
+{
+    if (!trace->active)
+        return;
+    trace_enter(trace, PHASE_NONE);
+    trace->active = 0;
+    long total = trace->mark - trace->start;
+
+    pthread_mutex_lock(&stats.lock);
+    stats.queries++;
+    stats.cache_hits += trace->cache_hit;
+    stats.total_ns += total;
+    stats.total_hist[stats_bucket(total / 1000)]++;
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        stats.phase_ns[p] += trace->phase_ns[p];
+        if (trace->phase_ns[p] > 0)
+            stats.phase_hist[p][stats_bucket(trace->phase_ns[p] / 1000)]++;
+    }
+    if (!trace->cache_hit)
+        stats.chain_hist[stats_bucket(trace->chain_length)]++;
+    stats.rows_read += trace->rows_read;
+    stats.rows_matched += trace->rows_matched;
+    stats.bytes_sent += trace->bytes_sent;
+    if (trace->chain_length > stats.max_chain)
+    {
+        stats.max_chain = trace->chain_length;
+        snprintf(stats.max_chain_query, sizeof(stats.max_chain_query), "%s", description);
+    }
+    int slow = stats.slow_threshold_ns > 0 && total >= stats.slow_threshold_ns;
+    if (slow)
+    {
+        SlowQuery *entry = &stats.recent_slow[stats.recent_next++ % STATS_RECENT_SLOW];
+        snprintf(entry->query, sizeof(entry->query), "%s", description);
+        entry->total_ns = total;
+        entry->chain_length = trace->chain_length;
+        entry->rows_read = trace->rows_read;
+        stats.slow_queries++;
+    }
+    pthread_mutex_unlock(&stats.lock);
+
+    if (slow)
+    {
+        // Una sola llamada por línea, así las de distintos hilos no se mezclan
+        fprintf(stderr,
+                "Servidor: consulta lenta (%.3f ms) %s: caché %.3f, claves %.3f, recorrido %.3f, lectura %.3f, "
+                "filtrado %.3f, envío %.3f ms; bloque de %ld entradas, %ld filas leídas, %ld encontradas, %ld bytes\n",
+                total / 1e6, description, trace->phase_ns[PHASE_CACHE] / 1e6, trace->phase_ns[PHASE_LOOKUP] / 1e6,
+                trace->phase_ns[PHASE_WALK] / 1e6, trace->phase_ns[PHASE_FETCH] / 1e6,
+                trace->phase_ns[PHASE_FILTER] / 1e6, trace->phase_ns[PHASE_SEND] / 1e6, trace->chain_length,
+                trace->rows_read, trace->rows_matched, trace->bytes_sent);
+    }
+}
+
+// Respuesta en curso: los resultados se acumulan en una sola trama de tamaño fijo y se
+// envían en cuanto se llena, así la memoria por solicitud no crece con el número de filas
+// y el cliente empieza a recibir datos antes de que termine la búsqueda.
+// La carga útil siempre empieza en frame + RESPONSE_HEADER_SIZE y la cabecera (de texto o
+// binaria) se escribe justo antes, así cada trama sale con un solo send.
+typedef struct {
+    int fd;
+    OutputBuffer *out;   // Búfer de salida de la conexión
+    int binary;          // 1 si la respuesta usa el formato binario
+    uint32_t request_id; // Id de la solicitud binaria a la que se responde
+    int error;           // 1 si el cliente cerró la conexión; se dejan de enviar datos
+    size_t len;          // Bytes de carga útil acumulados en la trama actual
+    unsigned char frame[RESPONSE_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+
+    // Copia de la carga útil completa para guardarla en la caché de resultados.
+    // El buffer es del hilo y se reutiliza entre solicitudes.
+    char *capture;
+    size_t capture_len;
+    size_t capture_cap;
+    size_t capture_limit; // 0 = no se captura; si la respuesta lo supera, se descarta la copia
+
+    QueryTrace trace; // Medición de la búsqueda en curso (inactiva en las demás solicitudes)
+
+    int has_next;     // 1 si la página quedó incompleta y la trama final lleva el cursor
+    PageCursor next;  // Dónde sigue la próxima página (REQ_PAGE)
+
+    RowFetch *fetch;  // Lector de filas del hilo, con la última tanda leída del CSV (puede ser NULL)
+    Arena arena;      // Memoria de la solicitud en curso; se libera al terminar cada solicitud
+} ResponseWriter;
+
+void writer_init(ResponseWriter *writer, int fd, OutputBuffer *out, int binary, uint32_t request_id)
+{
+    writer->fd = fd;
+    writer->out = out;
+    out->deadline_ns = 0; // Cada respuesta tiene su propio plazo de espera
+    writer->binary = binary;
+    writer->request_id = request_id;
+    writer->error = 0;
+    writer->len = 0;
+    writer->capture_len = 0;
+    writer->capture_limit = 0;
+    writer->trace.active = 0;
+    writer->has_next = 0;
+    if (writer->fetch)
+        writer->fetch->row_count = 0;
+}
+
+// Empieza a copiar la carga útil de la respuesta, hasta 'limit' bytes
+void writer_start_capture(ResponseWriter *writer, size_t limit)
+{
+    writer->capture_len = 0;
+    writer->capture_limit = limit;
+}
+
+// Guarda una copia de los datos en el buffer de captura, si se está capturando
+void writer_capture(ResponseWriter *writer, const char *data, size_t len)
+{
+    if (writer->capture_limit == 0)
+        return;
+    if (writer->capture_len + len > writer->capture_limit)
+    {
+        writer->capture_limit = 0; // Demasiado grande para la caché
+        return;
+    }
+    if (writer->capture_len + len > writer->capture_cap)
+    {
+        size_t new_cap = writer->capture_cap ? writer->capture_cap : 4096;
+        while (new_cap < writer->capture_len + len)
+            new_cap *= 2;
+        char *grown = realloc(writer->capture, new_cap);
+        if (grown == NULL)
+        {
+            writer->capture_limit = 0;
+            return;
+        }
+        writer->capture = grown;
+        writer->capture_cap = new_cap;
+    }
+    memcpy(writer->capture + writer->capture_len, data, len);
+    writer->capture_len += len;
+}
+
+// Envía una trama. 'payload' debe tener RESPONSE_HEADER_SIZE bytes libres antes para la cabecera.
+void writer_send_frame(ResponseWriter *writer, char type, unsigned char *payload, size_t len)
+{
+    if (writer->error)
+        return;
+    size_t header_size = writer->binary ? RESPONSE_HEADER_SIZE : FRAME_HEADER_SIZE;
+    unsigned char *header = payload - header_size;
+    if (writer->binary)
+        response_header_encode(header, type, writer->request_id, len);
+    else
+        frame_header_encode(header, type, len);
+    int previous = trace_enter(&writer->trace, PHASE_SEND);
+    if (output_write(writer->fd, writer->out, (const char *)header, header_size + len) < 0)
+    {
+        perror("Error al enviar datos al cliente");
+        writer->error = 1;
+    }
+    writer->trace.bytes_sent += header_size + len;
+    trace_enter(&writer->trace, previous);
+}
+
+// Envía la trama de datos acumulada, si hay algo pendiente
+void writer_flush(ResponseWriter *writer)
+{
+    if (writer->len == 0 || writer->error)
+        return;
+    writer_send_frame(writer, FRAME_DATA, writer->frame + RESPONSE_HEADER_SIZE, writer->len);
+    writer->len = 0;
+}
+
+// Añade datos a la respuesta; si no caben en la trama actual, la envía y empieza otra.
+// Lo que cabe en una trama no se parte, así cada trama lleva filas completas.
+void writer_append(ResponseWriter *writer, const char *data, size_t len)
+{
+    writer_capture(writer, data, len);
+    if (len <= FRAME_MAX_PAYLOAD && writer->len + len > FRAME_MAX_PAYLOAD)
+        writer_flush(writer);
+
+    while (len > 0 && !writer->error)
+    {
+        size_t room = FRAME_MAX_PAYLOAD - writer->len;
+        size_t chunk = len < room ? len : room;
+        memcpy(writer->frame + RESPONSE_HEADER_SIZE + writer->len, data, chunk);
+        writer->len += chunk;
+        data += chunk;
+        len -= chunk;
+        if (writer->len == FRAME_MAX_PAYLOAD)
+            writer_flush(writer);
+    }
+}
+
+void writer_append_str(ResponseWriter *writer, const char *str)
+{
+    writer_append(writer, str, strlen(str));
+}
+
+// Añade un bloque de filas completas (por ejemplo, una respuesta guardada en la caché),
+// cortándolo en saltos de línea para que cada trama siga llevando filas completas
+void writer_append_rows(ResponseWriter *writer, const char *data, size_t len)
+{
+    while (len > 0 && !writer->error)
+    {
+        size_t chunk = len;
+        if (chunk > FRAME_MAX_PAYLOAD)
+        {
+            const char *newline = memrchr(data, '\n', FRAME_MAX_PAYLOAD);
+            chunk = newline ? (size_t)(newline - data) + 1 : FRAME_MAX_PAYLOAD;
+        }
+        writer_append(writer, data, chunk);
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+// Envía lo pendiente y la trama final con el número de filas encontradas
+// (como texto en el formato de compatibilidad y como entero de 8 bytes en el binario)
+void writer_finish(ResponseWriter *writer, long rows)
+{
+    writer_flush(writer);
+
+    unsigned char trailer[RESPONSE_HEADER_SIZE + 8 + PAGE_CURSOR_SIZE];
+    unsigned char *payload = trailer + RESPONSE_HEADER_SIZE;
+    size_t trailer_len;
+    if (writer->binary)
+    {
+        put_u64(payload, (uint64_t)rows);
+        trailer_len = 8;
+        if (writer->has_next)
+            trailer_len += page_cursor_encode(payload + 8, &writer->next);
+    }
+    else
+    {
+        trailer_len = snprintf((char *)payload, 32, "%ld", rows);
+    }
+    writer_send_frame(writer, FRAME_END, payload, trailer_len);
+}
+
+// Envía una respuesta corta que solo lleva un mensaje de error y su trama final.
+// En binario el mensaje va en una trama FRAME_ERROR; en texto, como datos normales.
+void send_message_response(ResponseWriter *writer, const char *message)
+{
+    size_t len = strlen(message);
+    if (len > FRAME_MAX_PAYLOAD)
+        len = FRAME_MAX_PAYLOAD;
+    memcpy(writer->frame + RESPONSE_HEADER_SIZE, message, len);
+    writer_send_frame(writer, writer->binary ? FRAME_ERROR : FRAME_DATA, writer->frame + RESPONSE_HEADER_SIZE, len);
+    writer->len = 0;
+    writer_finish(writer, 0);
+}
+
+// ---------------------- Caché de resultados ----------------------
+// Las consultas se concentran en pocos títulos populares, así que guardamos la carga útil
+// completa de las respuestas ya calculadas. La clave es la consulta normalizada, así que la
+// misma búsqueda hecha por texto o por el protocolo binario comparte la entrada. Cuando se
+// llena el presupuesto de memoria se descartan las entradas usadas hace más tiempo (LRU).
+//
+// Una entrada que se está enviando no se libera aunque la desalojen: lleva un contador de
+// referencias y la libera el último hilo que la suelta. Así el envío, que puede tardar,
+// ocurre fuera del candado.
+
+#define CACHE_BUCKETS 16384
+#define CACHE_KEY_LEN 2048
+#define CACHE_DEFAULT_MB 64
+
+typedef struct CacheEntry {
+    char *key;
+    char *data;       // Carga útil de la respuesta (filas en texto)
+    size_t len;
+    long rows;        // Número de filas, para la trama final
+    size_t cost;      // Bytes que cuenta contra el presupuesto
+    int refs;         // Hilos que la están enviando
+    int evicted;      // Ya no está en la tabla; se libera cuando refs llegue a 0
+    struct CacheEntry *hash_next;
+    struct CacheEntry *lru_prev; // Hacia las más recientes
+    struct CacheEntry *lru_next; // Hacia las más antiguas
+} CacheEntry;
+
+typedef struct {
+    CacheEntry *buckets[CACHE_BUCKETS];
+    CacheEntry *lru_head; // La más reciente
+    CacheEntry *lru_tail; // La próxima a desalojar
+    size_t budget;        // Presupuesto de memoria en bytes (0 = caché desactivada)
+    size_t used;
+    long entries;
+    unsigned long generation; // Aumenta con cada invalidación
+    long hits;
+    long misses;
+    long evictions;
+    long invalidations;
+    pthread_mutex_t lock;
+} QueryCache;
+
+QueryCache cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Clave normalizada de una consulta: los campos vacíos siempre se escriben como 0
+void cache_key(const SearchQuery *query, char *key, size_t size)
+{
+    size_t len = snprintf(key, size, "%s|%d|%d|%ld|%ld", query->id, query->year, query->month, query->date_from,
+                          query->date_to);
+    // Cada predicado lleva el largo de su valor, así ningún texto se confunde con otro
+    for (int i = 0; i < query->predicate_count && len < size; i++)
+    {
+        const Predicate *predicate = &query->predicates[i];
+        len += snprintf(key + len, size - len, "|%d%c%zu:%s", predicate->column,
+                        predicate->op == PRED_PREFIX ? '^' : '=', strlen(predicate->value), predicate->value);
+    }
+}
+
+void cache_init(size_t budget)
+{
+    cache.budget = budget;
+}
+
+void cache_free_entry(CacheEntry *entry)
+{
+    free(entry->key);
+    free(entry->data);
+    free(entry);
+}
+
+void lru_unlink(CacheEntry *entry)
+{
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        cache.lru_head = entry->lru_next;
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        cache.lru_tail = entry->lru_prev;
+}
+
+void lru_push_front(CacheEntry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache.lru_head;
+    if (cache.lru_head)
+        cache.lru_head->lru_prev = entry;
+    cache.lru_head = entry;
+    if (cache.lru_tail == NULL)
+        cache.lru_tail = entry;
+}
+
+// Saca una entrada de la tabla y de la lista. Se llama con el candado tomado.
+void cache_remove(CacheEntry *entry)
+{
+    CacheEntry **link = &cache.buckets[hash_function(entry->key) % CACHE_BUCKETS];
+    while (*link != entry)
+        link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    lru_unlink(entry);
+    cache.used -= entry->cost;
+    cache.entries--;
+
+    if (entry->refs == 0)
+        cache_free_entry(entry);
+    else
+        entry->evicted = 1;
+}
+
+// Vacía la caché porque se cargó la generación 'generation' del índice. Las respuestas que se
+// calculan con una generación anterior ya no se guardan (ver cache_insert).
+void cache_invalidate(unsigned long generation)
+{
+    pthread_mutex_lock(&cache.lock);
+    while (cache.lru_head)
+        cache_remove(cache.lru_head);
+    cache.generation = generation;
+    cache.invalidations++;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// Busca una respuesta guardada para una consulta sobre la generación 'generation' del índice.
+// Si la encuentra la marca como en uso (hay que soltarla con cache_release) y devuelve la
+// entrada; si no, devuelve NULL. Las entradas solo valen para la generación de la caché.
+CacheEntry *cache_acquire(const char *key, unsigned long generation)
+{
+    if (cache.budget == 0)
+        return NULL;
+
+    pthread_mutex_lock(&cache.lock);
+    CacheEntry *entry = NULL;
+    if (generation == cache.generation)
+        entry = cache.buckets[hash_function(key) % CACHE_BUCKETS];
+    while (entry && strcmp(entry->key, key) != 0)
+        entry = entry->hash_next;
+
+    if (entry)
+    {
+        entry->refs++;
+        lru_unlink(entry);
+        lru_push_front(entry);
+        cache.hits++;
+    }
+    else
+    {
+        cache.misses++;
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return entry;
+}
+
+void cache_release(CacheEntry *entry)
+{
+    pthread_mutex_lock(&cache.lock);
+    entry->refs--;
+    int release = entry->evicted && entry->refs == 0;
+    pthread_mutex_unlock(&cache.lock);
+    if (release)
+        cache_free_entry(entry);
+}
+
+// Tamaño máximo de una respuesta que vale la pena guardar: una sola no puede ocupar toda la caché
+size_t cache_max_entry(void)
+{
+    return cache.budget / 4;
+}
+
+// Guarda una respuesta recién calculada con la generación 'generation' del índice. Si la caché
+// ya es de otra generación, la respuesta viene del índice viejo y no se guarda.
+void cache_insert(const char *key, const char *data, size_t len, long rows, unsigned long generation)
+{
+    size_t cost = sizeof(CacheEntry) + strlen(key) + 1 + len;
+    if (cache.budget == 0 || cost > cache_max_entry())
+        return;
+
+    // La copia se hace fuera del candado
+    CacheEntry *entry = calloc(1, sizeof(CacheEntry));
+    char *key_copy = strdup(key);
+    char *data_copy = malloc(len > 0 ? len : 1);
+    if (entry == NULL || key_copy == NULL || data_copy == NULL)
+    {
+        free(entry);
+        free(key_copy);
+        free(data_copy);
+        return;
+    }
+    memcpy(data_copy, data, len);
+    entry->key = key_copy;
+    entry->data = data_copy;
+    entry->len = len;
+    entry->rows = rows;
+    entry->cost = cost;
+
+    pthread_mutex_lock(&cache.lock);
+    unsigned long bucket = hash_function(key) % CACHE_BUCKETS;
+    CacheEntry *existing = cache.buckets[bucket];
+    while (existing && strcmp(existing->key, key) != 0)
+        existing = existing->hash_next;
+
+    if (generation != cache.generation || existing != NULL)
+    {
+        // Otro hilo ya la guardó, o la respuesta es de antes de la invalidación
+        pthread_mutex_unlock(&cache.lock);
+        cache_free_entry(entry);
+        return;
+    }
+
+    while (cache.used + cost > cache.budget && cache.lru_tail)
+    {
+        cache_remove(cache.lru_tail);
+        cache.evictions++;
+    }
+    entry->hash_next = cache.buckets[bucket];
+    cache.buckets[bucket] = entry;
+    lru_push_front(entry);
+    cache.used += cost;
+    cache.entries++;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// Escribe los contadores de la caché en 'out'
+void cache_stats(char *out, size_t size)
+{
+    pthread_mutex_lock(&cache.lock);
+    long lookups = cache.hits + cache.misses;
+    snprintf(out, size,
+             "Caché: %ld aciertos, %ld fallos (%.1f%% de aciertos), %ld entradas, %zu de %zu bytes, %ld desalojos, %ld invalidaciones\n",
+             cache.hits, cache.misses, lookups ? 100.0 * cache.hits / lookups : 0.0,
+             cache.entries, cache.used, cache.budget, cache.evictions, cache.invalidations);
+    pthread_mutex_unlock(&cache.lock);
+}
 
-    buffer_size = 256; // Empezamos con un tamaño inicial
-    line = malloc(buffer_size);
+// Escribe con 'writer' las métricas acumuladas de las búsquedas. Se copian bajo el candado
+// y se formatean fuera de él, porque escribir puede enviar tramas.
+void stats_report(ResponseWriter *writer)
+{
+    ServerStats *copy = arena_alloc(&writer->arena, sizeof(ServerStats));
+    if (copy == NULL)
+    {
+        writer_append_str(writer, "Error: no hay memoria para las métricas.\n");
+        return;
+    }
+    pthread_mutex_lock(&stats.lock);
+    memcpy(copy, &stats, sizeof(ServerStats));
+    pthread_mutex_unlock(&stats.lock);
+
+    char line[512];
+    long queries = copy->queries;
+    long computed = queries - copy->cache_hits;
+    snprintf(line, sizeof(line), "Búsquedas: %ld (%ld desde la caché), %.3f ms en promedio, p50 <= %ld us, p99 <= %ld us, p999 <= %ld us\n",
+             queries, copy->cache_hits, queries ? copy->total_ns / 1e6 / queries : 0.0,
+             stats_percentile(copy->total_hist, queries, 0.50), stats_percentile(copy->total_hist, queries, 0.99),
+             stats_percentile(copy->total_hist, queries, 0.999));
+    writer_append_str(writer, line);
+
+    writer_append_str(writer, "Fase,total_ms,p50_us,p99_us\n");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        long count = 0;
+        for (int b = 0; b < STATS_BUCKETS; b++)
+            count += copy->phase_hist[p][b];
+        snprintf(line, sizeof(line), "%s,%.3f,%ld,%ld\n", phase_names[p], copy->phase_ns[p] / 1e6,
+                 stats_percentile(copy->phase_hist[p], count, 0.50), stats_percentile(copy->phase_hist[p], count, 0.99));
+        writer_append_str(writer, line);
+    }
+
+    snprintf(line, sizeof(line),
+             "Bloques: p50 <= %ld, p99 <= %ld entradas; el más largo (%ld) fue de %s\n"
+             "Filas: %ld leídas, %ld encontradas; %ld bytes enviados\n",
+             stats_percentile(copy->chain_hist, computed, 0.50), stats_percentile(copy->chain_hist, computed, 0.99),
+             copy->max_chain, copy->max_chain_query[0] ? copy->max_chain_query : "-", copy->rows_read,
+             copy->rows_matched, copy->bytes_sent);
+    writer_append_str(writer, line);
+
+    writer_append_str(writer, "Latencia_us,búsquedas\n");
+    for (int b = 0; b < STATS_BUCKETS; b++)
+    {
+        if (copy->total_hist[b] == 0)
+            continue;
+        snprintf(line, sizeof(line), "<%ld,%ld\n", 1L << b, copy->total_hist[b]);
+        writer_append_str(writer, line);
+    }
+
+    if (copy->slow_threshold_ns > 0)
+    {
+        snprintf(line, sizeof(line), "Lentas (>= %.1f ms): %ld\n", copy->slow_threshold_ns / 1e6, copy->slow_queries);
+        writer_append_str(writer, line);
+        long recent = copy->slow_queries < STATS_RECENT_SLOW ? copy->slow_queries : STATS_RECENT_SLOW;
+        for (long i = 1; i <= recent; i++)
+        {
+            const SlowQuery *entry = &copy->recent_slow[(copy->recent_next - i) % STATS_RECENT_SLOW];
+            snprintf(line, sizeof(line), "%.3f ms, %ld entradas, %ld filas leídas: %s\n", entry->total_ns / 1e6,
+                     entry->chain_length, entry->rows_read, entry->query);
+            writer_append_str(writer, line);
+        }
+    }
+
+    char cache_line[256];
+    cache_stats(cache_line, sizeof(cache_line));
+    writer_append_str(writer, cache_line);
+}
+
+// Añade una fila de resultados (ya terminada en '\n'); antes de la primera va el encabezado
+void append_result_row(ResponseWriter *writer, const char *description, long *found_count, const char *row, size_t len)
+{
+    if (*found_count == 0)
+    {
+        writer_append_str(writer, "Registros encontrados para ");
+        writer_append_str(writer, description);
+        writer_append_str(writer, ":\n");
+        writer_append_str(writer, "BibNumber,ItemBarcode,ItemType,Collection,CallNumber,CheckoutDateTime\n");
+    }
+    // Se envía en cuanto la trama se llena
+    writer_append(writer, row, len);
+    (*found_count)++;
+}
+
+// Número de registro del almacén binario con el que se arma la fila de 'entry', o -1 si la
+// fila se lee del CSV
+long entry_record(const IndexEntry *entry, const char *check_id)
+{
+    if (!indice->has_records || check_id != NULL)
+        return -1;
+    long record = record_find(&indice->records, entry->data_offset);
+    return record >= 0 && !(indice->records.flags[record] & RECORD_FLAG_RAW) ? record : -1;
+}
+
+// 1 si la primera columna de la línea (el BibNumber) es 'id'
+int line_has_id(const char *line, size_t len, const char *id)
+{
+    FieldView fields[2];
+    size_t id_len = strlen(id);
+    return csv_split_line(line, len, fields, 2) == 2 && fields[COL_BIBNUMBER].len == id_len &&
+           memcmp(fields[COL_BIBNUMBER].start, id, id_len) == 0;
+}
+
+// Lee juntas del CSV las filas de 'entries', para que emit_entry_row las encuentre ya en
+// memoria. Si las filas salen del almacén binario no hace falta (las pocas que no se pueden
+// reconstruir se leen del mapeo), y con pocas filas tampoco vale la pena.
+#define FETCH_MIN_ROWS 4
+
+void fetch_entry_rows(ResponseWriter *writer, const IndexEntry *entries, long count, const char *check_id)
+{
+    if (writer->fetch == NULL)
+        return;
+    writer->fetch->row_count = 0;
+    if (count < FETCH_MIN_ROWS || (indice->has_records && check_id == NULL))
+        return;
+
+    trace_enter(&writer->trace, PHASE_FETCH);
+    long offsets[FETCH_MAX_ROWS];
+    int n = 0;
+    for (long i = 0; i < count && n < FETCH_MAX_ROWS; i++)
+        offsets[n++] = entries[i].data_offset;
+    fetch_rows(writer->fetch, offsets, n);
+}
+
+// Escribe la fila de una entrada del índice. Si 'check_id' no es NULL, la fila solo se
+// escribe si su BibNumber es ese (claves derivadas del hash). Devuelve -1 si el offset no es
+// válido.
+int emit_entry_row(ResponseWriter *writer, const IndexEntry *entry, const char *check_id, const char *description,
+                   long *found_count)
+{
+    trace_enter(&writer->trace, PHASE_FETCH);
+    writer->trace.rows_read++;
+
+    // Si la fila está en el almacén binario, se arma desde las columnas sin parsear texto
+    long record = entry_record(entry, check_id);
+    if (record >= 0)
+    {
+        char row[RECORD_MAX_LINE];
+        size_t row_len = format_record(&indice->records, record, row, sizeof(row) - 1);
+        if (row_len > 0)
+        {
+            row[row_len] = '\n';
+            append_result_row(writer, description, found_count, row, row_len + 1);
+            return 0;
+        }
+    }
+
+    // Si no, la línea del CSV: de la tanda que ya leyó fetch_entry_rows o, si no está ahí,
+    // directamente del mapeo. En los dos casos se usa en su lugar, sin copiarla.
+    size_t line_len;
+    const char *line = fetch_lookup(writer->fetch, entry->data_offset, &line_len);
+    int has_newline = 1;
     if (line == NULL)
     {
-        perror("Error: Fallo al asignar memoria para la línea");
-        return NULL;
+        line = mapped_line(entry->data_offset, &line_len);
+        if (line == NULL)
+            return -1;
+        has_newline = line + line_len < indice->csv_data + indice->csv_size;
+    }
+
+    // Con una clave derivada del hash verificamos que el ID del registro (la primera
+    // columna) sea el que buscamos. La fecha ya se filtró con el índice.
+    if (check_id != NULL)
+    {
+        trace_enter(&writer->trace, PHASE_FILTER);
+        if (!line_has_id(line, line_len, check_id))
+            return 0;
+    }
+
+    // Añadimos la línea del CSV; viaja con su salto, que ya la sigue en memoria
+    if (has_newline)
+        append_result_row(writer, description, found_count, line, line_len + 1);
+    else
+    {
+        append_result_row(writer, description, found_count, line, line_len);
+        writer_append(writer, "\n", 1); // Última línea del archivo, sin salto
+    }
+    return 0;
+}
+
+// ---------------------- Consultas con predicados ----------------------
+// Cada condición (el BibNumber o un predicado sobre una columna con índice secundario) se
+// traduce a uno o más bloques de entradas, todos ordenados por (fecha, offset). La
+// intersección se hace sobre los índices: se recorre la condición con menos entradas,
+// ya filtrada por fecha, y cada candidata se busca en los bloques de las demás avanzando
+// siempre hacia adelante. Solo las filas que pasan todas las condiciones se leen.
+
+#define MAX_QUERY_ENTRIES (4L * 1024 * 1024) // Entradas que una consulta puede copiar a memoria
+#define MAX_SCAN_BLOCKS 16 // Con más bloques, una condición se junta en un solo arreglo
+
+// Entradas que cumplen una condición
+typedef struct {
+    const IndexEntry *entries; // Un solo bloque, o la base de los bloques de 'values'
+    const ValueSlot *values;   // Bloques de un índice secundario (NULL si es un solo bloque)
+    long block_count;
+    long total;                // Entradas en todos los bloques
+    IndexEntry *owned;         // Si se juntó en memoria, el arreglo (en la arena de la solicitud)
+    long *cursors;             // Posición de la búsqueda en cada bloque
+} PostingSet;
+
+void posting_block(const PostingSet *set, long block, const IndexEntry **entries, long *count)
+{
+    if (set->values)
+    {
+        *entries = set->entries + set->values[block].start;
+        *count = set->values[block].count;
+    }
+    else
+    {
+        *entries = set->entries;
+        *count = set->total;
+    }
+}
+
+// Orden de las entradas dentro de un bloque
+int compare_entry_order(const IndexEntry *a, long checkout_time, long data_offset)
+{
+    if (a->checkout_time != checkout_time)
+        return a->checkout_time < checkout_time ? -1 : 1;
+    if (a->data_offset != data_offset)
+        return a->data_offset < data_offset ? -1 : 1;
+    return 0;
+}
+
+int compare_entries(const void *a, const void *b)
+{
+    const IndexEntry *eb = b;
+    return compare_entry_order(a, eb->checkout_time, eb->data_offset);
+}
+
+// Compara el texto del valor 'i' con 'text'. Con 'prefix', un valor que empieza con 'text' es igual.
+int compare_value(const SecondaryIndex *index, long i, const char *text, size_t len, int prefix)
+{
+    const ValueSlot *value = &index->values[i];
+    size_t common = (size_t)value->name_len < len ? (size_t)value->name_len : len;
+    int cmp = memcmp(index->strings + value->name_offset, text, common);
+    if (cmp != 0)
+        return cmp;
+    if ((size_t)value->name_len == len || (prefix && (size_t)value->name_len > len))
+        return 0;
+    return (size_t)value->name_len < len ? -1 : 1;
+}
+
+// Rango [first, last) de valores de la columna que cumplen el predicado. Como los valores
+// están ordenados, los que empiezan con un prefijo quedan juntos.
+void find_values(const SecondaryIndex *index, const Predicate *predicate, long *first, long *last)
+{
+    size_t len = strlen(predicate->value);
+    int prefix = predicate->op == PRED_PREFIX;
+    long lo = 0, hi = index->value_count;
+    while (lo < hi)
+    {
+        long mid = lo + (hi - lo) / 2;
+        if (compare_value(index, mid, predicate->value, len, prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *first = lo;
+    hi = index->value_count;
+    while (lo < hi)
+    {
+        long mid = lo + (hi - lo) / 2;
+        if (compare_value(index, mid, predicate->value, len, prefix) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *last = lo;
+}
+
+// Copia a un solo arreglo ordenado las entradas de la condición que caen en los filtros de
+// fecha. Devuelve 0 si todo salió bien y -1 si son más de MAX_QUERY_ENTRIES o no hay memoria.
+int gather_postings(PostingSet *set, const SearchQuery *query, Arena *arena)
+{
+    long capacity = set->total < MAX_QUERY_ENTRIES ? set->total : MAX_QUERY_ENTRIES;
+    IndexEntry *gathered = arena_alloc(arena, sizeof(IndexEntry) * capacity);
+    if (gathered == NULL)
+        return -1;
+
+    long count = 0;
+    long ranges[MAX_DATE_RANGES][2];
+    for (long block = 0; block < set->block_count; block++)
+    {
+        const IndexEntry *entries;
+        long entry_count;
+        posting_block(set, block, &entries, &entry_count);
+        int range_count = build_date_ranges(query, entries, entry_count, ranges);
+        for (int r = 0; r < range_count; r++)
+        {
+            long first = lower_bound_time(entries, entry_count, ranges[r][0]);
+            long last = lower_bound_time(entries, entry_count, ranges[r][1]);
+            if (count + (last - first) > capacity)
+                return -1; // El arreglo se libera con el resto de la solicitud
+            memcpy(gathered + count, entries + first, sizeof(IndexEntry) * (last - first));
+            count += last - first;
+        }
+    }
+    if (set->block_count > 1)
+        qsort(gathered, count, sizeof(IndexEntry), compare_entries);
+
+    set->owned = gathered;
+    set->entries = gathered;
+    set->values = NULL;
+    set->block_count = 1;
+    set->total = count;
+    return 0;
+}
+
+// 1 si la entrada está en la condición. Las candidatas llegan en orden, así que cada bloque
+// se sigue buscando desde donde quedó la búsqueda anterior.
+int posting_contains(PostingSet *set, const IndexEntry *candidate)
+{
+    for (long block = 0; block < set->block_count; block++)
+    {
+        const IndexEntry *entries;
+        long count;
+        posting_block(set, block, &entries, &count);
+        long lo = set->cursors[block], hi = count;
+        while (lo < hi)
+        {
+            long mid = lo + (hi - lo) / 2;
+            if (compare_entry_order(&entries[mid], candidate->checkout_time, candidate->data_offset) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        set->cursors[block] = lo;
+        if (lo < count && compare_entry_order(&entries[lo], candidate->checkout_time, candidate->data_offset) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// ---------------------- Paginación ----------------------
+// Una página (REQ_PAGE) termina al juntar las filas pedidas o al revisar PAGE_MAX_SCAN
+// entradas, así el trabajo de cada solicitud tiene un tope sin importar cuán popular sea el
+// título. El cursor guarda la posición en el bloque recorrido y la fecha y el offset de la
+// última entrada revisada: la página siguiente retoma ahí sin volver a revisar las anteriores.
+
+#define PAGE_MAX_SCAN (1L << 20) // Entradas que una página revisa como máximo
+
+// Primera entrada de 'entries' que le toca a la página. Si la posición del cursor ya no
+// corresponde a su fecha y offset (el índice se reconstruyó), se busca por ellos.
+long page_start(const IndexEntry *entries, long count, const SearchQuery *query)
+{
+    if (!query->has_cursor)
+        return 0;
+    const PageCursor *cursor = &query->cursor;
+    if (cursor->position > 0 && cursor->position <= count &&
+        compare_entry_order(&entries[cursor->position - 1], cursor->checkout_time, cursor->data_offset) == 0)
+        return cursor->position;
+
+    long lo = 0, hi = count;
+    while (lo < hi)
+    {
+        long mid = lo + (hi - lo) / 2;
+        if (compare_entry_order(&entries[mid], cursor->checkout_time, cursor->data_offset) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Se llama después de revisar la entrada 'i'. Devuelve 1 si la página ya está completa y,
+// si quedan entradas, deja el cursor de la siguiente en 'writer'.
+int page_full(ResponseWriter *writer, const SearchQuery *query, const IndexEntry *entries, long count, long i,
+              long found_count, long *scanned)
+{
+    if (query->limit == 0)
+        return 0;
+    (*scanned)++;
+    if (found_count < query->limit && *scanned < PAGE_MAX_SCAN)
+        return 0;
+    if (i + 1 < count)
+    {
+        writer->has_next = 1;
+        writer->next = (PageCursor){i + 1, entries[i].checkout_time, entries[i].data_offset};
+    }
+    return 1;
+}
+
+// Mensaje de una página sin filas. Devuelve 0 si la consulta no es paginada y lleva el mensaje de siempre.
+int page_empty_message(ResponseWriter *writer, const SearchQuery *query, const char *description)
+{
+    if (writer->has_next)
+    {
+        writer_append_str(writer, "Ninguna coincidencia en las entradas revisadas; la búsqueda sigue en la página siguiente.");
+        return 1;
+    }
+    if (query->has_cursor)
+    {
+        writer_append_str(writer, "No hay más registros para ");
+        writer_append_str(writer, description);
+        writer_append_str(writer, ".");
+        return 1;
+    }
+    return 0;
+}
+
+// Describe la consulta para los mensajes: "el ID '123', Collection = 'namys', ..."
+void describe_query(const SearchQuery *query, char *out, size_t size)
+{
+    size_t len = 0;
+    out[0] = '\0';
+    if (query->id[0] != '\0')
+        len += snprintf(out, size, "el ID '%s'", query->id);
+    for (int i = 0; i < query->predicate_count && len < size; i++)
+    {
+        const Predicate *predicate = &query->predicates[i];
+        len += snprintf(out + len, size - len, "%s%s %s '%s'", len > 0 ? ", " : "", column_name(predicate->column),
+                        predicate->op == PRED_PREFIX ? "empieza con" : "=", predicate->value);
+    }
+}
+
+// Busca las filas que cumplen todas las condiciones de la consulta. Devuelve cuántas filas
+// hubo, o -1 (sin escribir nada) si la consulta abarca demasiadas entradas.
+long search_predicates(ResponseWriter *writer, const SearchQuery *query)
+{
+    PostingSet sets[MAX_PREDICATES + 1];
+    int set_count = 0;
+    trace_enter(&writer->trace, PHASE_LOOKUP);
+    int empty = periodo_vacio(query);
+    const char *check_id = NULL;
+
+    // El ID, si lo hay, es una condición de un solo bloque
+    if (query->id[0] != '\0' && !empty)
+    {
+        long key = index_key(query->id, strlen(query->id));
+        const KeySlot *slot = NULL;
+        if (!indice->bloom_words || bloom_may_contain(indice->bloom_words, indice->bloom_bits, indice->bloom_hashes, key))
+            slot = find_key(indice->key_table, indice->table_size, key);
+        if (slot == NULL)
+            empty = 1;
+        else
+            sets[set_count++] = (PostingSet){indice->index_entries + slot->start, NULL, 1, slot->count, NULL, NULL};
+        if (!key_is_exact(key))
+            check_id = query->id;
+    }
+    for (int i = 0; i < query->predicate_count && !empty; i++)
+    {
+        const SecondaryIndex *index = &indice->secondary[query->predicates[i].column];
+        long first, last;
+        find_values(index, &query->predicates[i], &first, &last);
+        if (first == last)
+        {
+            empty = 1;
+            break;
+        }
+        const ValueSlot *values = index->values + first;
+        long total = values[last - first - 1].start + values[last - first - 1].count - values[0].start;
+        if (last - first == 1)
+            sets[set_count++] = (PostingSet){index->entries + values[0].start, NULL, 1, total, NULL, NULL};
+        else
+            sets[set_count++] = (PostingSet){index->entries, values, last - first, total, NULL, NULL};
+    }
+
+    // La condición con menos entradas es la que se recorre
+    int driver = 0;
+    for (int i = 1; i < set_count; i++)
+    {
+        if (sets[i].total < sets[driver].total)
+            driver = i;
+    }
+
+    int too_broad = 0;
+    trace_enter(&writer->trace, PHASE_WALK);
+    if (!empty)
+    {
+        // La que se recorre tiene que quedar en orden; si tiene varios bloques se junta
+        // en memoria. Las demás se juntan solo si tienen demasiados bloques para buscar en
+        // cada uno; si no caben, se sigue buscando bloque por bloque.
+        for (int i = 0; i < set_count && !too_broad; i++)
+        {
+            if (i == driver && sets[i].block_count > 1)
+                too_broad = gather_postings(&sets[i], query, &writer->arena) < 0;
+            else if (i != driver && sets[i].block_count > MAX_SCAN_BLOCKS)
+                gather_postings(&sets[i], query, &writer->arena);
+        }
+        for (int i = 0; i < set_count && !too_broad; i++)
+        {
+            sets[i].cursors = arena_alloc(&writer->arena, sizeof(long) * sets[i].block_count);
+            too_broad = sets[i].cursors == NULL;
+            if (!too_broad)
+                memset(sets[i].cursors, 0, sizeof(long) * sets[i].block_count);
+        }
+    }
+
+    long found_count = 0;
+    char description[PREDICATE_VALUE_LEN * MAX_PREDICATES + 512];
+    describe_query(query, description, sizeof(description));
+
+    if (!empty && !too_broad)
+    {
+        const IndexEntry *entries = sets[driver].entries;
+        long count = sets[driver].total;
+        writer->trace.chain_length = count;
+        long ranges[MAX_DATE_RANGES][2];
+        // Si la condición ya se juntó, sus entradas ya están filtradas por fecha
+        int range_count = sets[driver].owned ? 1 : build_date_ranges(query, entries, count, ranges);
+        long start = page_start(entries, count, query);
+        long scanned = 0;
+        int page_done = 0;
+        for (int r = 0; r < range_count && !writer->error && !page_done; r++)
+        {
+            long first = sets[driver].owned ? 0 : lower_bound_time(entries, count, ranges[r][0]);
+            long last = sets[driver].owned ? count : lower_bound_time(entries, count, ranges[r][1]);
+            if (first < start)
+                first = start;
+            for (long i = first; i < last && !writer->error; i++)
+            {
+                trace_enter(&writer->trace, PHASE_FILTER);
+                int matches = 1;
+                for (int s = 0; s < set_count && matches; s++)
+                {
+                    if (s != driver)
+                        matches = posting_contains(&sets[s], &entries[i]);
+                }
+                if (matches && emit_entry_row(writer, &entries[i], check_id, description, &found_count) < 0)
+                    break;
+                if (page_full(writer, query, entries, count, i, found_count, &scanned))
+                {
+                    page_done = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (too_broad)
+        return -1;
+
+    if (found_count == 0 && !page_empty_message(writer, query, description))
+    {
+        writer_append_str(writer, "No hay registros para ");
+        writer_append_str(writer, description);
+        if (query->year > 0 || query->month > 0 || query->date_from != 0 || query->date_to != 0)
+            writer_append_str(writer, " con los filtros de fecha");
+        writer_append_str(writer, ".");
+    }
+    return found_count;
+}
+
+// Esta función realiza la búsqueda del ID en el índice residente y filtra por año, mes o rango de fechas.
+// Los filtros se resuelven con búsquedas binarias sobre las fechas guardadas en el índice,
+// así que solo se leen del CSV las filas que caen dentro del rango pedido.
+// Escribe las filas (o el mensaje de "no encontrado") con 'writer' y devuelve cuántas filas hubo,
+// o -1 (sin escribir nada) si la consulta no se puede resolver.
+long search_index(ResponseWriter *writer, const SearchQuery *query)
+{
+    if (query->predicate_count > 0)
+        return search_predicates(writer, query);
+
+    const char *id_to_find = query->id;
+    int has_date_filter = query->year > 0 || query->month > 0 || query->date_from != 0 || query->date_to != 0;
+
+    // Buscar la clave del ID en la tabla ya mapeada. Si no está, no hay registros con ese ID
+    // y se responde sin tocar el CSV. El filtro de Bloom descarta antes, sin salir de la
+    // memoria del proceso, casi todos los IDs que no existen. Si según el manifiesto nadie
+    // tiene préstamos en el año pedido, ni siquiera hace falta buscar la clave.
+    trace_enter(&writer->trace, PHASE_LOOKUP);
+    long key = index_key(id_to_find, strlen(id_to_find));
+    const KeySlot *slot = NULL;
+    if (!periodo_vacio(query) &&
+        (!indice->bloom_words || bloom_may_contain(indice->bloom_words, indice->bloom_bits, indice->bloom_hashes, key)))
+        slot = find_key(indice->key_table, indice->table_size, key);
+
+    // Con una clave numérica todas las entradas del bloque son del ID buscado; con una clave
+    // derivada del hash hay que confirmar el ID en el CSV
+    int exact_key = key_is_exact(key);
+
+    long found_count = 0;
+    char description[300];
+    snprintf(description, sizeof(description), "el ID '%s'", id_to_find);
+
+    // El bloque contiguo de postings de la clave está ordenado por fecha
+    // Cada entrada contiene un offset al registro en el CSV(el offset es como la dirección de memoria del registro en el CSV)
+    const IndexEntry *bucket = slot ? indice->index_entries + slot->start : NULL;
+    long bucket_count = slot ? slot->count : 0;
+    writer->trace.chain_length = bucket_count;
+
+    trace_enter(&writer->trace, PHASE_WALK);
+    long ranges[MAX_DATE_RANGES][2];
+    int range_count = bucket_count > 0 ? build_date_ranges(query, bucket, bucket_count, ranges) : 0;
+
+    long start = page_start(bucket, bucket_count, query);
+    long scanned = 0;
+    int page_done = 0;
+    for (int range_idx = 0; range_idx < range_count && !writer->error && !page_done; range_idx++)
+    {
+        // Solo recorremos las entradas cuya fecha cae en [from, to)
+        trace_enter(&writer->trace, PHASE_WALK);
+        long first = lower_bound_time(bucket, bucket_count, ranges[range_idx][0]);
+        long last = lower_bound_time(bucket, bucket_count, ranges[range_idx][1]);
+        if (first < start)
+            first = start;
+
+        // Las filas se leen del CSV por tandas, todas a la vez, y se escriben en orden de fecha.
+        // En una página no se leen más filas de las que faltan para llenarla.
+        int range_done = 0;
+        for (long i = first; i < last && !writer->error && !range_done && !page_done;)
+        {
+            long window = last - i < FETCH_MAX_ROWS ? last - i : FETCH_MAX_ROWS;
+            if (query->limit > 0 && exact_key && window > query->limit - found_count)
+                window = query->limit - found_count;
+            fetch_entry_rows(writer, &bucket[i], window, exact_key ? NULL : id_to_find);
+
+            for (long end = i + window; i < end && !writer->error; i++)
+            {
+                if (emit_entry_row(writer, &bucket[i], exact_key ? NULL : id_to_find, description, &found_count) < 0)
+                {
+                    range_done = 1; // Offset inválido
+                    break;
+                }
+                if (page_full(writer, query, bucket, bucket_count, i, found_count, &scanned))
+                {
+                    page_done = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (found_count == 0 && !page_empty_message(writer, query, description))
+    {
+        // No hubo coincidencias: el único contenido de la respuesta es el mensaje
+        writer_append_str(writer, "ID '");
+        writer_append_str(writer, id_to_find);
+        writer_append_str(writer, "' no encontrado");
+        if (has_date_filter)
+        {
+            writer_append_str(writer, " o no hay registros que coincidan con los filtros de fecha.");
+        }
+    }
+
+    return found_count;
+}
+
+// ---------------------- Búsquedas por lotes ----------------------
+// REQ_BATCH resuelve muchos IDs en una sola solicitud. Antes de escribir las filas se juntan
+// los offsets de todas las entradas que se van a leer, se ordenan y se agrupan en tramos
+// contiguos (dos filas a menos de BATCH_COALESCE_GAP bytes van en el mismo tramo). Cada tramo
+// se pide al kernel con MADV_WILLNEED, que lo lee de una vez en lecturas grandes y
+// secuenciales en vez de una falla de página por fila. Después las filas se escriben por
+// ID, en el orden de la solicitud y por fecha, sobre páginas que ya están en memoria.
+
+#define BATCH_COALESCE_GAP (256 * 1024) // Hueco máximo entre filas de un mismo tramo del CSV
+#define BATCH_COALESCE_RECORDS 4096     // Lo mismo en registros del almacén binario
+#define BATCH_ROW_ESTIMATE 512          // Bytes que se suponen por fila al final de un tramo
+
+// Clave resuelta de un ID del lote
+typedef struct {
+    char id[256];
+    const IndexEntry *bucket; // Entradas del ID ordenadas por fecha (NULL si no existe)
+    long count;
+    long selected; // Entradas que pasan los filtros de fecha
+    int exact_key;
+} BatchItem;
+
+int compare_longs(const void *a, const void *b)
+{
+    long la = *(const long *)a, lb = *(const long *)b;
+    return la < lb ? -1 : la > lb;
+}
+
+// Pide al kernel que lea [start, start + len) de un archivo mapeado
+void advise_willneed(const char *start, size_t len)
+{
+    static long page_size = 0;
+    if (page_size == 0)
+        page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t aligned = (uintptr_t)start & ~(uintptr_t)(page_size - 1);
+    madvise((void *)aligned, len + ((uintptr_t)start - aligned), MADV_WILLNEED);
+}
+
+// Adelanta la lectura de los registros [first, last] en todas las columnas del almacén
+void prefetch_records(long first, long last)
+{
+    const RecordStore *store = &indice->records;
+    long n = last - first + 1;
+    advise_willneed((const char *)(store->csv_offset + first), n * sizeof(long));
+    advise_willneed((const char *)(store->item_barcode + first), n * sizeof(uint64_t));
+    advise_willneed((const char *)(store->checkout_time + first), n * sizeof(uint32_t));
+    advise_willneed((const char *)(store->bib_number + first), n * sizeof(uint32_t));
+    advise_willneed((const char *)(store->call_start + first), (n + 1) * sizeof(uint32_t));
+    advise_willneed((const char *)(store->item_type + first), n * sizeof(uint16_t));
+    advise_willneed((const char *)(store->collection + first), n * sizeof(uint16_t));
+    advise_willneed((const char *)(store->barcode_digits + first), n);
+    advise_willneed((const char *)(store->flags + first), n);
+    advise_willneed(store->heap + store->call_start[first], store->call_start[last + 1] - store->call_start[first]);
+}
+
+// Agrupa los offsets (ya ordenados) en tramos y adelanta su lectura. Devuelve cuántos tramos hubo.
+long prefetch_rows(const long *offsets, long count)
+{
+    long spans = 0;
+    if (indice->has_records)
+    {
+        // En el almacén los registros están en el orden del CSV, así que quedan ordenados
+        long first = -1, last = -1;
+        for (long i = 0; i <= count; i++)
+        {
+            long record = i < count ? record_find(&indice->records, offsets[i]) : -1;
+            if (i < count && record < 0)
+                continue; // Fila que no está en el almacén: se leerá del CSV
+            if (first >= 0 && (i == count || record > last + BATCH_COALESCE_RECORDS))
+            {
+                prefetch_records(first, last);
+                spans++;
+                first = -1;
+            }
+            if (i < count)
+            {
+                if (first < 0)
+                    first = record;
+                last = record;
+            }
+        }
+        return spans;
+    }
+
+    long start = -1, end = -1;
+    for (long i = 0; i <= count; i++)
+    {
+        if (start >= 0 && (i == count || offsets[i] > end + BATCH_COALESCE_GAP))
+        {
+            long limit = end < (long)indice->csv_size ? end : (long)indice->csv_size;
+            advise_willneed(indice->csv_data + start, limit - start);
+            spans++;
+            start = -1;
+        }
+        if (i < count && offsets[i] >= 0 && (size_t)offsets[i] < indice->csv_size)
+        {
+            if (start < 0)
+                start = offsets[i];
+            end = offsets[i] + BATCH_ROW_ESTIMATE;
+        }
+    }
+    return spans;
+}
+
+// Escribe las filas de todos los IDs del lote, agrupadas por ID. Devuelve cuántas filas hubo,
+// o -1 (sin escribir nada) si el lote abarca demasiadas entradas o no hay memoria.
+long search_batch(ResponseWriter *writer, const SearchQuery *filters, const unsigned char *payload, long ids_pos,
+                  uint32_t id_count)
+{
+    BatchItem *items = arena_alloc(&writer->arena, sizeof(BatchItem) * id_count);
+    if (items == NULL)
+        return -1;
+
+    // 1. Resolver las claves, igual que search_index
+    trace_enter(&writer->trace, PHASE_LOOKUP);
+    int empty = periodo_vacio(filters);
+    int has_date_filter = filters->year > 0 || filters->month > 0 || filters->date_from != 0 || filters->date_to != 0;
+    long pos = ids_pos;
+    for (uint32_t i = 0; i < id_count; i++)
+    {
+        BatchItem *item = &items[i];
+        pos = batch_next_id(payload, pos, item->id);
+        long key = index_key(item->id, strlen(item->id));
+        const KeySlot *slot = NULL;
+        if (!empty &&
+            (!indice->bloom_words || bloom_may_contain(indice->bloom_words, indice->bloom_bits, indice->bloom_hashes, key)))
+            slot = find_key(indice->key_table, indice->table_size, key);
+        item->bucket = slot ? indice->index_entries + slot->start : NULL;
+        item->count = slot ? slot->count : 0;
+        item->exact_key = key_is_exact(key);
+    }
+
+    // 2. Juntar los offsets de las filas que se van a leer, ordenarlos y adelantar su lectura.
+    // El límite se aplica a las entradas que pasan los filtros de fecha, así que acotar las
+    // fechas siempre sirve para que un lote grande entre.
+    trace_enter(&writer->trace, PHASE_WALK);
+    long ranges[MAX_DATE_RANGES][2];
+    long total = 0;
+    for (uint32_t i = 0; i < id_count; i++)
+    {
+        BatchItem *item = &items[i];
+        int range_count = item->count > 0 ? build_date_ranges(filters, item->bucket, item->count, ranges) : 0;
+        item->selected = 0;
+        for (int r = 0; r < range_count; r++)
+            item->selected += lower_bound_time(item->bucket, item->count, ranges[r][1]) -
+                              lower_bound_time(item->bucket, item->count, ranges[r][0]);
+        total += item->selected;
+    }
+    long *offsets = total <= MAX_QUERY_ENTRIES ? arena_alloc(&writer->arena, sizeof(long) * total) : NULL;
+    if (offsets == NULL)
+        return -1;
+    long offset_count = 0;
+    for (uint32_t i = 0; i < id_count; i++)
+    {
+        const BatchItem *item = &items[i];
+        if (item->selected == 0)
+            continue;
+        int range_count = build_date_ranges(filters, item->bucket, item->count, ranges);
+        for (int r = 0; r < range_count; r++)
+        {
+            long first = lower_bound_time(item->bucket, item->count, ranges[r][0]);
+            long last = lower_bound_time(item->bucket, item->count, ranges[r][1]);
+            for (long e = first; e < last; e++)
+                offsets[offset_count++] = item->bucket[e].data_offset;
+        }
+    }
+    qsort(offsets, offset_count, sizeof(long), compare_longs);
+    prefetch_rows(offsets, offset_count);
+    writer->trace.chain_length = offset_count;
+
+    // 3. Escribir las filas de cada ID por fecha
+    long found_total = 0;
+    for (uint32_t i = 0; i < id_count && !writer->error; i++)
+    {
+        const BatchItem *item = &items[i];
+        long found_count = 0;
+        char description[300];
+        snprintf(description, sizeof(description), "el ID '%s'", item->id);
+
+        int range_count = item->count > 0 ? build_date_ranges(filters, item->bucket, item->count, ranges) : 0;
+        for (int r = 0; r < range_count && !writer->error; r++)
+        {
+            trace_enter(&writer->trace, PHASE_WALK);
+            long first = lower_bound_time(item->bucket, item->count, ranges[r][0]);
+            long last = lower_bound_time(item->bucket, item->count, ranges[r][1]);
+            for (long e = first; e < last && !writer->error; e++)
+            {
+                if (emit_entry_row(writer, &item->bucket[e], item->exact_key ? NULL : item->id, description,
+                                   &found_count) < 0)
+                    break;
+            }
+        }
+        if (found_count == 0)
+        {
+            writer_append_str(writer, "ID '");
+            writer_append_str(writer, item->id);
+            writer_append_str(writer, "' no encontrado");
+            if (has_date_filter)
+                writer_append_str(writer, " o no hay registros que coincidan con los filtros de fecha");
+            writer_append_str(writer, ".\n");
+        }
+        found_total += found_count;
+    }
+    return found_total;
+}
+
+// ---------------------- Series y listas de más prestados ----------------------
+// Se contestan desde aggregates.dat sin tocar index.dat ni el CSV (salvo para los IDs cuya
+// clave viene de un hash, que hay que confirmar fila por fila).
+
+// 1 si el mes (año * 12 + mes - 1) pasa los filtros de fecha de la consulta
+int month_selected(const SearchQuery *query, long month)
+{
+    int year = (int)(month / 12);
+    int month_of_year = (int)(month % 12) + 1;
+    if ((query->year > 0 && year != query->year) || (query->month > 0 && month_of_year != query->month))
+        return 0;
+    long from, to;
+    month_range(year, month_of_year, &from, &to);
+    return (query->date_from == 0 || to > query->date_from) && (query->date_to == 0 || from < query->date_to);
+}
+
+// Agrega la fila "AAAA-MM,préstamos" de un mes a la respuesta
+void append_month_row(ResponseWriter *writer, long month, long rows)
+{
+    char row[64];
+    int len = snprintf(row, sizeof(row), "%04ld-%02ld,%ld\n", month / 12, month % 12 + 1, rows);
+    writer_append(writer, row, len);
+}
+
+// Serie de un ID cuya clave viene de un hash: se recorre su bloque de index.dat (ya ordenado
+// por fecha) y se confirma el ID de cada fila en el CSV
+long hashed_id_series(ResponseWriter *writer, const SearchQuery *query, long key)
+{
+    const KeySlot *slot = find_key(indice->key_table, indice->table_size, key);
+    long months = 0, current = -1, rows = 0;
+    for (long i = 0; slot && i < slot->count; i++)
+    {
+        const IndexEntry *entry = &indice->index_entries[slot->start + i];
+        long month = month_index(entry->checkout_time);
+        if (month < 0)
+            continue;
+        size_t line_len;
+        const char *line = mapped_line(entry->data_offset, &line_len);
+        if (line == NULL || !line_has_id(line, line_len, query->id))
+            continue;
+        if (month != current)
+        {
+            if (rows > 0 && month_selected(query, current))
+            {
+                append_month_row(writer, current, rows);
+                months++;
+            }
+            current = month;
+            rows = 0;
+        }
+        rows++;
     }
+    if (rows > 0 && month_selected(query, current))
+    {
+        append_month_row(writer, current, rows);
+        months++;
+    }
+    return months;
+}
+
+// Atiende REQ_SERIES: préstamos por mes de un ID, o de un valor exacto de ItemType o Collection.
+// Devuelve los meses enviados, o -1 (sin escribir nada) si la consulta no es de ese tipo.
+long aggregate_series(ResponseWriter *writer, const SearchQuery *query)
+{
+    const Aggregates *agg = &indice->aggregates;
+    const MonthCount *series = NULL;
+    long series_count = 0;
+    const long *rollup_row = NULL;
+    long months = 0;
 
-    // Leemos carácter por carácter (fgetc) hasta encontrar un salto de línea o EOF(Final del archivo)
-    while ((c = fgetc(stream)) != EOF && c != '\n')
+    if (query->predicate_count == 0)
     {
-        //En caso de que el búfer se llene, lo redimensionamos
-        if (line_len + 1 >= buffer_size)
+        long key = index_key(query->id, strlen(query->id));
+        if (!key_is_exact(key))
+            return hashed_id_series(writer, query, key);
+        const KeySlot *slot = find_key(agg->key_table, agg->header->table_size, key);
+        if (slot)
         {
-            buffer_size *= 2; // Duplicar el tamano es la mejor opción para redimencionar
-            char *new_line = realloc(line, buffer_size); //Copiamos todo lo que teniuamos en el búfer pero ahora con más espacio
-            if (new_line == NULL)
-            {
-                perror("Error: Fallo al redimensionar el búfer");
-                free(line);
-                return NULL;
-            }
-            line = new_line; // Actualizamos el puntero al nuevo búfer
+            series = agg->series + slot->start;
+            series_count = slot->count;
         }
-        line[line_len++] = c; //Construyo la nueva línea, caracter por caracter
     }
-    line[line_len] = '\0'; //Añadimos el carácter nulo al final de la cadena
+    else
+    {
+        const Predicate *predicate = &query->predicates[0];
+        int group = predicate->column == COL_ITEMTYPE ? 0 : predicate->column == COL_COLLECTION ? 1 : -1;
+        if (query->id[0] != '\0' || query->predicate_count != 1 || predicate->op != PRED_EQUALS || group < 0)
+            return -1;
 
-    // Si no leímos nada y llegamos al final del archivo, devolvemos NULL
-    if (line_len == 0 && c == EOF)
-    {   
-        free(line);
-        return NULL;
+        // Los valores de cada grupo están ordenados por texto
+        const ValueSlot *values = agg->rollup_values + (group == 1 ? agg->header->rollup_values[0] : 0);
+        long lo = 0, hi = agg->header->rollup_values[group];
+        size_t len = strlen(predicate->value);
+        while (lo < hi)
+        {
+            long mid = lo + (hi - lo) / 2;
+            size_t name_len = values[mid].name_len;
+            int cmp = memcmp(agg->rollup_strings + values[mid].name_offset, predicate->value, name_len < len ? name_len : len);
+            if (cmp < 0 || (cmp == 0 && name_len < len))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo < agg->header->rollup_values[group] && (size_t)values[lo].name_len == len &&
+            memcmp(agg->rollup_strings + values[lo].name_offset, predicate->value, len) == 0)
+            rollup_row = agg->rollup_rows + values[lo].start * agg->row_width;
     }
 
-    return line; // Devolvemos la línea completa leída
+    for (long i = 0; i < series_count; i++)
+    {
+        if (month_selected(query, series[i].month))
+        {
+            append_month_row(writer, series[i].month, series[i].rows);
+            months++;
+        }
+    }
+    for (long i = 0; rollup_row && i < agg->row_width; i++)
+    {
+        long month = agg->header->first_year * 12 + i;
+        if (rollup_row[i] > 0 && month_selected(query, month))
+        {
+            append_month_row(writer, month, rollup_row[i]);
+            months++;
+        }
+    }
+    return months;
 }
 
-// Esta función se encarga de añadir una cadena a nuestro búfer dinámico, y lo redimensiona si es necesario.
-
-//buffer es el bufer donde se almacenan los datos
-//buffer_pos es la posición actual de escritura en el bufer
-//buffer_size es el tamaño actual del búfer
-//str_to_add es la cadena que queremos añadir al búfer
-char *append_to_buffer(char *buffer, size_t *buffer_pos, size_t *buffer_size, const char *str_to_add)
+// Atiende REQ_TOP: filas "posición,BibNumber,préstamos" del período pedido, de mayor a menor.
+// Devuelve cuántas filas se enviaron.
+long aggregate_top(ResponseWriter *writer, const TopQuery *query)
 {
-    size_t len_to_add = strlen(str_to_add);
-
-    // Comprobamos si necesitamos más espacio. (+1 para el carácter nulo  '\0')
-    if (*buffer_pos + len_to_add + 1 > *buffer_size)
+    const Aggregates *agg = &indice->aggregates;
+    long period = agg_period(agg->header, query->year, query->month);
+    if (period < 0)
+        return 0;
+    const TopEntry *top = agg->top + agg->periods[period].start;
+    long count = agg->periods[period].count < query->limit ? agg->periods[period].count : query->limit;
+    for (long i = 0; i < count && !writer->error; i++)
     {
-        size_t new_size = *buffer_size * 2; // Duplicamos el tamaño
-        // Nos aseguramos de que el nuevo tamaño sea suficiente
-        if (new_size < *buffer_pos + len_to_add + 1)
+        char id[256];
+        if (key_is_exact(top[i].key))
         {
-            new_size = *buffer_pos + len_to_add + 1;
+            snprintf(id, sizeof(id), "%ld", top[i].key);
         }
-        //Redimencionamos el búfer existente, este contienen la misma información pero ahora con más espacio
-        char *new_buffer = realloc(buffer, new_size);
-        if (new_buffer == NULL)
+        else
         {
-            perror("Error: Fallo al redimensionar el búfer");
-            free(buffer); // Liberamos la memoria antigua
-            return NULL;  // Indicamos el error
+            // El texto del ID solo está en el CSV: es la primera columna de una de sus filas
+            size_t line_len = 0;
+            const char *line = mapped_line(top[i].data_offset, &line_len);
+            FieldView field = {"", 0};
+            if (line != NULL)
+                csv_split_line(line, line_len, &field, 1);
+            size_t id_len = field.len < sizeof(id) ? field.len : sizeof(id) - 1;
+            memcpy(id, field.start, id_len);
+            id[id_len] = '\0';
         }
+        char row[320];
+        int len = snprintf(row, sizeof(row), "%ld,%s,%ld\n", i + 1, id, top[i].rows);
+        writer_append(writer, row, len);
+    }
+    return count;
+}
+
+// Cierra la medición de una búsqueda, con la consulta y sus filtros como descripción
+void record_search(ResponseWriter *writer, const SearchQuery *query)
+{
+    char description[STATS_QUERY_LEN];
+    describe_query(query, description, sizeof(description));
+    size_t len = strlen(description);
+    if (query->year > 0 && len < sizeof(description))
+        len += snprintf(description + len, sizeof(description) - len, ", año %d", query->year);
+    if (query->month > 0 && len < sizeof(description))
+        len += snprintf(description + len, sizeof(description) - len, ", mes %d", query->month);
+    if ((query->date_from != 0 || query->date_to != 0) && len < sizeof(description))
+        snprintf(description + len, sizeof(description) - len, ", fechas [%ld, %ld)", query->date_from, query->date_to);
+    stats_record(&writer->trace, description);
+}
+
+// Atiende una búsqueda: primero en la caché y, si no está, en el índice.
+// La respuesta se escribe con 'writer', ya preparado para la conexión y la solicitud;
+// la conexión no se cierra aquí porque puede seguir recibiendo solicitudes.
+void perform_search(ResponseWriter *writer, const SearchQuery *query)
+{
+    trace_start(&writer->trace);
+    trace_enter(&writer->trace, PHASE_CACHE);
+    char key[CACHE_KEY_LEN];
+    cache_key(query, key, sizeof(key));
+
+    // Las páginas no pasan por la caché: su costo ya está acotado y la respuesta depende del cursor
+    CacheEntry *entry = query->limit == 0 ? cache_acquire(key, indice->generation) : NULL;
+    if (entry != NULL)
+    {
+        writer->trace.cache_hit = 1;
+        writer_append_rows(writer, entry->data, entry->len);
+        writer_finish(writer, entry->rows);
+        cache_release(entry);
+        record_search(writer, query);
+        return;
+    }
 
-        // Si realloc tuvo éxito, actualizamos nuestros datos
-        buffer = new_buffer;
-        *buffer_size = new_size;
+    if (query->limit == 0)
+        writer_start_capture(writer, cache_max_entry());
+    long found_count = search_index(writer, query);
+    if (found_count < 0)
+    {
+        writer->capture_limit = 0;
+        send_message_response(writer, "Error: la consulta abarca demasiados registros; agregue más condiciones o filtros de fecha.");
+        record_search(writer, query);
+        return;
     }
 
-    // Copiamos la nueva cadena en la posición correcta
-    strcpy(buffer + *buffer_pos, str_to_add);
-    *buffer_pos += len_to_add; // Actualizamos la posición de escritura
+    //----------Enviar el final de la respuesta al cliente-------------
+    writer_finish(writer, found_count);
 
-    return buffer; // Devolvemos el puntero (pudo haber cambiado por realloc)
+    // Solo se guarda si la respuesta se copió completa
+    trace_enter(&writer->trace, PHASE_CACHE);
+    if (writer->capture_limit > 0 && !writer->error)
+        cache_insert(key, writer->capture, writer->capture_len, found_count, indice->generation);
+    writer->capture_limit = 0;
+    writer->trace.rows_matched = found_count;
+    record_search(writer, query);
 }
 
-// Esta función realiza la búsqueda del ID en el archivo CSV y filtra por año y mes si se proporcionan.
-void perform_search(const char *id_to_find, int filter_year, int filter_month, char *archivo_csv)
+// Interpreta una solicitud de texto "id|año|mes|desde|hasta". Todos los campos salvo el ID son
+// opcionales y pueden ir vacíos; desde y hasta son fechas MM/DD/AAAA y hasta es inclusivo.
+// Devuelve 0 si la solicitud es válida y -1 si no.
+int parse_text_request(char *request, SearchQuery *query)
 {
-    int r;
-    // los 3 archivos necesarios
-    const char *csv_filepath = archivo_csv; // El archivo CSV que contiene los registros
-    const char *header_filepath = "header.dat";
-    const char *index_filepath = "index.dat";
+    char *fields[5] = {NULL, NULL, NULL, NULL, NULL};
+    int field_count = 0;
 
-    // Abrir el archivo de cabecera para leer la tabla hash
-    FILE *header_file = fopen(header_filepath, "rb");
-    if (!header_file)
+    // strsep respeta los campos vacíos ("123||5" tiene año vacío), a diferencia de strtok
+    char *cursor = request;
+    char *token;
+    while (field_count < 5 && (token = strsep(&cursor, "|\r\n")) != NULL)
     {
-        perror("Error abriendo archivo de cabecera");
-        return;
+        fields[field_count++] = token;
     }
 
-    // Leer la tabla hash desde el archivo de cabecera
-    long header_table[HASH_TABLE_SIZE];
-    fread(header_table, sizeof(long), HASH_TABLE_SIZE, header_file);
-    fclose(header_file);
+    memset(query, 0, sizeof(*query));
+    if (fields[0] == NULL || fields[0][0] == '\0')
+        return -1;
+    strncpy(query->id, fields[0], sizeof(query->id) - 1);
 
-    // Buscar el ID (que ya se paso por parametro a la funcion) en la tabla hash
-    unsigned int hash_index = hash_function(id_to_find) % HASH_TABLE_SIZE;
+    // convertir el mes y el año a enteros (si están vacíos, se convierten a 0)
+    query->year = (fields[1] && fields[1][0]) ? atoi(fields[1]) : 0;
+    query->month = (fields[2] && fields[2][0]) ? atoi(fields[2]) : 0;
+    if (query->month < 0 || query->month > 12)
+        return -1;
 
-    // Obtener la posición del primer nodo en la lista enlazada
-    // Si no hay nodos, significa que no hay registros con ese ID y eso pasa si el offset es -1(definicion en la inicializacion de la tabla hash)
-    long current_node_offset = header_table[hash_index];
+    if (fields[3] && fields[3][0])
+    {
+        query->date_from = parse_checkout_datetime(fields[3]);
+        if (query->date_from < 0)
+            return -1;
+    }
+    if (fields[4] && fields[4][0])
+    {
+        long to_day = parse_checkout_datetime(fields[4]);
+        if (to_day < 0)
+            return -1;
+        query->date_to = to_day + 86400; // Incluimos el día completo
+    }
+    return 0;
+}
 
-    if (current_node_offset == -1)
+// ---------------------- Recarga del índice ----------------------
+// Un hilo revisa cada INDEX_CHECK_INTERVAL segundos si cambió alguno de los archivos que
+// reemplazan el constructor, juntar o convertir. Cuando un cambio lleva un intervalo sin
+// moverse (así no se carga un CSV a medio escribir) y no hay una actualización a medio
+// confirmar, carga una generación nueva del índice aparte, sin frenar las consultas, y la
+// pone como actual. Si la generación nueva no carga, se sigue con la anterior.
+//
+// Cada solicitud toma una referencia a la generación actual al empezar (index_acquire) y la
+// usa hasta terminar, aunque entretanto se cargue otra; su CSV y su descriptor para fetch.h
+// son parte de la generación. La generación reemplazada se desmapea cuando la suelta la
+// última solicitud que la usaba. Así ninguna solicitud espera a otra: un cliente lento solo
+// retrasa que se libere la memoria del índice anterior.
+
+#define INDEX_CHECK_INTERVAL 1 // Segundos entre revisiones de los archivos del índice
+#define INDEX_WATCHED_FILES 4
+
+// Identidad de un archivo del índice: si cambia, hay que volver a cargarlo
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} FileSignature;
+
+const char *index_watched_files[INDEX_WATCHED_FILES] = {"header.dat", "index.dat", "DataC.csv", "records.dat"};
+
+MappedIndex *current_index;                          // La generación que toman las solicitudes nuevas
+pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER; // Protege current_index y los refs
+FileSignature loaded_files[INDEX_WATCHED_FILES]; // Cómo estaban los archivos al cargar el índice en uso
+
+void read_signatures(FileSignature *files)
+{
+    for (int i = 0; i < INDEX_WATCHED_FILES; i++)
     {
-        // No hay registros con ese ID en la tabla hash
-        // Enviar mensaje de error al frontend
-        char not_found_msg[256];
-        snprintf(not_found_msg, sizeof(not_found_msg),
-                 "ID '%s' no encontrado.", id_to_find);
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        stat(index_watched_files[i], &st); // Si el archivo desapareció, la firma queda en ceros y también cuenta como cambio
+        files[i].dev = st.st_dev;
+        files[i].ino = st.st_ino;
+        files[i].size = st.st_size;
+        files[i].mtime = st.st_mtim;
+    }
+}
 
-        /*
-        int fd = open(OUTPUT_PIPE, O_WRONLY);
-        write(fd, not_found_msg, strlen(not_found_msg) + 1);
-        close(fd);
-        */
-        //----------Enviar un mensaje al cliente-------------
+int same_signatures(const FileSignature *a, const FileSignature *b)
+{
+    for (int i = 0; i < INDEX_WATCHED_FILES; i++)
+        if (a[i].dev != b[i].dev || a[i].ino != b[i].ino || a[i].size != b[i].size ||
+            a[i].mtime.tv_sec != b[i].mtime.tv_sec || a[i].mtime.tv_nsec != b[i].mtime.tv_nsec)
+            return 0;
+    return 1;
+}
 
-        r = send(clientfd, not_found_msg,sizeof(not_found_msg), 0);
-        if (r < 0) {
-            perror("Error al enviar datos al cliente");
-            close(clientfd);
-            close(serverfd);
-            return;
-        }
-        return;
+// Carga todos los archivos del índice en 'idx'. Devuelve -1 si falta alguno de los obligatorios.
+int cargar_generacion(MappedIndex *idx)
+{
+    if (cargar_indice(idx, "header.dat", "index.dat", "bloom.dat", "years.dat", "DataC.csv", "records.dat") < 0)
+        return -1;
+    cargar_indices_secundarios(idx);
+    cargar_agregados(idx, "aggregates.dat");
+    return 0;
+}
+
+// Suelta una referencia a una generación; la última libera la generación
+void index_drop(MappedIndex *idx)
+{
+    pthread_mutex_lock(&index_lock);
+    int last = --idx->refs == 0;
+    pthread_mutex_unlock(&index_lock);
+    if (last)
+    {
+        index_release(idx);
+        free(idx);
     }
+}
+
+// Fija la generación del índice que usa la solicitud que empieza en este hilo (y el CSV del
+// que lee 'fetch'). Hay que soltarla con index_finish al terminar la solicitud.
+void index_acquire(RowFetch *fetch)
+{
+    pthread_mutex_lock(&index_lock);
+    indice = current_index;
+    indice->refs++;
+    pthread_mutex_unlock(&index_lock);
+    if (fetch)
+        fetch_bind(fetch, indice->csv_fd, indice->csv_data, indice->csv_size);
+}
+
+void index_finish(void)
+{
+    index_drop(indice);
+    indice = NULL;
+}
 
-    // Abrir el archivo de índice y el archivo CSV
-    FILE *index_file = fopen(index_filepath, "rb");
-    if (!index_file)
+// Carga el índice que está en disco y reemplaza con él al que está en uso
+void reload_index(void)
+{
+    read_signatures(loaded_files); // Antes de cargar: un cambio durante la carga provoca otra recarga
+    MappedIndex *next = calloc(1, sizeof(MappedIndex));
+    if (next == NULL || cargar_generacion(next) < 0)
     {
-        fclose(header_file);
-        fclose(index_file);
-        perror("Error abriendo archivo de índice");
+        fprintf(stderr, "Aviso: no se pudo cargar el índice nuevo; se sigue usando el anterior\n");
+        if (next)
+            index_release(next);
+        free(next);
         return;
     }
 
-    FILE *csv_file = fopen(csv_filepath, "r");
-    if (!csv_file)
+    // Solo este hilo cambia current_index, así que puede leerlo sin el candado
+    MappedIndex *old = current_index;
+    next->generation = old->generation + 1;
+    next->refs = 1; // La referencia de current_index
+    pthread_mutex_lock(&index_lock);
+    current_index = next;
+    pthread_mutex_unlock(&index_lock);
+    cache_invalidate(next->generation);
+    printf("Servidor: los archivos del índice cambiaron, se cargó el índice nuevo (%zu entradas)\n", next->index_count);
+    index_drop(old); // Se libera aquí o al terminar la última solicitud que lo usa
+}
+
+void *index_watcher_main(void *arg)
+{
+    (void)arg;
+    FileSignature seen[INDEX_WATCHED_FILES];
+    memcpy(seen, loaded_files, sizeof(seen));
+    while (1)
     {
-        fclose(csv_file);
-        fclose(index_file);
-        fclose(header_file);
-        perror("Error abriendo archivo CSV");
-        return;
+        sleep(INDEX_CHECK_INTERVAL);
+        if (access(UPDATE_COMMIT_FILE, F_OK) == 0)
+            continue; // El constructor está renombrando los archivos nuevos
+
+        FileSignature current[INDEX_WATCHED_FILES];
+        read_signatures(current);
+        int stable = same_signatures(current, seen);
+        memcpy(seen, current, sizeof(seen));
+        if (stable && !same_signatures(current, loaded_files))
+            reload_index();
     }
+    return NULL;
+}
 
-    // Preparar el buffer para almacenar los resultados
-    int found_count = 0;
+// ---------------------- Servidor concurrente ----------------------
+// Un hilo (el principal) atiende el epoll: acepta conexiones y lee las solicitudes sin
+// bloquearse. Cuando una conexión tiene al menos una solicitud completa pasa a la cola y
+// la toma alguno de los hilos del pool. El índice mapeado es de solo lectura; cada solicitud
+// solo toma index_lock un momento para fijar la generación que usa (ver index_acquire). Aparte
+// de eso, el único estado compartido que se protege es la cola.
+//
+// Las conexiones se registran con EPOLLONESHOT: mientras un hilo atiende una conexión,
+// epoll no la vuelve a reportar, así que nunca hay dos hilos sobre el mismo descriptor.
+// Al terminar, las conexiones binarias se vuelven a armar en el epoll (keep-alive) y las
+// de texto se cierran, como antes. Si al hilo le quedó salida sin enviar, la conexión se arma
+// con EPOLLOUT y el hilo de eventos la termina de enviar antes de seguir con ella.
+
+#define CONN_UNKNOWN 0 // Todavía no llegaron bytes suficientes para saber el formato
+#define CONN_TEXT 1    // Formato de texto "id|año|mes|desde|hasta": una solicitud por conexión
+#define CONN_BINARY 2  // Protocolo binario: varias solicitudes por conexión
+
+// Estado de una conexión. Solo la toca el hilo de eventos o el hilo que la atiende, nunca los dos.
+typedef struct Connection {
+    int fd;
+    int mode;          // CONN_UNKNOWN, CONN_TEXT o CONN_BINARY
+    int peer_closed;   // El cliente cerró su lado: se atiende lo pendiente y se cierra
+    int close_after_flush; // Cerrar en cuanto se termine de enviar la salida pendiente
+    size_t len;        // Bytes recibidos que aún no se han procesado
+    size_t capacity;
+    char *buffer;      // Tiene capacity + 1 bytes para poder terminar en '\0' el texto
+    OutputBuffer out;  // Respuestas que el socket todavía no aceptó
+    struct Connection *next; // Enlace en la cola de trabajos
+} Connection;
+
+int epollfd;
+
+// Cola FIFO de conexiones con solicitudes completas, compartida entre el hilo de eventos y el pool
+typedef struct {
+    Connection *head;
+    Connection *tail;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+} JobQueue;
+
+JobQueue job_queue = {NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+void enqueue_job(JobQueue *queue, Connection *conn)
+{
+    conn->next = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail)
+        queue->tail->next = conn;
+    else
+        queue->head = conn;
+    queue->tail = conn;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
 
-    // Buffer para leer líneas del CSV y almacenar resultados
+Connection *dequeue_job(JobQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->head == NULL)
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    Connection *conn = queue->head;
+    queue->head = conn->next;
+    if (queue->head == NULL)
+        queue->tail = NULL;
+    pthread_mutex_unlock(&queue->lock);
+    return conn;
+}
 
-    size_t buffer_size = INITIAL_BUFFER_SIZE;
-    size_t buffer_pos = 0; // Posición actual de escritura (longitud de la cadena)
+int set_nonblocking(int fd, int enabled)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    flags = enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(fd, F_SETFL, flags);
+}
 
-    //reservo espacio para el buffer de resultados
-    char *result_buffer = malloc(buffer_size);
+void close_connection(Connection *conn)
+{
+    close(conn->fd); // Cerrar el descriptor también lo saca del epoll
+    free(conn->buffer);
+    free(conn->out.data);
+    free(conn);
+}
 
-    // Vaalido error
-    if (result_buffer == NULL)
+// Vuelve a activar la conexión en el epoll con los eventos que se esperan de ella
+void arm_connection(Connection *conn, uint32_t events)
+{
+    struct epoll_event ev;
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epollfd, EPOLL_CTL_MOD, conn->fd, &ev) < 0)
     {
-        perror("Error: Fallo al asignar memoria inicial");
-        // Cerramos los archivos que ya estaban abiertos
-        fclose(index_file);
-        fclose(csv_file);
-        return; // Salimos de la función si no hay memoria
+        perror("Error al reactivar la conexión en epoll");
+        close_connection(conn);
     }
+}
+
+// Vuelve a activar la conexión en el epoll para recibir su próxima solicitud
+void rearm_connection(Connection *conn)
+{
+    arm_connection(conn, EPOLLIN | EPOLLRDHUP);
+}
 
-    // la inicializacion del buffer de resultados con una cadena vacía para iniciar
-    result_buffer[0] = '\0';
+// Tamaño máximo del buffer de entrada según el formato de la conexión
+size_t connection_limit(const Connection *conn)
+{
+    return conn->mode == CONN_BINARY ? REQUEST_HEADER_SIZE + MAX_REQUEST_PAYLOAD : MAX_LINE_LEN;
+}
 
-    const char *csv_headers = "BibNumber,ItemBarcode,ItemType,Collection,CallNumber,CheckoutDateTime\n";
+// Decide el formato con los primeros bytes: las solicitudes binarias empiezan con PROTOCOL_MAGIC
+void detect_mode(Connection *conn)
+{
+    if (conn->mode != CONN_UNKNOWN || conn->len == 0)
+        return;
+    unsigned char magic[4];
+    put_u32(magic, PROTOCOL_MAGIC);
+    size_t n = conn->len < 4 ? conn->len : 4;
+    if (memcmp(conn->buffer, magic, n) != 0)
+        conn->mode = CONN_TEXT;
+    else if (n == 4)
+        conn->mode = CONN_BINARY;
+    else if (conn->peer_closed)
+        conn->mode = CONN_TEXT; // Un prefijo del magic que ya no se va a completar
+}
 
-    // Leer el archivo CSV y buscar el ID
-    // Recorremos la lista enlazada de nodos en el índice
-    // Cada nodo contiene un offset al registro en el CSV(el offset es como la dirección de memoria del registro en el CSV)
-    while (current_node_offset != -1)
+// Lee todo lo que haya llegado sin bloquear. Devuelve -1 si hubo un error de lectura.
+int read_available(Connection *conn)
+{
+    while (1)
     {
-        // Mover al nodo actual en el archivo de índice, para eso es fseek(mover puntero de lectura/escritura)
-        fseek(index_file, current_node_offset, SEEK_SET); 
+        if (conn->len == conn->capacity)
+        {
+            // Las solicitudes binarias pueden ser más grandes que el buffer inicial
+            size_t limit = connection_limit(conn);
+            if (conn->capacity >= limit)
+                return 0; // Lo demás se lee cuando se procese lo pendiente
+            size_t new_capacity = conn->capacity * 2 < limit ? conn->capacity * 2 : limit;
+            char *grown = realloc(conn->buffer, new_capacity + 1);
+            if (grown == NULL)
+                return -1;
+            conn->buffer = grown;
+            conn->capacity = new_capacity;
+        }
 
-        // Leemos el nodo completo en la variable 'current_node'.
-        IndexNode current_node;
-        if (fread(&current_node, sizeof(IndexNode), 1, index_file) != 1)
+        ssize_t r = recv(conn->fd, conn->buffer + conn->len, conn->capacity - conn->len, 0);
+        if (r > 0)
         {
-            // Error al leer el nodo, salimos de la función
-            fclose(index_file);
-            fclose(csv_file);
-            perror("Error leyendo nodo del archivo de índice");
-            break;
+            conn->len += r;
+            detect_mode(conn);
+            continue;
         }
+        if (r == 0)
+        {
+            conn->peer_closed = 1;
+            detect_mode(conn);
+            return 0;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        return -1;
+    }
+}
+
+// Indica si el buffer tiene algo que un hilo deba atender
+int has_complete_request(const Connection *conn)
+{
+    if (conn->mode == CONN_TEXT)
+    {
+        // El cliente de texto envía la solicitud completa en un solo mensaje y espera la respuesta
+        return conn->len > 0;
+    }
+    if (conn->mode == CONN_BINARY && conn->len >= REQUEST_HEADER_SIZE)
+    {
+        RequestHeader header;
+        if (request_header_decode((const unsigned char *)conn->buffer, &header) < 0)
+            return 1; // Flujo inválido: el hilo lo rechaza y cierra la conexión
+        return header.payload_len > MAX_REQUEST_PAYLOAD ||
+               conn->len >= REQUEST_HEADER_SIZE + (size_t)header.payload_len;
+    }
+    return 0;
+}
 
-        // Ahora leemos el registro correspondiente en el archivo CSV usando el offset del nodo
-        // ya tenemos la dirección del registro en el CSV, así que movemos el puntero de lectura al offset del registro
-        fseek(csv_file, current_node.data_offset, SEEK_SET);
+// Atiende la única solicitud de una conexión de texto
+void serve_text_request(Connection *conn, ResponseWriter *writer)
+{
+    conn->buffer[conn->len] = '\0';
+    printf("\nServidor: Mensaje recibido del cliente: %s\n", conn->buffer);
+
+    writer_init(writer, conn->fd, &conn->out, 0, 0);
+    SearchQuery query;
+    index_acquire(writer->fetch);
+    if (parse_text_request(conn->buffer, &query) < 0)
+        send_message_response(writer, "Error: solicitud inválida. Formato: id|año|mes|desde|hasta (fechas MM/DD/AAAA).");
+    else
+        perform_search(writer, &query);
+    index_finish();
+    arena_reset(&writer->arena); // Toda la memoria de la solicitud se devuelve de una vez
+}
 
-        // leemos la línea completa del CSV sin importar su longitud
-        char *full_line = read_full_line(csv_file);
-        if (full_line == NULL)
+// Revisa que todas las columnas de los predicados tengan índice secundario. Si alguna no lo
+// tiene, responde con el error y devuelve -1.
+int check_predicate_columns(ResponseWriter *writer, const SearchQuery *query)
+{
+    for (int i = 0; i < query->predicate_count; i++)
+    {
+        int column = query->predicates[i].column;
+        if (column < SECONDARY_FIRST_COLUMN || column > SECONDARY_LAST_COLUMN || !indice->secondary[column].loaded)
         {
-            break; // No hay más líneas o error de memoria
+            char message[128];
+            snprintf(message, sizeof(message), "Error: no hay índice para la columna %s; ejecute ./constructor.",
+                     column_name(column));
+            send_message_response(writer, message);
+            return -1;
         }
+    }
+    return 0;
+}
+
+// Atiende una solicitud binaria cuya carga útil ya está completa en 'payload'
+void serve_binary_request(ResponseWriter *writer, const RequestHeader *header, const unsigned char *payload)
+{
+    if (header->version != PROTOCOL_VERSION)
+    {
+        send_message_response(writer, "Error: versión de protocolo no soportada.");
+        return;
+    }
 
-        // 2. Para strtok, necesitamos una copia. La creamos con malloc del tamaño exacto.
-        char *line_copy_for_id = malloc(strlen(full_line) + 1);
-        if (line_copy_for_id == NULL)
+    switch (header->type)
+    {
+    case REQ_SEARCH:
+    {
+        SearchQuery query;
+        if (search_payload_decode(payload, header->payload_len, &query) < 0)
         {
-            free(full_line);
-            break;
+            send_message_response(writer, "Error: solicitud de búsqueda inválida.");
+            return;
+        }
+        printf("\nServidor: Solicitud %u: búsqueda del ID '%s'\n", header->request_id, query.id);
+        perform_search(writer, &query);
+        break;
+    }
+    case REQ_QUERY:
+    {
+        SearchQuery query;
+        if (query_payload_decode(payload, header->payload_len, &query) < 0)
+        {
+            send_message_response(writer, "Error: solicitud de consulta inválida.");
+            return;
+        }
+        if (check_predicate_columns(writer, &query) < 0)
+            return;
+        printf("\nServidor: Solicitud %u: consulta con %d condiciones\n", header->request_id,
+               query.predicate_count + (query.id[0] != '\0'));
+        perform_search(writer, &query);
+        break;
+    }
+    case REQ_PAGE:
+    {
+        SearchQuery query;
+        if (page_payload_decode(payload, header->payload_len, &query) < 0)
+        {
+            send_message_response(writer, "Error: solicitud de página inválida.");
+            return;
+        }
+        if (check_predicate_columns(writer, &query) < 0)
+            return;
+        printf("\nServidor: Solicitud %u: página de %ld filas%s\n", header->request_id, query.limit,
+               query.has_cursor ? " (continuación)" : "");
+        perform_search(writer, &query);
+        break;
+    }
+    case REQ_BATCH:
+    {
+        SearchQuery filters;
+        uint32_t id_count;
+        long ids_pos;
+        if (batch_payload_decode(payload, header->payload_len, &filters, &id_count, &ids_pos) < 0)
+        {
+            send_message_response(writer, "Error: solicitud de lote inválida.");
+            return;
+        }
+        printf("\nServidor: Solicitud %u: lote de %u IDs\n", header->request_id, id_count);
+        trace_start(&writer->trace);
+        long rows = search_batch(writer, &filters, payload, ids_pos, id_count);
+        if (rows < 0)
+            send_message_response(writer, "Error: el lote abarca demasiados registros; divídalo o agregue filtros de fecha.");
+        else
+            writer_finish(writer, rows);
+        char description[64];
+        snprintf(description, sizeof(description), "lote de %u IDs", id_count);
+        writer->trace.rows_matched = rows > 0 ? rows : 0;
+        stats_record(&writer->trace, description);
+        break;
+    }
+    case REQ_SERIES:
+    {
+        SearchQuery query;
+        if (query_payload_decode(payload, header->payload_len, &query) < 0)
+        {
+            send_message_response(writer, "Error: solicitud de serie inválida.");
+            return;
+        }
+        if (!indice->aggregates.loaded)
+        {
+            send_message_response(writer, "Error: no hay agregados; ejecute ./constructor.");
+            return;
+        }
+        printf("\nServidor: Solicitud %u: serie mensual\n", header->request_id);
+        long months = aggregate_series(writer, &query);
+        if (months < 0)
+        {
+            send_message_response(writer, "Error: las series se piden por ID o por un valor exacto de ItemType o Collection.");
+            return;
         }
+        if (months == 0)
+            writer_append_str(writer, "No hay préstamos en el período pedido.");
+        writer_finish(writer, months);
+        break;
+    }
+    case REQ_TOP:
+    {
+        TopQuery query;
+        if (top_payload_decode(payload, header->payload_len, &query) < 0)
+        {
+            send_message_response(writer, "Error: solicitud de más prestados inválida.");
+            return;
+        }
+        if (!indice->aggregates.loaded)
+        {
+            send_message_response(writer, "Error: no hay agregados; ejecute ./constructor.");
+            return;
+        }
+        printf("\nServidor: Solicitud %u: los %ld más prestados\n", header->request_id, query.limit);
+        long rows = aggregate_top(writer, &query);
+        if (rows == 0)
+            writer_append_str(writer, "No hay préstamos en el período pedido.");
+        writer_finish(writer, rows);
+        break;
+    }
+    case REQ_CACHE_STATS:
+    {
+        char stats[256];
+        cache_stats(stats, sizeof(stats));
+        writer_append_str(writer, stats);
+        writer_finish(writer, 0);
+        break;
+    }
+    case REQ_STATS:
+        stats_report(writer);
+        writer_finish(writer, 0);
+        break;
+    default:
+        send_message_response(writer, "Error: tipo de solicitud desconocido.");
+    }
+}
 
-        // Copiamos la línea completa para no modificarla con strtok
-        strcpy(line_copy_for_id, full_line);
+// Atiende, en orden, todas las solicitudes binarias completas del buffer; lo que quede
+// incompleto se conserva para la próxima lectura. Devuelve 0 si la conexión debe cerrarse.
+int serve_binary_requests(Connection *conn, ResponseWriter *writer)
+{
+    size_t consumed = 0;
+    int keep_open = 1;
 
-        // Extraemos el ID del registro, que está en la primera columna (índice 0)
-        char *record_id = strtok(line_copy_for_id, ",");
+    while (keep_open && conn->len - consumed >= REQUEST_HEADER_SIZE)
+    {
+        const unsigned char *data = (const unsigned char *)conn->buffer + consumed;
+        RequestHeader header;
+        if (request_header_decode(data, &header) < 0)
+        {
+            // Sin magic no sabemos dónde empieza la próxima solicitud
+            fprintf(stderr, "Servidor: flujo binario inválido, se cierra la conexión\n");
+            keep_open = 0;
+            break;
+        }
 
-        // Verificamos si el ID del registro coincide con el ID que estamos buscando
-        if (record_id != NULL && strcmp(record_id, id_to_find) == 0)
+        writer_init(writer, conn->fd, &conn->out, 1, header.request_id);
+        if (header.payload_len > MAX_REQUEST_PAYLOAD)
         {
-            // El ID coincide, ahora filtramos por fecha.
-            // Necesitamos otra copia de la línea completa para extraer la fecha
-            char *line_copy_for_date = malloc(strlen(full_line) + 1);
-            if (line_copy_for_date == NULL)
-            {
-                free(full_line);
-                free(line_copy_for_id);
-                break;
-            }
-            strcpy(line_copy_for_date, full_line);
-            
-            // Extraemos la fecha del registro, que está en la sexta columna (índice 5)
-            // Usamos strtok para saltar a la columna de fecha
-            char *date_time_str = NULL;
-            char *token = strtok(line_copy_for_date, ",");
-            for (int col_idx = 0; token != NULL && col_idx < 5; col_idx++)
-            {
-                token = strtok(NULL, ",");
-            }
+            send_message_response(writer, "Error: solicitud demasiado grande.");
+            keep_open = 0;
+            break;
+        }
+        if (conn->len - consumed < REQUEST_HEADER_SIZE + (size_t)header.payload_len)
+            break;
 
-            // Ahora token apunta a la columna de fecha (sexta columna)
-            // data_time_str <-- fecha y hora del registro
-            if (token != NULL)
-            {
-                date_time_str = token;
-            }
-            
-            //En este punto voy a guardar la fecha en estas 3 variables
-            int record_month, record_day, record_year;
+        index_acquire(writer->fetch);
+        serve_binary_request(writer, &header, data + REQUEST_HEADER_SIZE);
+        index_finish();
+        arena_reset(&writer->arena); // Toda la memoria de la solicitud se devuelve de una vez
+        consumed += REQUEST_HEADER_SIZE + header.payload_len;
+        if (writer->error)
+            keep_open = 0;
+        else if (output_pending(&conn->out) > 0)
+            break; // El cliente va atrasado: las demás solicitudes esperan a que se vacíe la salida
+    }
 
-            // Ahora extraemos el mes, día y año de la fecha aunque no necesitamos el dia
-            if (date_time_str && sscanf(date_time_str, "%d/%d/%d", &record_month, &record_day, &record_year) == 3)
-            {
-                // Comprobamos si el año y mes coinciden con los filtros o si no hay filtros
-                int year_matches = (filter_year == 0 || record_year == filter_year);
-                int month_matches = (filter_month == 0 || record_month == filter_month);
-                if (year_matches && month_matches)
-                {
-                    if (found_count == 0)
-                    {
-                        result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, "Registros encontrados para el ID '");
-                        result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, id_to_find);
-                        result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, "'");
-
-                        result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, ":\n");
-                        result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, csv_headers);
-                    }
-                    result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, full_line);
-                    result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, "\n"); // Añadir salto de línea
-                    // Si en algún punto append_to_buffer falla, result_buffer será NULL
-                    if (result_buffer == NULL)
-                    {
-                        free(full_line);
-                        free(line_copy_for_id);
-                        free(line_copy_for_date);
-                        fclose(index_file);
-                        fclose(csv_file);
-                        return; // Salimos limpiamente
-                    }
-
-                    // Añadimos la línea del CSV
-
-                    found_count++;
-                }
-            }
-            free(line_copy_for_date); // Liberar la copia para la fecha
-        }
+    memmove(conn->buffer, conn->buffer + consumed, conn->len - consumed);
+    conn->len -= consumed;
+    return keep_open;
+}
+
+// Cada hilo del pool toma conexiones de la cola para siempre. La trama de salida es de
+// tamaño fijo, así que cada hilo reserva la suya una sola vez en el heap.
+void *worker_main(void *arg)
+{
+    (void)arg;
+    ResponseWriter *writer = malloc(sizeof(ResponseWriter));
+    if (writer == NULL)
+    {
+        perror("Error: Fallo al asignar memoria para la respuesta");
+        return NULL;
+    }
+    writer->capture = NULL;
+    writer->capture_cap = 0;
+    writer->fetch = fetch_create(); // Sin él las filas se leen solo del mapeo
+    writer->arena.blocks = NULL;
 
-        free(line_copy_for_id);
-        free(full_line);
+    while (1)
+    {
+        Connection *conn = dequeue_job(&job_queue);
 
-        current_node_offset = current_node.next_node_offset;
+        int keep_open = 0;
+        if (conn->mode == CONN_BINARY)
+            keep_open = serve_binary_requests(conn, writer);
+        else
+            serve_text_request(conn, writer);
+
+        // Desde aquí la conexión vuelve a ser del hilo de eventos
+        conn->close_after_flush = !keep_open || (conn->peer_closed && !has_complete_request(conn));
+        if (conn->out.failed)
+            close_connection(conn);
+        else if (output_pending(&conn->out) > 0)
+            arm_connection(conn, EPOLLOUT);
+        else if (conn->close_after_flush)
+            close_connection(conn);
+        else
+            rearm_connection(conn);
     }
+    return NULL;
+}
 
-    if (found_count == 0)
+// Acepta todas las conexiones pendientes y las registra en el epoll
+void accept_connections(void)
+{
+    while (1)
     {
-        // Limpiamos el búfer y construimos el mensaje de forma segura
-        buffer_pos = 0;
-        result_buffer[0] = '\0';
+        struct sockaddr_in client;
+        socklen_t lenclient = sizeof(client);
+        int clientfd = accept(serverfd, (struct sockaddr *)&client, &lenclient);
+        if (clientfd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("Error al aceptar la conexión");
+            return;
+        }
 
-        result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, "ID '");
-        result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, id_to_find);
-        result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, "' no encontrado");
-        if (filter_year > 0 || filter_month > 0)
+        Connection *conn = calloc(1, sizeof(Connection));
+        char *buffer = malloc(MAX_LINE_LEN + 1);
+        if (conn == NULL || buffer == NULL || set_nonblocking(clientfd, 1) < 0)
+        {
+            perror("Error al preparar la conexión");
+            free(conn);
+            free(buffer);
+            close(clientfd);
+            continue;
+        }
+        // Las respuestas terminan con una trama final pequeña; sin TCP_NODELAY, Nagle la retiene
+        // hasta el ACK retardado del cliente y cada consulta en una conexión reutilizada tarda ~40 ms
+        int nodelay = 1;
+        setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        conn->fd = clientfd;
+        conn->mode = CONN_UNKNOWN;
+        conn->buffer = buffer;
+        conn->capacity = MAX_LINE_LEN;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, clientfd, &ev) < 0)
         {
-            result_buffer = append_to_buffer(result_buffer, &buffer_pos, &buffer_size, " o no hay registros que coincidan con los filtros de fecha.");
+            perror("Error al registrar la conexión en epoll");
+            close_connection(conn);
         }
     }
-    /*
-    // Send response back to frontend
-    int fd = open(OUTPUT_PIPE, O_WRONLY);
+}
 
-    // La longitud de los datos es ahora buffer_pos
-    if (fd != -1)
+// Lee lo que haya llegado de una conexión. Si ya hay una solicitud completa la entrega al
+// pool; a partir de ahí la conexión es responsabilidad del hilo hasta que la vuelva a armar.
+void handle_readable(Connection *conn)
+{
+    if (read_available(conn) < 0)
     {
-        write(fd, result_buffer, buffer_pos + 1); // +1 para enviar el '\0'
-        close(fd);
+        perror("Error al recibir datos del cliente");
+        close_connection(conn);
+        return;
     }
+
+    if (has_complete_request(conn))
+        enqueue_job(&job_queue, conn);
+    else if (conn->peer_closed)
+        close_connection(conn); // El cliente cerró sin completar una solicitud
     else
+        rearm_connection(conn);
+}
+
+// El socket volvió a aceptar datos: se envía la salida pendiente y, cuando se vacía, la conexión
+// sigue como si el hilo acabara de atenderla (las solicitudes que quedaron en el buffer van al pool)
+void handle_writable(Connection *conn)
+{
+    if (output_flush(conn->fd, &conn->out) < 0)
     {
-        perror("Error al abrir el pipe de salida");
+        perror("Error al enviar datos al cliente");
+        close_connection(conn);
     }
-    // ¡Paso más importante! Liberar la memoria.
-    free(result_buffer);
-
-    fclose(index_file);
-    fclose(csv_file);
-    */
-
-   //----------Enviar un mensaje al cliente-------------
-
-   r = send(clientfd,result_buffer, buffer_pos, 0);
-   if (r < 0) {
-       perror("Error al enviar datos al cliente");
-       close(clientfd);
-       close(serverfd);
-       return;
-   }
-   free(result_buffer);
-   fclose(index_file);
-   fclose(csv_file);
-   close(clientfd);
+    else if (output_pending(&conn->out) > 0)
+        arm_connection(conn, EPOLLOUT);
+    else if (conn->close_after_flush)
+        close_connection(conn);
+    else if (has_complete_request(conn))
+        enqueue_job(&job_queue, conn);
+    else
+        rearm_connection(conn);
 }
 
-int main()
+int main(int argc, char **argv)
 {
     signal(SIGINT, cerrar_servidor);
-    char buffer_s[100];
-    char request[MAX_LINE_LEN];
-    char id_to_find[256];
-    char year_str[16];
-    char month_str[16];
-    int filter_year, filter_month;
-
-    socklen_t lenclient;
-    struct sockaddr_in server,client;
+
+    // Número de hilos del pool: por defecto uno por núcleo, o el que se pase como argumento
+    long worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1)
+        worker_count = atol(argv[1]);
+    if (worker_count < 1)
+        worker_count = 1;
+    if (worker_count > MAX_WORKERS)
+        worker_count = MAX_WORKERS;
+
+    // Presupuesto de la caché de resultados en MB (0 la desactiva)
+    long cache_mb = CACHE_DEFAULT_MB;
+    if (argc > 2)
+        cache_mb = atol(argv[2]);
+    if (cache_mb < 0)
+        cache_mb = 0;
+
+    // Umbral en milisegundos para anotar una búsqueda como lenta (0 = sin registro)
+    if (argc > 3)
+        stats.slow_threshold_ns = (long)(atof(argv[3]) * 1e6);
+    if (stats.slow_threshold_ns < 0)
+        stats.slow_threshold_ns = 0;
+
+    // Si el constructor se cortó después de confirmar una actualización, se termina de aplicar
+    if (finish_index_update() < 0)
+    {
+        fprintf(stderr, "No se pudo completar la actualización pendiente del índice.\n");
+        return -1;
+    }
+
+    // El índice y el CSV se mapean al arrancar; las consultas ya no abren archivos. Después se
+    // vuelven a cargar solo si cambian en disco (ver reload_index)
+    read_signatures(loaded_files);
+    current_index = calloc(1, sizeof(MappedIndex));
+    if (current_index == NULL || cargar_generacion(current_index) < 0) {
+        fprintf(stderr, "No se pudo cargar el índice. ¿Ejecutó ./constructor?\n");
+        return -1;
+    }
+    current_index->refs = 1;
+    // Lecturas posicionales de filas del CSV; si no se puede, las filas se leen del mapeo
+    if (fetch_start(FETCH_THREADS) < 0)
+        fprintf(stderr, "Aviso: las filas del CSV se leerán solo del mapeo.\n");
+    cache_init((size_t)cache_mb * 1024 * 1024);
+
+    struct sockaddr_in server;
     int r;
 
     //-----------------Creacion del socket del servidor-------------
@@ -405,6 +3183,10 @@ int main()
         return -1;
     }
 
+    // Permite reiniciar el servidor sin esperar a que expiren las conexiones en TIME_WAIT
+    int reuse = 1;
+    setsockopt(serverfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     //---------Configuracion de la estructura del servidor----------
 
     server.sin_family = AF_INET;
@@ -427,58 +3209,64 @@ int main()
         perror("Error en el listen");
         exit(-1);
     }
+    set_nonblocking(serverfd, 1);
 
-    while (1)
-    {
-        // Leer del frontend a través de sockets
-        //acept devuelve el descriptor del socket del cliente
-        printf("Servidor escuchando en el puerto %d...\n", PORT);
-        clientfd = accept(serverfd, (struct sockaddr *)&client, &lenclient);
-        if (clientfd < 0) {
-            perror("Error al aceptar la conexión");
-            close(serverfd);
-            return -1;
-        }
+    //------------Crear el epoll--------------
+    // Se crea antes que los hilos porque ellos también rearman conexiones en él
+    epollfd = epoll_create1(0);
+    if (epollfd < 0) {
+        perror("Error al crear epoll");
+        exit(-1);
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // NULL identifica al socket del servidor
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, serverfd, &ev) < 0) {
+        perror("Error al registrar el servidor en epoll");
+        exit(-1);
+    }
 
-        //----------Recibir un mensaje del cliente-------------
-        r = recv(clientfd, request, sizeof(request), 0);
-        if (r < 0) {
-            perror("Error al recibir datos del cliente");
-            close(clientfd);
-            close(serverfd);
-            return -1;
+    //------------Crear el pool de hilos--------------
+    for (long i = 0; i < worker_count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, NULL) != 0) {
+            perror("Error al crear hilo del pool");
+            exit(-1);
         }
-        printf("\nServidor: Mensaje recibido del cliente: %s\n", request);
-        request[r] = '\0';
-        
-        /*int fd = open(INPUT_PIPE, O_RDONLY);
-        read(fd, request, sizeof(request));
-        close(fd);*/
-
-        // Parse the request
-        char *token = strtok(request, "|");
-        if (token)
-            strncpy(id_to_find, token, sizeof(id_to_find) - 1);
-
-        token = strtok(NULL, "|");
-        if (token)
-            strncpy(year_str, token, sizeof(year_str) - 1);
-        else
-            year_str[0] = '\0';
+        pthread_detach(thread);
+    }
+    pthread_t watcher;
+    if (pthread_create(&watcher, NULL, index_watcher_main, NULL) != 0)
+        perror("Error al crear el hilo que revisa los archivos del índice");
+    else
+        pthread_detach(watcher);
 
-        token = strtok(NULL, "|");
-        if (token)
-            strncpy(month_str, token, sizeof(month_str) - 1);
-        else
-            month_str[0] = '\0';
+    printf("Servidor escuchando en el puerto %d con %ld hilos y %ld MB de caché...\n", PORT, worker_count, cache_mb);
 
-        // convertir el mes y el año a enteros (si están vacíos, se convierten a 0)
-        filter_year = (strlen(year_str) > 0) ? atoi(year_str) : 0;
-        filter_month = (strlen(month_str) > 0) ? atoi(month_str) : 0;
+    //------------Bucle de eventos--------------
+    struct epoll_event events[MAX_EVENTS];
+    while (1)
+    {
+        int ready = epoll_wait(epollfd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Error en epoll_wait");
+            break;
+        }
 
-        // Perform the search
-        perform_search(id_to_find, filter_year, filter_month, "DataC.csv");
+        for (int i = 0; i < ready; i++)
+        {
+            Connection *conn = events[i].data.ptr;
+            if (conn == NULL)
+                accept_connections();
+            else if (output_pending(&conn->out) > 0)
+                handle_writable(conn); // Solo se arma con EPOLLOUT cuando queda salida pendiente
+            else
+                handle_readable(conn);
+        }
     }
 
+    close(serverfd);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,758 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "indexer.h"
+#include "protocol.h"
+
+// Generador de carga para el backend. Habla el protocolo binario por el puerto 3550 y mide la
+// latencia de cada solicitud, desde que se envía (o desde que le tocaba enviarse, con una tasa
+// fija) hasta que llega su trama FRAME_END.
+//
+// Dos modos:
+//  - lazo cerrado (por defecto): cada conexión envía una solicitud, espera la respuesta y
+//    envía la siguiente; la concurrencia es el número de conexiones;
+//  - lazo abierto (-r): las solicitudes salen a la tasa pedida, repartida entre las conexiones,
+//    sin esperar respuestas (pipelining). Si el servidor se atrasa, la latencia lo muestra en
+//    vez de bajar la tasa.
+//
+// Los IDs siguen una distribución de Zipf sobre los BibNumber de header.dat ordenados por
+// préstamos (el más prestado es el más pedido), o sobre una lista propia (-i).
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT 3550
+#define MAX_CONNECTIONS 1024
+#define OPEN_LOOP_WINDOW 4096 // Solicitudes sin respuesta por conexión en lazo abierto
+#define TOP_LIMIT 50          // IDs que pide cada REQ_TOP
+
+#define MIX_SEARCH 0
+#define MIX_SERIES 1
+#define MIX_TOP 2
+#define MIX_TYPES 3
+
+typedef struct
+{
+    const char *host;
+    int port;
+    int connections;
+    double duration;     // Segundos de medición (si no se fija el número de solicitudes)
+    long total_requests; // 0 = sin límite, se corta por tiempo
+    double rate;         // Solicitudes por segundo en total; 0 = lazo cerrado
+    double zipf_s;       // Exponente de Zipf: 0 es uniforme, 1 es la ley de Zipf clásica
+    double missing_rate; // Fracción de búsquedas por un ID que no existe
+    double year_rate;    // Fracción de búsquedas con filtro de año
+    double month_rate;   // Fracción de búsquedas con filtro de mes
+    int mix[MIX_TYPES];  // Peso de cada tipo de solicitud
+    int json;
+    unsigned long seed;
+} BenchConfig;
+
+// IDs que se piden, del más al menos popular, con la distribución acumulada de Zipf
+typedef struct
+{
+    char **ids;
+    long count;
+    double *cdf;
+    long max_numeric; // Mayor BibNumber numérico; los IDs faltantes se generan por encima
+    int first_year;
+    int last_year;
+} IdPool;
+
+typedef struct
+{
+    int fd;
+    unsigned long rng;
+    double *latencies; // En segundos
+    long latency_count;
+    long latency_capacity;
+    long requests;
+    long errors;
+    long failed; // 1 si la conexión se cortó
+    unsigned long long bytes;
+
+    // Lazo abierto: el emisor anota cuándo le tocaba salir a cada solicitud y el receptor
+    // calcula la latencia al leer su respuesta
+    double send_times[OPEN_LOOP_WINDOW];
+    long sent;
+    long received;
+    int sender_done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t sender;
+    pthread_t receiver;
+} Client;
+
+BenchConfig config;
+IdPool pool;
+double start_time;
+double end_time;
+long issued = 0; // Solicitudes reservadas entre todos los clientes (para -n)
+pthread_mutex_t issued_lock = PTHREAD_MUTEX_INITIALIZER;
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void sleep_until(double when)
+{
+    double wait = when - now_seconds();
+    if (wait <= 0)
+        return;
+    struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+    nanosleep(&ts, NULL);
+}
+
+// xorshift64*: cada cliente tiene su propio estado, así no comparten un generador con candado
+unsigned long next_random(unsigned long *state)
+{
+    unsigned long x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DUL;
+}
+
+double random_unit(unsigned long *state)
+{
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Reserva una solicitud más. Devuelve 0 cuando ya se hicieron todas o se acabó el tiempo.
+int take_request(void)
+{
+    if (config.total_requests == 0)
+        return now_seconds() < end_time;
+    pthread_mutex_lock(&issued_lock);
+    int ok = issued < config.total_requests;
+    if (ok)
+        issued++;
+    pthread_mutex_unlock(&issued_lock);
+    return ok;
+}
+
+int compare_key_popularity(const void *a, const void *b)
+{
+    const KeySlot *ka = a;
+    const KeySlot *kb = b;
+    if (ka->count != kb->count)
+        return ka->count > kb->count ? -1 : 1;
+    return ka->key < kb->key ? -1 : ka->key > kb->key;
+}
+
+// Carga los BibNumber de header.dat ordenados por número de préstamos
+int load_ids_from_index(const char *header_filepath)
+{
+    FILE *file = fopen(header_filepath, "rb");
+    if (!file)
+    {
+        perror(header_filepath);
+        return -1;
+    }
+    IndexHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.table_size <= 0)
+    {
+        fprintf(stderr, "Error: '%s' no tiene el formato esperado\n", header_filepath);
+        fclose(file);
+        return -1;
+    }
+    KeySlot *slots = malloc(sizeof(KeySlot) * header.table_size);
+    if (!slots || fread(slots, sizeof(KeySlot), header.table_size, file) != (size_t)header.table_size)
+    {
+        fprintf(stderr, "Error: no se pudo leer la tabla de claves de '%s'\n", header_filepath);
+        free(slots);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    // Solo las claves numéricas: su texto es el propio número
+    long count = 0;
+    for (long i = 0; i < header.table_size; i++)
+    {
+        if (slots[i].key != KEY_EMPTY && key_is_exact(slots[i].key))
+            slots[count++] = slots[i];
+    }
+    qsort(slots, count, sizeof(KeySlot), compare_key_popularity);
+
+    pool.ids = malloc(sizeof(char *) * (count ? count : 1));
+    if (!pool.ids)
+    {
+        free(slots);
+        return -1;
+    }
+    for (long i = 0; i < count; i++)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%ld", slots[i].key);
+        pool.ids[i] = strdup(text);
+        if (slots[i].key > pool.max_numeric)
+            pool.max_numeric = slots[i].key;
+    }
+    pool.count = count;
+    free(slots);
+    return 0;
+}
+
+// Carga una lista de IDs, uno por línea, del más al menos popular
+int load_ids_from_file(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        perror(path);
+        return -1;
+    }
+    long capacity = 1024;
+    pool.ids = malloc(sizeof(char *) * capacity);
+    char line[256];
+    while (pool.ids && fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0')
+            continue;
+        if (pool.count == capacity)
+        {
+            capacity *= 2;
+            char **grown = realloc(pool.ids, sizeof(char *) * capacity);
+            if (!grown)
+                break;
+            pool.ids = grown;
+        }
+        pool.ids[pool.count++] = strdup(line);
+        char *end;
+        long numeric = strtol(line, &end, 10);
+        if (*end == '\0' && numeric > pool.max_numeric)
+            pool.max_numeric = numeric;
+    }
+    fclose(file);
+    return pool.ids ? 0 : -1;
+}
+
+// Años para los filtros: los del manifiesto si existe, o los del dataset original
+void load_years(const char *years_filepath)
+{
+    pool.first_year = 2005;
+    pool.last_year = 2017;
+    FILE *file = fopen(years_filepath, "rb");
+    if (!file)
+        return;
+    YearManifest *manifest = malloc(sizeof(YearManifest));
+    if (manifest && fread(manifest, sizeof(YearManifest), 1, file) == 1 &&
+        memcmp(manifest->magic, YEARS_MAGIC, sizeof(manifest->magic)) == 0 && manifest->first_year > 0)
+    {
+        pool.first_year = (int)manifest->first_year;
+        pool.last_year = (int)manifest->last_year;
+    }
+    free(manifest);
+    fclose(file);
+}
+
+// Distribución acumulada de Zipf: el ID de posición i tiene peso 1 / (i + 1)^s
+int build_zipf(double s)
+{
+    pool.cdf = malloc(sizeof(double) * pool.count);
+    if (!pool.cdf)
+        return -1;
+    double total = 0;
+    for (long i = 0; i < pool.count; i++)
+    {
+        total += 1.0 / pow((double)(i + 1), s);
+        pool.cdf[i] = total;
+    }
+    for (long i = 0; i < pool.count; i++)
+        pool.cdf[i] /= total;
+    return 0;
+}
+
+const char *pick_id(Client *client, char *missing)
+{
+    if (random_unit(&client->rng) < config.missing_rate)
+    {
+        // Por encima del mayor BibNumber no hay ninguno
+        snprintf(missing, 32, "%ld", pool.max_numeric + 1 + (long)(next_random(&client->rng) % 1000000));
+        return missing;
+    }
+    double u = random_unit(&client->rng);
+    long lo = 0, hi = pool.count - 1;
+    while (lo < hi)
+    {
+        long mid = lo + (hi - lo) / 2;
+        if (pool.cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return pool.ids[lo];
+}
+
+// Arma la próxima solicitud según la mezcla configurada. Devuelve su largo total.
+size_t build_request(Client *client, unsigned char *out, uint32_t request_id)
+{
+    int total_weight = config.mix[MIX_SEARCH] + config.mix[MIX_SERIES] + config.mix[MIX_TOP];
+    int pick = (int)(next_random(&client->rng) % total_weight);
+    int type = pick < config.mix[MIX_SEARCH] ? MIX_SEARCH
+               : pick < config.mix[MIX_SEARCH] + config.mix[MIX_SERIES] ? MIX_SERIES
+                                                                          : MIX_TOP;
+
+    int year = 0, month = 0;
+    if (random_unit(&client->rng) < config.year_rate)
+        year = pool.first_year + (int)(next_random(&client->rng) % (pool.last_year - pool.first_year + 1));
+    if (random_unit(&client->rng) < config.month_rate)
+        month = 1 + (int)(next_random(&client->rng) % 12);
+
+    unsigned char *payload = out + REQUEST_HEADER_SIZE;
+    size_t payload_len;
+    if (type == MIX_TOP)
+    {
+        TopQuery query = {year, year ? month : 0, TOP_LIMIT};
+        payload_len = top_payload_encode(payload, &query);
+        request_header_encode(out, REQ_TOP, request_id, payload_len);
+        return REQUEST_HEADER_SIZE + payload_len;
+    }
+
+    SearchQuery query;
+    memset(&query, 0, sizeof(query));
+    char missing[32];
+    snprintf(query.id, sizeof(query.id), "%s", pick_id(client, missing));
+    query.year = year;
+    query.month = month;
+    if (type == MIX_SEARCH)
+    {
+        payload_len = search_payload_encode(payload, &query);
+        request_header_encode(out, REQ_SEARCH, request_id, payload_len);
+    }
+    else
+    {
+        payload_len = query_payload_encode(payload, &query);
+        request_header_encode(out, REQ_SERIES, request_id, payload_len);
+    }
+    return REQUEST_HEADER_SIZE + payload_len;
+}
+
+int send_request(int fd, const unsigned char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+// Lee la respuesta completa de la solicitud 'request_id' (hasta su trama FRAME_END).
+// Devuelve 1 si el servidor respondió con un error, 0 si no y -1 si la conexión falló.
+int read_response(Client *client, uint32_t request_id)
+{
+    static __thread unsigned char payload[FRAME_MAX_PAYLOAD];
+    int is_error = 0;
+    while (1)
+    {
+        unsigned char header[RESPONSE_HEADER_SIZE];
+        if (recv_all(client->fd, header, sizeof(header)) < 0)
+            return -1;
+        char type;
+        uint32_t id, len;
+        response_header_decode(header, &type, &id, &len);
+        if (id != request_id)
+        {
+            fprintf(stderr, "Error: llegó la respuesta %u cuando se esperaba la %u\n", id, request_id);
+            return -1;
+        }
+        client->bytes += sizeof(header) + len;
+        while (len > 0)
+        {
+            uint32_t chunk = len < sizeof(payload) ? len : sizeof(payload);
+            if (recv_all(client->fd, payload, chunk) < 0)
+                return -1;
+            len -= chunk;
+        }
+        if (type == FRAME_ERROR)
+            is_error = 1;
+        if (type == FRAME_END)
+            return is_error;
+    }
+}
+
+void record_latency(Client *client, double latency, int result)
+{
+    if (client->latency_count == client->latency_capacity)
+    {
+        long capacity = client->latency_capacity ? client->latency_capacity * 2 : 1 << 16;
+        double *grown = realloc(client->latencies, sizeof(double) * capacity);
+        if (!grown)
+            return;
+        client->latencies = grown;
+        client->latency_capacity = capacity;
+    }
+    client->latencies[client->latency_count++] = latency;
+    client->requests++;
+    if (result > 0)
+        client->errors++;
+}
+
+int connect_to_server(void)
+{
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char port[16];
+    snprintf(port, sizeof(port), "%d", config.port);
+    if (getaddrinfo(config.host, port, &hints, &addresses) != 0)
+        return -1;
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address && fd < 0; address = address->ai_next)
+    {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) < 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd >= 0)
+    {
+        // Las solicitudes son pequeñas; sin Nagle cada una sale de inmediato
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// Lazo cerrado: una solicitud a la vez por conexión
+void *closed_loop(void *arg)
+{
+    Client *client = arg;
+    unsigned char request[REQUEST_HEADER_SIZE + SEARCH_PAYLOAD_FIXED + 512];
+    for (uint32_t request_id = 1; take_request(); request_id++)
+    {
+        size_t len = build_request(client, request, request_id);
+        double sent_at = now_seconds();
+        int result = send_request(client->fd, request, len) < 0 ? -1 : read_response(client, request_id);
+        if (result < 0)
+        {
+            client->failed = 1;
+            break;
+        }
+        record_latency(client, now_seconds() - sent_at, result);
+    }
+    return NULL;
+}
+
+// Lazo abierto, emisor: cada solicitud sale en su turno aunque falten respuestas
+void *open_loop_sender(void *arg)
+{
+    Client *client = arg;
+    double interval = config.connections / config.rate;
+    double next = start_time + interval * random_unit(&client->rng); // Las conexiones no salen a la vez
+    unsigned char request[REQUEST_HEADER_SIZE + SEARCH_PAYLOAD_FIXED + 512];
+    while (take_request())
+    {
+        pthread_mutex_lock(&client->lock);
+        while (client->sent - client->received >= OPEN_LOOP_WINDOW && !client->failed)
+            pthread_cond_wait(&client->cond, &client->lock);
+        int failed = client->failed;
+        pthread_mutex_unlock(&client->lock);
+        if (failed)
+            break;
+
+        sleep_until(next);
+        size_t len = build_request(client, request, (uint32_t)(client->sent + 1));
+        pthread_mutex_lock(&client->lock);
+        // La latencia se mide desde el turno, no desde el envío real: si el emisor se atrasó
+        // porque el servidor no da abasto, ese tiempo también cuenta
+        client->send_times[client->sent % OPEN_LOOP_WINDOW] = next;
+        client->sent++;
+        pthread_cond_broadcast(&client->cond);
+        pthread_mutex_unlock(&client->lock);
+        if (send_request(client->fd, request, len) < 0)
+            break;
+        next += interval;
+    }
+    pthread_mutex_lock(&client->lock);
+    client->sender_done = 1;
+    pthread_cond_broadcast(&client->cond);
+    pthread_mutex_unlock(&client->lock);
+    shutdown(client->fd, SHUT_WR);
+    return NULL;
+}
+
+// Lazo abierto, receptor: las respuestas llegan en el orden de las solicitudes
+void *open_loop_receiver(void *arg)
+{
+    Client *client = arg;
+    while (1)
+    {
+        pthread_mutex_lock(&client->lock);
+        while (client->received == client->sent && !client->sender_done)
+            pthread_cond_wait(&client->cond, &client->lock);
+        int finished = client->received == client->sent;
+        double scheduled = client->send_times[client->received % OPEN_LOOP_WINDOW];
+        pthread_mutex_unlock(&client->lock);
+        if (finished)
+            break;
+
+        int result = read_response(client, (uint32_t)(client->received + 1));
+        pthread_mutex_lock(&client->lock);
+        if (result < 0)
+            client->failed = 1;
+        else
+            client->received++;
+        pthread_cond_broadcast(&client->cond);
+        pthread_mutex_unlock(&client->lock);
+        if (result < 0)
+            break;
+        record_latency(client, now_seconds() - scheduled, result);
+    }
+    return NULL;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return da < db ? -1 : da > db;
+}
+
+double percentile(const double *sorted, long count, double q)
+{
+    if (count == 0)
+        return 0;
+    long index = (long)ceil(q * count) - 1;
+    if (index < 0)
+        index = 0;
+    return sorted[index];
+}
+
+void print_usage(const char *program)
+{
+    fprintf(stderr, "Uso: %s [opciones]\n", program);
+    fprintf(stderr, "  -c conexiones  conexiones simultáneas (por defecto 8)\n");
+    fprintf(stderr, "  -d segundos    duración de la medición (por defecto 10)\n");
+    fprintf(stderr, "  -n solicitudes total de solicitudes, en vez de una duración\n");
+    fprintf(stderr, "  -r tasa        lazo abierto: solicitudes por segundo en total\n");
+    fprintf(stderr, "  -z s           exponente de Zipf para elegir IDs (por defecto 1; 0 = uniforme)\n");
+    fprintf(stderr, "  -f fracción    búsquedas por IDs que no existen (por defecto 0)\n");
+    fprintf(stderr, "  -y fracción    búsquedas con filtro de año (por defecto 0)\n");
+    fprintf(stderr, "  -m fracción    búsquedas con filtro de mes (por defecto 0)\n");
+    fprintf(stderr, "  -x b,s,t       pesos de REQ_SEARCH, REQ_SERIES y REQ_TOP (por defecto 100,0,0)\n");
+    fprintf(stderr, "  -i archivo     IDs a pedir, uno por línea y del más al menos popular (por defecto, header.dat)\n");
+    fprintf(stderr, "  -H servidor    dirección del backend (por defecto %s)\n", DEFAULT_HOST);
+    fprintf(stderr, "  -p puerto      puerto del backend (por defecto %d)\n", DEFAULT_PORT);
+    fprintf(stderr, "  -s semilla     semilla de los números aleatorios\n");
+    fprintf(stderr, "  -j             imprimir el resultado como una línea JSON\n");
+}
+
+int main(int argc, char **argv)
+{
+    config.host = DEFAULT_HOST;
+    config.port = DEFAULT_PORT;
+    config.connections = 8;
+    config.duration = 10;
+    config.zipf_s = 1.0;
+    config.mix[MIX_SEARCH] = 100;
+    config.seed = 12345;
+    const char *ids_filepath = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:n:r:z:f:y:m:x:i:H:p:s:j")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config.connections = atoi(optarg);
+            break;
+        case 'd':
+            config.duration = atof(optarg);
+            break;
+        case 'n':
+            config.total_requests = atol(optarg);
+            break;
+        case 'r':
+            config.rate = atof(optarg);
+            break;
+        case 'z':
+            config.zipf_s = atof(optarg);
+            break;
+        case 'f':
+            config.missing_rate = atof(optarg);
+            break;
+        case 'y':
+            config.year_rate = atof(optarg);
+            break;
+        case 'm':
+            config.month_rate = atof(optarg);
+            break;
+        case 'x':
+            if (sscanf(optarg, "%d,%d,%d", &config.mix[MIX_SEARCH], &config.mix[MIX_SERIES], &config.mix[MIX_TOP]) != 3 ||
+                config.mix[MIX_SEARCH] < 0 || config.mix[MIX_SERIES] < 0 || config.mix[MIX_TOP] < 0 ||
+                config.mix[MIX_SEARCH] + config.mix[MIX_SERIES] + config.mix[MIX_TOP] == 0)
+            {
+                fprintf(stderr, "Error: la mezcla debe ser tres pesos no negativos, por ejemplo 90,5,5\n");
+                return 1;
+            }
+            break;
+        case 'i':
+            ids_filepath = optarg;
+            break;
+        case 'H':
+            config.host = optarg;
+            break;
+        case 'p':
+            config.port = atoi(optarg);
+            break;
+        case 's':
+            config.seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'j':
+            config.json = 1;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.connections < 1 || config.connections > MAX_CONNECTIONS || config.duration <= 0 ||
+        config.total_requests < 0 || config.rate < 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // 1. IDs que se van a pedir y su distribución
+    if ((ids_filepath ? load_ids_from_file(ids_filepath) : load_ids_from_index("header.dat")) < 0)
+        return 1;
+    if (pool.count == 0)
+    {
+        fprintf(stderr, "Error: no hay IDs para pedir\n");
+        return 1;
+    }
+    load_years("years.dat");
+    if (build_zipf(config.zipf_s) < 0)
+    {
+        perror("Error: Fallo al asignar memoria para la distribución");
+        return 1;
+    }
+
+    // 2. Abrir todas las conexiones antes de empezar a medir
+    Client *clients = calloc(config.connections, sizeof(Client));
+    if (!clients)
+    {
+        perror("Error: Fallo al asignar memoria para los clientes");
+        return 1;
+    }
+    for (int i = 0; i < config.connections; i++)
+    {
+        clients[i].fd = connect_to_server();
+        if (clients[i].fd < 0)
+        {
+            fprintf(stderr, "Error: no se pudo conectar con %s:%d\n", config.host, config.port);
+            return 1;
+        }
+        clients[i].rng = config.seed * 0x9E3779B97F4A7C15UL + i + 1;
+        pthread_mutex_init(&clients[i].lock, NULL);
+        pthread_cond_init(&clients[i].cond, NULL);
+    }
+
+    // 3. Generar la carga
+    start_time = now_seconds();
+    end_time = start_time + config.duration;
+    for (int i = 0; i < config.connections; i++)
+    {
+        int created;
+        if (config.rate > 0)
+            created = pthread_create(&clients[i].sender, NULL, open_loop_sender, &clients[i]) == 0 &&
+                      pthread_create(&clients[i].receiver, NULL, open_loop_receiver, &clients[i]) == 0;
+        else
+            created = pthread_create(&clients[i].sender, NULL, closed_loop, &clients[i]) == 0;
+        if (!created)
+        {
+            perror("Error creando hilo");
+            return 1;
+        }
+    }
+    for (int i = 0; i < config.connections; i++)
+    {
+        pthread_join(clients[i].sender, NULL);
+        if (config.rate > 0)
+            pthread_join(clients[i].receiver, NULL);
+        close(clients[i].fd);
+    }
+    double elapsed = now_seconds() - start_time;
+
+    // 4. Juntar las latencias de todas las conexiones y calcular los percentiles
+    long requests = 0, errors = 0, failed = 0;
+    unsigned long long bytes = 0;
+    for (int i = 0; i < config.connections; i++)
+    {
+        requests += clients[i].latency_count;
+        errors += clients[i].errors;
+        failed += clients[i].failed;
+        bytes += clients[i].bytes;
+    }
+    double *latencies = malloc(sizeof(double) * (requests ? requests : 1));
+    if (!latencies)
+    {
+        perror("Error: Fallo al asignar memoria para las latencias");
+        return 1;
+    }
+    long filled = 0;
+    for (int i = 0; i < config.connections; i++)
+    {
+        memcpy(latencies + filled, clients[i].latencies, sizeof(double) * clients[i].latency_count);
+        filled += clients[i].latency_count;
+    }
+    qsort(latencies, requests, sizeof(double), compare_doubles);
+
+    double qps = elapsed > 0 ? requests / elapsed : 0;
+    double p50 = percentile(latencies, requests, 0.50) * 1e6;
+    double p90 = percentile(latencies, requests, 0.90) * 1e6;
+    double p99 = percentile(latencies, requests, 0.99) * 1e6;
+    double p999 = percentile(latencies, requests, 0.999) * 1e6;
+    double max = requests ? latencies[requests - 1] * 1e6 : 0;
+
+    if (config.json)
+    {
+        printf("{\"mode\":\"%s\",\"connections\":%d,\"target_rate\":%.1f,\"zipf_s\":%.3f,\"missing_rate\":%.3f,"
+               "\"year_rate\":%.3f,\"month_rate\":%.3f,\"mix\":[%d,%d,%d],\"seconds\":%.3f,\"requests\":%ld,"
+               "\"errors\":%ld,\"failed_connections\":%ld,\"qps\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,"
+               "\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"bytes\":%llu}\n",
+               config.rate > 0 ? "open" : "closed", config.connections, config.rate, config.zipf_s,
+               config.missing_rate, config.year_rate, config.month_rate, config.mix[MIX_SEARCH],
+               config.mix[MIX_SERIES], config.mix[MIX_TOP], elapsed, requests, errors, failed, qps, p50, p90, p99,
+               p999, max, bytes);
+    }
+    else
+    {
+        printf("Lazo %s, %d conexiones, %ld IDs (Zipf s=%.2f)\n", config.rate > 0 ? "abierto" : "cerrado",
+               config.connections, pool.count, config.zipf_s);
+        printf("Solicitudes: %ld en %.2f s (%ld con error, %ld conexiones cortadas)\n", requests, elapsed, errors,
+               failed);
+        printf("QPS: %.1f\n", qps);
+        printf("Latencia (ms): p50 %.3f  p90 %.3f  p99 %.3f  p999 %.3f  máx %.3f\n", p50 / 1000, p90 / 1000,
+               p99 / 1000, p999 / 1000, max / 1000);
+        printf("Recibido: %.1f MB (%.1f MB/s)\n", bytes / 1048576.0, elapsed > 0 ? bytes / 1048576.0 / elapsed : 0.0);
+    }
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdint.h>
+#include <math.h>
+#include "indexer.h"
+
+// Filtro de Bloom sobre las claves del índice (bloom.dat), generado por ./constructor.
+//
+// Responde "seguro que no está" o "puede estar". El backend lo carga completo en memoria y
+// lo consulta antes que la tabla de claves, así que un BibNumber inexistente (un error de
+// tipeo, por ejemplo) se descarta sin tocar header.dat, index.dat ni el CSV.
+//
+// Para cada clave se encienden 'hash_count' bits elegidos con doble hashing
+// (h1 + i * h2) sobre un arreglo de 'bit_count' bits. El tamaño sale de la tasa de falsos
+// positivos pedida: m = -n ln(p) / ln(2)^2 bits y k = (m / n) ln(2) funciones.
+
+#define BLOOM_MAGIC "SPLBLM1"
+#define BLOOM_DEFAULT_RATE 0.01
+#define BLOOM_MAX_HASHES 16
+
+typedef struct {
+    char magic[8];
+    long bit_count;   // Bits del filtro (múltiplo de 64)
+    long hash_count;  // Bits que se encienden por clave
+    long key_count;   // Claves que se agregaron; debe coincidir con header.dat
+    long entry_count; // Entradas de index.dat, para detectar un filtro de otro índice
+    double fp_rate;   // Tasa de falsos positivos con la que se dimensionó
+} BloomHeader;
+
+// Calcula cuántos bits y funciones hacen falta para 'key_count' claves con tasa 'fp_rate'
+void bloom_size(long key_count, double fp_rate, long *bit_count, long *hash_count) {
+    if (key_count < 1) key_count = 1;
+    double bits = -(double)key_count * log(fp_rate) / (M_LN2 * M_LN2);
+    long words = (long)ceil(bits / 64);
+    if (words < 1) words = 1;
+    *bit_count = words * 64;
+
+    long hashes = lround((double)*bit_count / key_count * M_LN2);
+    if (hashes < 1) hashes = 1;
+    if (hashes > BLOOM_MAX_HASHES) hashes = BLOOM_MAX_HASHES;
+    *hash_count = hashes;
+}
+
+// Dos hashes independientes de la clave para el doble hashing. h2 es impar para que los
+// saltos no se queden en un subconjunto de posiciones.
+void bloom_hashes(long key, uint64_t *h1, uint64_t *h2) {
+    uint64_t x = (uint64_t)key;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    *h1 = x ^ (x >> 31);
+    x = *h1 + 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    *h2 = (x ^ (x >> 31)) | 1;
+}
+
+void bloom_add(uint64_t *words, long bit_count, long hash_count, long key) {
+    uint64_t h1, h2;
+    bloom_hashes(key, &h1, &h2);
+    for (long i = 0; i < hash_count; i++) {
+        uint64_t bit = (h1 + i * h2) % (uint64_t)bit_count;
+        words[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+// Devuelve 0 si la clave seguro no está en el índice y 1 si puede estar
+int bloom_may_contain(const uint64_t *words, long bit_count, long hash_count, long key) {
+    uint64_t h1, h2;
+    bloom_hashes(key, &h1, &h2);
+    for (long i = 0; i < hash_count; i++) {
+        uint64_t bit = (h1 + i * h2) % (uint64_t)bit_count;
+        if (!(words[bit / 64] & (1ULL << (bit % 64)))) return 0;
+    }
+    return 1;
+}
+
+#endif // BLOOM_H
@@ -1,93 +1,1862 @@
+#define _GNU_SOURCE // memrchr
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "indexer.h"
+#include "bloom.h"
+#include "csvscan.h"
 
-#define MAX_LINE_LEN 2048 // Asumimos un largo máximo de línea en el CSV
+#define MAX_ID_LEN 256 // Largo máximo del BibNumber
+#define RUN_RECORDS (4 * 1024 * 1024) // Registros que ordenamos en memoria antes de volcarlos a disco (96 MB en total)
+#define MERGE_FAN_IN 64 // Corridas que se mezclan a la vez (64 archivos y 64 MB de búferes como máximo)
+#define MAX_THREADS 64
+#define MAX_INPUT_FILES 1024 // Archivos anuales que se pueden juntar con -j
+#define RUN_FILE_FMT "index.run.%d.tmp"
+#define MERGE_IO_BUFFER (1 << 20) // Búfer de stdio para cada corrida durante la mezcla
+#define MAX_VALUE_LEN 4096 // Largo máximo del valor de una columna en los índices secundarios
+#define FUSE_BLOCK_SIZE (4 * 1024 * 1024) // Bytes que se leen de una vez de los archivos anuales (-j)
+#define FIRST_YEAR 2005
+#define LAST_YEAR 2017
 
-int main(void) {
+// Registro intermedio del ordenamiento externo: la clave, la fecha y el offset de la línea en el CSV.
+// Tiene la misma forma que IndexEntry, así que un índice ya escrito entra directo a la mezcla.
+typedef struct {
+    long key;
+    long checkout_time;
+    long data_offset;
+} SortRecord;
+
+_Static_assert(sizeof(SortRecord) == sizeof(IndexEntry), "SortRecord e IndexEntry deben coincidir");
+
+// Índice anterior que se mezcla con las filas nuevas en el modo de agregado (-a)
+typedef struct {
+    const SortRecord *entries;
+    size_t count;
+    const long *remap; // Clave nueva de cada clave anterior (índices secundarios), o NULL
+} BaseIndex;
+
+// Un valor distinto de una columna, mientras se arma su índice secundario
+typedef struct {
+    long name_offset; // Posición del texto en 'strings'
+    long name_len;
+    long rows;        // Filas con este valor
+    long code;        // Posición del valor en orden alfabético; es la clave de sus entradas
+} DictValue;
+
+// Valores distintos de una columna (tabla hash con direccionamiento abierto). La llena un
+// hilo que recorre todo el CSV; después se ordena y queda de solo lectura.
+typedef struct {
+    int column;
+    const char *csv_data;
+    size_t begin;
+    size_t end;
+    char *strings;
+    size_t strings_size;
+    size_t strings_capacity;
+    DictValue *values;
+    long count;
+    long capacity;
+    long *slots;      // Índice + 1 del valor en 'values', 0 si la posición está libre
+    long slot_count;  // Potencia de 2
+    long rows;
+    int error;
+} ValueDict;
+
+// Un bloque de líneas completas leído de un archivo anual (-j). Va a dos etapas a la vez, la que
+// lo escribe en el CSV combinado y la que lo indexa, y vuelve a la reserva cuando ambas terminan.
+typedef struct {
+    char *buffer;     // FUSE_BLOCK_SIZE + 1 bytes, para poder agregar un salto de línea final
+    const char *data; // Primer byte del bloque dentro de 'buffer'
+    size_t size;
+    size_t skip;      // Bytes del principio que se escriben pero no se indexan (la cabecera)
+    long out_offset;  // Posición del bloque en el CSV combinado
+    int refs;         // Etapas que todavía lo usan
+} FuseBlock;
+
+typedef struct {
+    FuseBlock **items;
+    int capacity;
+    int head;
+    int count;
+    int closed;
+    pthread_cond_t ready;
+} BlockQueue;
+
+// Etapas de -j: el hilo principal lee, un hilo escribe y los demás indexan. Las colas comparten
+// un solo mutex; por ellas pasan pocos bloques grandes, así que no se disputa.
+typedef struct {
+    FuseBlock *blocks;
+    int block_count;
+    BlockQueue free_blocks;
+    BlockQueue parse_queue;
+    BlockQueue write_queue;
+    pthread_mutex_t lock;
+    int out_fd;
+    int error;
+} FusePipeline;
+
+// Trabajo de cada hilo: un trozo del CSV que empieza y termina en un límite de línea
+typedef struct {
+    const char *csv_data;  // CSV completo mapeado en memoria
+    size_t begin;          // Offset de la primera línea del trozo
+    size_t end;            // Offset donde empieza el siguiente trozo
+    SortRecord *records;   // Bloque de ordenamiento propio del hilo
+    size_t capacity;
+    size_t count;          // Registros pendientes en el bloque (al terminar, ya ordenados)
+    long rows;             // Filas indexadas por este hilo
+    int error;
+    int column;            // Columna que se indexa: COL_BIBNUMBER para index.dat
+    const ValueDict *dict; // Valores de la columna, en los índices secundarios
+    FusePipeline *pipeline; // Con -j, los bloques llegan por aquí en vez de 'csv_data'
+} ChunkWorker;
+
+// Número de corridas volcadas a disco; lo comparten todos los hilos
+int run_count = 0;
+pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Claves distintas en el orden en que salen de la mezcla, con su bloque en index.dat.
+// Al final se reparten en la tabla de direccionamiento abierto de header.dat.
+typedef struct {
+    KeySlot *keys;
+    long count;
+    long capacity;
+    long entry_count;
+    YearManifest *years; // Solo en index.dat: filas por año y mes para years.dat
+} KeyList;
+
+// Una fuente de la mezcla final: una corrida en disco o el bloque que le quedó en memoria a un hilo
+typedef struct {
+    FILE *file;
+    const SortRecord *mem;
+    size_t pos;
+    size_t count;
+    const long *remap; // Si no es NULL, traduce la clave de los registros en memoria
+    SortRecord head;   // Registro al frente de la fuente
+} RunSource;
+
+// Ordena por clave y, dentro de la clave, por fecha de préstamo y posición en el CSV.
+// Como el offset es único, el orden es total y la mezcla siempre produce el mismo index.dat
+// sin importar cuántos hilos se usen ni en qué orden terminen.
+int compare_records(const void *a, const void *b) {
+    const SortRecord *ra = a;
+    const SortRecord *rb = b;
+    if (ra->key != rb->key) return ra->key < rb->key ? -1 : 1;
+    if (ra->checkout_time != rb->checkout_time) return ra->checkout_time < rb->checkout_time ? -1 : 1;
+    if (ra->data_offset != rb->data_offset) return ra->data_offset < rb->data_offset ? -1 : 1;
+    return 0;
+}
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Ordena los registros en memoria y los escribe como una corrida temporal.
+// Devuelve 0 si todo salió bien y -1 en caso de error.
+int spill_run(SortRecord *records, size_t count) {
+    pthread_mutex_lock(&run_lock);
+    int run_id = run_count++;
+    pthread_mutex_unlock(&run_lock);
+
+    char run_path[64];
+    snprintf(run_path, sizeof(run_path), RUN_FILE_FMT, run_id);
+
+    qsort(records, count, sizeof(SortRecord), compare_records);
+
+    FILE *run_file = fopen(run_path, "wb");
+    if (!run_file) {
+        perror("Error creando corrida temporal");
+        return -1;
+    }
+    if (fwrite(records, sizeof(SortRecord), count, run_file) != count) {
+        perror("Error escribiendo corrida temporal");
+        fclose(run_file);
+        return -1;
+    }
+    fclose(run_file);
+    return 0;
+}
+
+// Largo del ID (primera columna) de una fila, o 0 si la línea está vacía o mal formada y
+// no se indexa. Todos los índices saltan las mismas líneas.
+size_t line_id_len(const CsvRow *row) {
+    size_t id_len = row->separator_count > 0 ? row->separators[0] : row->len;
+    if (id_len == 0 || id_len >= MAX_ID_LEN || row->line[0] == '\r') return 0;
+    return id_len;
+}
+
+// La fecha es la última columna: lo que sigue al último separador. CallNumber puede traer
+// comas, así que no se cuentan columnas desde el principio.
+long line_checkout_time(const CsvRow *row) {
+    if (row->separator_count == 0) return -1;
+    char date_str[64];
+    size_t date_len = row->len - row->last_separator - 1;
+    if (date_len >= sizeof(date_str)) date_len = sizeof(date_str) - 1;
+    memcpy(date_str, row->line + row->last_separator + 1, date_len);
+    date_str[date_len] = '\0';
+    return parse_checkout_datetime(date_str);
+}
+
+// Copia en 'out' el valor de una columna de la fila, sin las comillas del CSV. Las cuatro
+// primeras columnas no llevan comas; CallNumber es todo lo que queda antes de la fecha.
+// Una columna que falta queda vacía. Devuelve el largo del valor.
+size_t line_field(const CsvRow *row, int column, char *out) {
+    FieldView fields[CSV_COLUMNS];
+    int found = csv_row_fields(row, fields, CSV_COLUMNS);
+    // Sin la coma de la fecha no hay CallNumber
+    int present = column < COL_CALLNUMBER ? found > column : found == CSV_COLUMNS;
+    const char *cursor = present ? fields[column].start : row->line;
+    const char *field_end = present ? cursor + fields[column].len : cursor;
+
+    size_t len = field_end - cursor;
+    if (len >= MAX_VALUE_LEN) len = MAX_VALUE_LEN - 1;
+    if (len >= 2 && cursor[0] == '"' && cursor[len - 1] == '"') {
+        size_t out_len = 0;
+        for (size_t i = 1; i < len - 1; i++) {
+            out[out_len++] = cursor[i];
+            if (cursor[i] == '"' && cursor[i + 1] == '"') i++; // "" dentro de comillas es una comilla
+        }
+        return out_len;
+    }
+    memcpy(out, cursor, len);
+    return len;
+}
+
+// Posición del valor en dict->values, o -1 si no está
+long dict_find(const ValueDict *dict, const char *text, size_t len) {
+    for (unsigned long slot = value_hash(text, len) & (dict->slot_count - 1);; slot = (slot + 1) & (dict->slot_count - 1)) {
+        long index = dict->slots[slot] - 1;
+        if (index < 0) return -1;
+        const DictValue *value = &dict->values[index];
+        if ((size_t)value->name_len == len && memcmp(dict->strings + value->name_offset, text, len) == 0) return index;
+    }
+}
+
+// Duplica la tabla hash del diccionario. Devuelve 0 si todo salió bien y -1 si no hay memoria.
+int dict_grow_slots(ValueDict *dict) {
+    long slot_count = dict->slot_count ? dict->slot_count * 2 : 1 << 12;
+    long *slots = calloc(slot_count, sizeof(long));
+    if (!slots) return -1;
+    for (long i = 0; i < dict->count; i++) {
+        const DictValue *value = &dict->values[i];
+        unsigned long slot = value_hash(dict->strings + value->name_offset, value->name_len) & (slot_count - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = i + 1;
+    }
+    free(dict->slots);
+    dict->slots = slots;
+    dict->slot_count = slot_count;
+    return 0;
+}
+
+// Agrega el valor si es nuevo y le suma 'rows' filas. Devuelve -1 si no hay memoria.
+int dict_count_value(ValueDict *dict, const char *text, size_t len, long rows) {
+    long index = dict->slots ? dict_find(dict, text, len) : -1;
+    if (index >= 0) {
+        dict->values[index].rows += rows;
+        return 0;
+    }
+
+    if ((dict->count + 1) * 2 > dict->slot_count && dict_grow_slots(dict) < 0) return -1;
+    if (dict->count == dict->capacity) {
+        long capacity = dict->capacity ? dict->capacity * 2 : 1 << 12;
+        DictValue *grown = realloc(dict->values, sizeof(DictValue) * capacity);
+        if (!grown) return -1;
+        dict->values = grown;
+        dict->capacity = capacity;
+    }
+    if (dict->strings_size + len > dict->strings_capacity) {
+        size_t capacity = dict->strings_capacity ? dict->strings_capacity : 1 << 16;
+        while (capacity < dict->strings_size + len) capacity *= 2;
+        char *grown = realloc(dict->strings, capacity);
+        if (!grown) return -1;
+        dict->strings = grown;
+        dict->strings_capacity = capacity;
+    }
+
+    DictValue *value = &dict->values[dict->count];
+    value->name_offset = dict->strings_size;
+    value->name_len = len;
+    value->rows = rows;
+    value->code = -1;
+    memcpy(dict->strings + dict->strings_size, text, len);
+    dict->strings_size += len;
+
+    unsigned long slot = value_hash(text, len) & (dict->slot_count - 1);
+    while (dict->slots[slot] != 0) slot = (slot + 1) & (dict->slot_count - 1);
+    dict->slots[slot] = ++dict->count;
+    return 0;
+}
+
+// Primera pasada de un índice secundario: recorre el CSV (o solo lo agregado) y junta los
+// valores distintos de la columna con cuántas filas tiene cada uno. Corre un hilo por columna.
+void *collect_values(void *arg) {
+    ValueDict *dict = arg;
+    char value[MAX_VALUE_LEN];
+    CsvScanner scanner;
+    CsvRow row;
+    csv_scan_init(&scanner, dict->csv_data + dict->begin, dict->end - dict->begin);
+
+    while (csv_scan_row(&scanner, &row)) {
+        if (line_id_len(&row) == 0) continue;
+
+        size_t value_len = line_field(&row, dict->column, value);
+        if (dict_count_value(dict, value, value_len, 1) < 0) {
+            perror("Error: Fallo al asignar memoria para los valores de la columna");
+            dict->error = 1;
+            return NULL;
+        }
+        dict->rows++;
+    }
+    return NULL;
+}
+
+// Orden alfabético (por bytes) de dos valores del diccionario, para qsort_r
+int compare_values(const void *a, const void *b, void *arg) {
+    const ValueDict *dict = arg;
+    const DictValue *va = &dict->values[*(const long *)a];
+    const DictValue *vb = &dict->values[*(const long *)b];
+    size_t len = va->name_len < vb->name_len ? va->name_len : vb->name_len;
+    int cmp = memcmp(dict->strings + va->name_offset, dict->strings + vb->name_offset, len);
+    if (cmp != 0) return cmp;
+    return va->name_len < vb->name_len ? -1 : va->name_len > vb->name_len;
+}
+
+void free_dict(ValueDict *dict) {
+    free(dict->strings);
+    free(dict->values);
+    free(dict->slots);
+}
+
+// Recorre las líneas de data[begin, end), extrae la clave y la fecha y acumula los registros.
+// 'base_offset' es la posición de 'data' en el CSV. Devuelve 0 si todo salió bien y -1 si no.
+int index_lines(ChunkWorker *worker, const char *data, size_t begin, size_t end, long base_offset) {
+    char value[MAX_VALUE_LEN];
+    CsvScanner scanner;
+    CsvRow row;
+    csv_scan_init(&scanner, data + begin, end - begin);
+
+    while (csv_scan_row(&scanner, &row)) {
+        const char *line = row.line;
+        long line_offset = base_offset + (long)(line - data);
+
+        // Extraer el ID (primera columna)
+        size_t id_len = line_id_len(&row);
+        if (id_len == 0) {
+            continue; // Línea vacía o mal formada
+        }
+
+        // Calcular la clave (del ID, o la posición del valor de la columna) y guardar el registro
+        long key;
+        if (worker->column == COL_BIBNUMBER) {
+            key = index_key(line, id_len);
+        } else {
+            size_t value_len = line_field(&row, worker->column, value);
+            long index = dict_find(worker->dict, value, value_len);
+            if (index < 0) {
+                fprintf(stderr, "Error: el CSV cambió mientras se construía el índice de %s\n",
+                        column_name(worker->column));
+                worker->error = 1;
+                return -1;
+            }
+            key = worker->dict->values[index].code;
+        }
+        SortRecord *record = &worker->records[worker->count++];
+        record->key = key;
+        record->checkout_time = line_checkout_time(&row);
+        record->data_offset = line_offset;
+        worker->rows++;
+
+        // Si el bloque del hilo se llenó, lo volcamos como corrida ordenada
+        if (worker->count == worker->capacity) {
+            if (spill_run(worker->records, worker->count) < 0) {
+                worker->error = 1;
+                return -1;
+            }
+            worker->count = 0;
+        }
+    }
+    return 0;
+}
+
+// Indexa un trozo del CSV mapeado en memoria
+void *index_chunk(void *arg) {
+    ChunkWorker *worker = arg;
+    if (index_lines(worker, worker->csv_data, worker->begin, worker->end, 0) < 0) return NULL;
+
+    // Lo que quedó en memoria se ordena aquí mismo, en paralelo, y entra a la mezcla sin tocar disco
+    qsort(worker->records, worker->count, sizeof(SortRecord), compare_records);
+    return NULL;
+}
+
+// Avanza una fuente de la mezcla. Devuelve 1 si hay un nuevo registro al frente y 0 si se agotó.
+int advance_source(RunSource *source) {
+    if (source->file) {
+        return fread(&source->head, sizeof(SortRecord), 1, source->file) == 1;
+    }
+    if (source->pos < source->count) {
+        source->head = source->mem[source->pos++];
+        if (source->remap) source->head.key = source->remap[source->head.key];
+        return 1;
+    }
+    return 0;
+}
+
+// Escribe una entrada en index.dat y la cuenta en el bloque de su clave
+int emit_entry(FILE *index_file, KeyList *key_list, const SortRecord *record) {
+    IndexEntry entry;
+    entry.key = record->key;
+    entry.checkout_time = record->checkout_time;
+    entry.data_offset = record->data_offset;
+    if (fwrite(&entry, sizeof(IndexEntry), 1, index_file) != 1) {
+        perror("Error escribiendo archivo de índice");
+        return -1;
+    }
+
+    // Las entradas salen ordenadas por clave, así que una clave nueva siempre va al final
+    if (key_list->count == 0 || key_list->keys[key_list->count - 1].key != record->key) {
+        if (key_list->count == key_list->capacity) {
+            long capacity = key_list->capacity ? key_list->capacity * 2 : 1 << 16;
+            KeySlot *grown = realloc(key_list->keys, sizeof(KeySlot) * capacity);
+            if (!grown) {
+                perror("Error: Fallo al asignar memoria para las claves");
+                return -1;
+            }
+            key_list->keys = grown;
+            key_list->capacity = capacity;
+        }
+        KeySlot *slot = &key_list->keys[key_list->count++];
+        slot->key = record->key;
+        slot->start = key_list->entry_count;
+        slot->count = 0;
+    }
+    key_list->keys[key_list->count - 1].count++;
+    key_list->entry_count++;
+    if (key_list->years) manifest_add(key_list->years, record->checkout_time);
+    return 0;
+}
+
+// Reparte las claves en una tabla de direccionamiento abierto con al menos el doble de
+// posiciones que claves. Devuelve la tabla (con 'table_size' posiciones) o NULL si no hay memoria.
+KeySlot *build_key_table(const KeyList *key_list, long *table_size) {
+    long size = 16;
+    while (size < key_list->count * 2) size *= 2;
+
+    KeySlot *table = malloc(sizeof(KeySlot) * size);
+    if (!table) {
+        perror("Error: Fallo al asignar memoria para la tabla de claves");
+        return NULL;
+    }
+    for (long i = 0; i < size; i++) {
+        table[i].key = KEY_EMPTY;
+        table[i].start = 0;
+        table[i].count = 0;
+    }
+    for (long i = 0; i < key_list->count; i++) {
+        unsigned long slot = key_slot(key_list->keys[i].key, size);
+        while (table[slot].key != KEY_EMPTY) slot = (slot + 1) & (size - 1);
+        table[slot] = key_list->keys[i];
+    }
+    *table_size = size;
+    return table;
+}
+
+// Escribe bloom.dat con todas las claves de la lista. Devuelve 0 si todo salió bien y -1 si no.
+int write_bloom_filter(const char *path, const KeyList *key_list, double fp_rate) {
+    BloomHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BLOOM_MAGIC, sizeof(header.magic));
+    bloom_size(key_list->count, fp_rate, &header.bit_count, &header.hash_count);
+    header.key_count = key_list->count;
+    header.entry_count = key_list->entry_count;
+    header.fp_rate = fp_rate;
+
+    uint64_t *words = calloc(header.bit_count / 64, sizeof(uint64_t));
+    if (!words) {
+        perror("Error: Fallo al asignar memoria para el filtro de Bloom");
+        return -1;
+    }
+    for (long i = 0; i < key_list->count; i++) {
+        bloom_add(words, header.bit_count, header.hash_count, key_list->keys[i].key);
+    }
+
+    FILE *bloom_file = fopen(path, "wb");
+    if (!bloom_file) {
+        perror("Error creando archivo del filtro de Bloom");
+        free(words);
+        return -1;
+    }
+    int result = 0;
+    if (fwrite(&header, sizeof(header), 1, bloom_file) != 1 ||
+        fwrite(words, sizeof(uint64_t), header.bit_count / 64, bloom_file) != (size_t)(header.bit_count / 64)) {
+        perror("Error escribiendo archivo del filtro de Bloom");
+        result = -1;
+    }
+    fclose(bloom_file);
+    free(words);
+    if (result == 0) {
+        printf("Filtro de Bloom: %ld bits (%.1f KB), %ld funciones, %.4f%% de falsos positivos\n",
+               header.bit_count, header.bit_count / 8 / 1024.0, header.hash_count, fp_rate * 100);
+    }
+    return result;
+}
+
+// Escribe years.dat con las filas de cada mes. Devuelve 0 si todo salió bien y -1 si no.
+int write_year_manifest(const char *path, YearManifest *manifest, long entry_count) {
+    memcpy(manifest->magic, YEARS_MAGIC, sizeof(manifest->magic));
+    manifest->entry_count = entry_count;
+    FILE *years_file = fopen(path, "wb");
+    if (!years_file) {
+        perror("Error creando el manifiesto de años");
+        return -1;
+    }
+    int result = fwrite(manifest, sizeof(*manifest), 1, years_file) == 1 ? 0 : -1;
+    if (fclose(years_file) != 0) result = -1;
+    if (result < 0) {
+        perror("Error escribiendo el manifiesto de años");
+        return -1;
+    }
+    if (manifest->first_year > 0) {
+        printf("Manifiesto de años: de %ld a %ld (%ld filas sin fecha)\n", manifest->first_year, manifest->last_year,
+               manifest->undated_rows);
+    }
+    return 0;
+}
+
+// Restaura la propiedad de montículo mínimo desde la posición 'pos' hacia abajo.
+// 'heap' guarda índices de fuente y 'sources' el registro al frente de cada una.
+void sift_down(int *heap, int heap_size, const RunSource *sources, int pos) {
+    while (1) {
+        int smallest = pos;
+        int left = 2 * pos + 1;
+        int right = left + 1;
+        if (left < heap_size && compare_records(&sources[heap[left]].head, &sources[heap[smallest]].head) < 0) smallest = left;
+        if (right < heap_size && compare_records(&sources[heap[right]].head, &sources[heap[smallest]].head) < 0) smallest = right;
+        if (smallest == pos) return;
+        int tmp = heap[pos];
+        heap[pos] = heap[smallest];
+        heap[smallest] = tmp;
+        pos = smallest;
+    }
+}
+
+// Abre las corridas [first, last) como fuentes de la mezcla a partir de sources[0].
+// Devuelve cuántas abrió, o -1 (con las que sí abrió ya cerradas) si alguna falla.
+int open_runs(RunSource *sources, int first, int last) {
+    for (int i = first; i < last; i++) {
+        char run_path[64];
+        snprintf(run_path, sizeof(run_path), RUN_FILE_FMT, i);
+        RunSource *source = &sources[i - first];
+        memset(source, 0, sizeof(*source));
+        source->file = fopen(run_path, "rb");
+        if (!source->file) {
+            perror("Error abriendo corrida temporal");
+            for (int j = 0; j < i - first; j++) fclose(sources[j].file);
+            return -1;
+        }
+        setvbuf(source->file, NULL, _IOFBF, MERGE_IO_BUFFER);
+    }
+    return last - first;
+}
+
+// Borra las corridas [first, last)
+void remove_runs(int first, int last) {
+    for (int i = first; i < last; i++) {
+        char run_path[64];
+        snprintf(run_path, sizeof(run_path), RUN_FILE_FMT, i);
+        remove(run_path);
+    }
+}
+
+// Mezcla las fuentes con un montículo mínimo. Cada registro va a 'run_file' si no es NULL
+// (una corrida intermedia) o, si no, a index.dat con emit_entry.
+// Devuelve 0 si todo salió bien y -1 en caso de error.
+int merge_heap(RunSource *sources, int source_count, FILE *run_file, FILE *index_file, KeyList *key_list) {
+    static int heap[MERGE_FAN_IN + MAX_THREADS + 1];
+    int heap_size = 0;
+    for (int i = 0; i < source_count; i++) {
+        if (advance_source(&sources[i])) {
+            heap[heap_size++] = i;
+        }
+    }
+    for (int i = heap_size / 2 - 1; i >= 0; i--) {
+        sift_down(heap, heap_size, sources, i);
+    }
+
+    // Siempre sacamos la cima del montículo y la reemplazamos por el siguiente registro de su fuente
+    while (heap_size > 0) {
+        RunSource *min_source = &sources[heap[0]];
+        if (run_file) {
+            if (fwrite(&min_source->head, sizeof(SortRecord), 1, run_file) != 1) {
+                perror("Error escribiendo corrida temporal");
+                return -1;
+            }
+        } else if (emit_entry(index_file, key_list, &min_source->head) < 0) {
+            return -1;
+        }
+        if (!advance_source(min_source)) {
+            heap[0] = heap[--heap_size]; // La fuente se agotó
+        }
+        sift_down(heap, heap_size, sources, 0);
+    }
+    return 0;
+}
+
+// Junta las corridas de a MERGE_FAN_IN en corridas más largas, de las más viejas a las más
+// nuevas, hasta que queden a lo sumo MERGE_FAN_IN. Así la mezcla final nunca tiene abiertos
+// más archivos ni búferes que eso, sin importar cuántos hilos volcaron corridas.
+// Deja en '*first_run' la primera corrida que queda. Devuelve 0 si todo salió bien y -1 si no.
+int reduce_runs(int *first_run) {
+    static RunSource sources[MERGE_FAN_IN];
+    while (run_count - *first_run > MERGE_FAN_IN) {
+        int last = *first_run + MERGE_FAN_IN;
+        int out_id = run_count++;
+        char run_path[64];
+        snprintf(run_path, sizeof(run_path), RUN_FILE_FMT, out_id);
+        FILE *run_file = fopen(run_path, "wb");
+        if (!run_file) {
+            perror("Error creando corrida temporal");
+            return -1;
+        }
+        setvbuf(run_file, NULL, _IOFBF, MERGE_IO_BUFFER);
+        int source_count = open_runs(sources, *first_run, last);
+        int result = source_count < 0 ? -1 : merge_heap(sources, source_count, run_file, NULL, NULL);
+        for (int i = 0; i < source_count; i++) fclose(sources[i].file);
+        if (fclose(run_file) != 0 && result == 0) {
+            perror("Error escribiendo corrida temporal");
+            result = -1;
+        }
+        if (result < 0) return -1;
+        remove_runs(*first_run, last);
+        *first_run = last;
+    }
+    return 0;
+}
+
+// Mezcla las corridas en disco y los bloques en memoria de los hilos en index.dat.
+// Como cada fuente está ordenada por (clave, fecha, offset), basta con tomar siempre
+// el menor de los registros al frente.
+int merge_sources(ChunkWorker *workers, int thread_count, const BaseIndex *base, FILE *index_file,
+                  KeyList *key_list) {
+    static RunSource sources[MERGE_FAN_IN + MAX_THREADS + 1];
+    int first_run = 0;
+    int result = reduce_runs(&first_run);
+    int source_count = result == 0 ? open_runs(sources, first_run, run_count) : -1;
+    if (source_count < 0) {
+        remove_runs(first_run, run_count);
+        return -1;
+    }
+
+    for (int t = 0; t < thread_count; t++) {
+        RunSource *source = &sources[source_count++];
+        memset(source, 0, sizeof(*source));
+        source->mem = workers[t].records;
+        source->count = workers[t].count;
+    }
+    if (base) {
+        // El índice anterior ya está ordenado; entra como una fuente más
+        RunSource *source = &sources[source_count++];
+        memset(source, 0, sizeof(*source));
+        source->mem = base->entries;
+        source->count = base->count;
+        source->remap = base->remap;
+    }
+
+    result = merge_heap(sources, source_count, NULL, index_file, key_list);
+
+    for (int i = 0; i < source_count; i++) {
+        if (sources[i].file) fclose(sources[i].file);
+    }
+    remove_runs(first_run, run_count);
+    return result;
+}
+
+// Construye un índice ordenado de la columna 'column' con las filas desde 'data_begin' y lo
+// escribe en 'out' a partir de su posición actual. Para un índice secundario, 'dict' da la
+// clave de cada valor. Si hay 'base', sus entradas se mezclan con las nuevas.
+// Devuelve 0 si todo salió bien y -1 en caso de error.
+int build_sorted_index(const char *csv_data, size_t csv_size, size_t data_begin, long thread_count, int column,
+                       const ValueDict *dict, const BaseIndex *base, FILE *out, KeyList *key_list,
+                       long *total_rows_out) {
+    double start_time = now_seconds();
+    run_count = 0;
+
+    // Partir el CSV en trozos del mismo tamaño, movidos hasta el siguiente salto de línea
+    // para que ninguna fila quede repartida entre dos hilos. Cada hilo acumula
+    // (clave, fecha, offset) en su propio bloque y lo vuelca a disco cuando se llena,
+    // así el índice se puede construir aunque el dataset no quepa en RAM.
+    ChunkWorker workers[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    size_t chunk_size = (csv_size - data_begin) / thread_count + 1;
+    size_t chunk_begin = data_begin;
+    for (int t = 0; t < thread_count; t++) {
+        size_t chunk_end = chunk_begin + chunk_size;
+        if (t == thread_count - 1 || chunk_end >= csv_size) {
+            chunk_end = csv_size;
+        } else {
+            const char *newline = memchr(csv_data + chunk_end, '\n', csv_size - chunk_end);
+            chunk_end = newline ? (size_t)(newline - csv_data) + 1 : csv_size;
+        }
+
+        memset(&workers[t], 0, sizeof(ChunkWorker));
+        workers[t].csv_data = csv_data;
+        workers[t].begin = chunk_begin;
+        workers[t].end = chunk_end;
+        workers[t].capacity = RUN_RECORDS / thread_count;
+        workers[t].column = column;
+        workers[t].dict = dict;
+        workers[t].records = malloc(sizeof(SortRecord) * workers[t].capacity);
+        if (!workers[t].records) {
+            perror("Error: Fallo al asignar memoria para el ordenamiento");
+            return -1;
+        }
+        chunk_begin = chunk_end;
+    }
+    for (int t = 0; t < thread_count; t++) {
+        if (pthread_create(&threads[t], NULL, index_chunk, &workers[t]) != 0) {
+            perror("Error creando hilo");
+            return -1;
+        }
+    }
+
+    long total_rows = 0;
+    int result = 0;
+    for (int t = 0; t < thread_count; t++) {
+        pthread_join(threads[t], NULL);
+        total_rows += workers[t].rows;
+        if (workers[t].error) result = -1;
+    }
+
+    double parse_time = now_seconds() - start_time;
+    if (column == COL_BIBNUMBER) {
+        printf("Lectura: %ld filas en %.2f s (%.0f filas/s)\n", total_rows, parse_time,
+               parse_time > 0 ? total_rows / parse_time : 0.0);
+    }
+
+    // Mezclar corridas y bloques en memoria para escribir el índice ya ordenado
+    if (result == 0) {
+        if (run_count > 0) {
+            printf("Mezclando %d corridas ordenadas...\n", run_count);
+        }
+        result = merge_sources(workers, thread_count, base, out, key_list);
+    }
+    for (int t = 0; t < thread_count; t++) {
+        free(workers[t].records);
+    }
+    *total_rows_out = total_rows;
+    return result;
+}
+
+// Agrega un bloque a la cola. Hay que tener tomado el mutex del pipeline.
+void queue_push(BlockQueue *queue, FuseBlock *block) {
+    queue->items[(queue->head + queue->count) % queue->capacity] = block;
+    queue->count++;
+    pthread_cond_signal(&queue->ready);
+}
+
+// Saca el siguiente bloque de la cola; espera si está vacía. Devuelve NULL cuando la cola se
+// cerró y ya no quedan bloques.
+FuseBlock *queue_pop(FusePipeline *pipeline, BlockQueue *queue) {
+    pthread_mutex_lock(&pipeline->lock);
+    while (queue->count == 0 && !queue->closed) pthread_cond_wait(&queue->ready, &pipeline->lock);
+    FuseBlock *block = NULL;
+    if (queue->count > 0) {
+        block = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return block;
+}
+
+// Una etapa terminó con el bloque; si era la última, vuelve a la reserva
+void release_block(FusePipeline *pipeline, FuseBlock *block) {
+    pthread_mutex_lock(&pipeline->lock);
+    if (--block->refs <= 0) queue_push(&pipeline->free_blocks, block);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+void pipeline_fail(FusePipeline *pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->error = 1;
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+// Etapa de indexado: cada hilo toma bloques y acumula sus registros con el offset que tendrán
+// en el CSV combinado. Después de un error sigue sacando bloques para no trabar al lector.
+void *index_blocks(void *arg) {
+    ChunkWorker *worker = arg;
+    FusePipeline *pipeline = worker->pipeline;
+    FuseBlock *block;
+    while ((block = queue_pop(pipeline, &pipeline->parse_queue))) {
+        if (!worker->error && index_lines(worker, block->data, block->skip, block->size, block->out_offset) < 0) {
+            pipeline_fail(pipeline);
+        }
+        release_block(pipeline, block);
+    }
+    if (!worker->error) qsort(worker->records, worker->count, sizeof(SortRecord), compare_records);
+    return NULL;
+}
+
+// Etapa de escritura: cada bloque va a su posición del CSV combinado
+void *write_blocks(void *arg) {
+    FusePipeline *pipeline = arg;
+    FuseBlock *block;
+    int failed = 0;
+    while ((block = queue_pop(pipeline, &pipeline->write_queue))) {
+        size_t done = 0;
+        while (!failed && done < block->size) {
+            ssize_t n = pwrite(pipeline->out_fd, block->data + done, block->size - done, block->out_offset + done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                perror("Error escribiendo el CSV combinado");
+                failed = 1;
+                pipeline_fail(pipeline);
+                break;
+            }
+            done += n;
+        }
+        release_block(pipeline, block);
+    }
+    return NULL;
+}
+
+// Etapa de lectura: recorre los archivos en orden y los corta en bloques de líneas completas.
+// Solo se conserva la cabecera del primer archivo; la de los demás se descarta. La línea que
+// queda cortada al final de un bloque pasa al siguiente. Devuelve el tamaño del CSV combinado
+// o -1 si hubo un error.
+long read_yearly_files(FusePipeline *pipeline, const char *const *paths, int path_count) {
+    char *carry = malloc(FUSE_BLOCK_SIZE);
+    if (!carry) {
+        perror("Error: Fallo al asignar memoria para la lectura");
+        return -1;
+    }
+    long out_offset = 0;
+    int header_written = 0;
+    int failed = 0;
+
+    for (int i = 0; i < path_count && !failed; i++) {
+        int fd = open(paths[i], O_RDONLY);
+        if (fd < 0) {
+            perror(paths[i]); // Como en ./juntar, un año que falta no impide juntar los demás
+            continue;
+        }
+        printf("Procesando archivo: %s\n", paths[i]);
+        size_t carry_len = 0;
+        int in_header = 1;
+        int eof = 0;
+        while (!eof && !failed) {
+            FuseBlock *block = queue_pop(pipeline, &pipeline->free_blocks);
+            pthread_mutex_lock(&pipeline->lock);
+            failed = pipeline->error;
+            pthread_mutex_unlock(&pipeline->lock);
+            if (failed) {
+                release_block(pipeline, block);
+                break;
+            }
+
+            memcpy(block->buffer, carry, carry_len);
+            size_t filled = carry_len;
+            carry_len = 0;
+            while (filled < FUSE_BLOCK_SIZE) {
+                ssize_t n = read(fd, block->buffer + filled, FUSE_BLOCK_SIZE - filled);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) {
+                    perror(paths[i]);
+                    failed = 1;
+                }
+                if (n <= 0) {
+                    eof = 1;
+                    break;
+                }
+                filled += n;
+            }
+            // Si el archivo no termina en salto de línea, su última fila quedaría pegada a la siguiente
+            if (eof && filled > 0 && block->buffer[filled - 1] != '\n') block->buffer[filled++] = '\n';
+
+            size_t start = 0;
+            block->skip = 0;
+            if (in_header && filled > 0) {
+                const char *newline = memchr(block->buffer, '\n', filled);
+                if (!newline) {
+                    fprintf(stderr, "Error: la cabecera de '%s' es demasiado larga\n", paths[i]);
+                    failed = 1;
+                } else if (header_written) {
+                    start = newline - block->buffer + 1;
+                } else {
+                    block->skip = newline - block->buffer + 1;
+                    header_written = 1;
+                }
+                in_header = 0;
+            }
+            size_t end = filled;
+            if (!eof && !failed) {
+                const char *last = memrchr(block->buffer + start, '\n', filled - start);
+                if (!last) {
+                    fprintf(stderr, "Error: '%s' tiene una línea de más de %d bytes\n", paths[i], FUSE_BLOCK_SIZE);
+                    failed = 1;
+                } else {
+                    end = last - block->buffer + 1;
+                    carry_len = filled - end;
+                    memcpy(carry, block->buffer + end, carry_len);
+                }
+            }
+
+            block->data = block->buffer + start;
+            block->size = end - start;
+            block->out_offset = out_offset;
+            pthread_mutex_lock(&pipeline->lock);
+            if (failed || block->size == 0) {
+                queue_push(&pipeline->free_blocks, block);
+            } else {
+                block->refs = 2;
+                queue_push(&pipeline->parse_queue, block);
+                queue_push(&pipeline->write_queue, block);
+                out_offset += block->size;
+            }
+            pthread_mutex_unlock(&pipeline->lock);
+        }
+        close(fd);
+    }
+    free(carry);
+
+    if (!failed && out_offset == 0) {
+        fprintf(stderr, "Error: no hay filas en los archivos a juntar\n");
+        failed = 1;
+    }
+    if (failed) pipeline_fail(pipeline);
+    return failed ? -1 : out_offset;
+}
+
+// Junta los archivos anuales en 'out_path' y construye index.dat en 'index_file' en una sola
+// pasada: mientras el hilo principal lee un bloque, otro hilo escribe los anteriores en el CSV
+// combinado y los demás los indexan con los offsets que tienen ahí. Cada byte se lee de disco
+// una sola vez. El resultado es idéntico a juntar con ./juntar e indexar después.
+// Devuelve 0 si todo salió bien y -1 en caso de error.
+int fuse_yearly_files(const char *const *paths, int path_count, const char *out_path, long thread_count,
+                      FILE *index_file, KeyList *key_list, long *total_rows_out) {
+    double start_time = now_seconds();
+    run_count = 0;
+
+    FusePipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.free_blocks.ready, NULL);
+    pthread_cond_init(&pipeline.parse_queue.ready, NULL);
+    pthread_cond_init(&pipeline.write_queue.ready, NULL);
+    pipeline.out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (pipeline.out_fd < 0) {
+        perror("Error creando el CSV combinado");
+        return -1;
+    }
+
+    // Reservamos el tamaño de los archivos de entrada; al final se ajusta al real
+    off_t expected_size = 0;
+    for (int i = 0; i < path_count; i++) {
+        struct stat st;
+        if (stat(paths[i], &st) == 0) expected_size += st.st_size + 1;
+    }
+    if (expected_size > 0) posix_fallocate(pipeline.out_fd, 0, expected_size);
+
+    // Una reserva fija de bloques limita la memoria y frena al lector si las otras etapas se atrasan
+    pipeline.block_count = thread_count + 4;
+    pipeline.blocks = calloc(pipeline.block_count, sizeof(FuseBlock));
+    BlockQueue *queues[] = {&pipeline.free_blocks, &pipeline.parse_queue, &pipeline.write_queue};
+    int result = pipeline.blocks ? 0 : -1;
+    for (int q = 0; q < 3 && result == 0; q++) {
+        queues[q]->capacity = pipeline.block_count;
+        queues[q]->items = malloc(sizeof(FuseBlock *) * pipeline.block_count);
+        if (!queues[q]->items) result = -1;
+    }
+    for (int b = 0; b < pipeline.block_count && result == 0; b++) {
+        pipeline.blocks[b].buffer = malloc(FUSE_BLOCK_SIZE + 1);
+        if (!pipeline.blocks[b].buffer) result = -1;
+        else queue_push(&pipeline.free_blocks, &pipeline.blocks[b]);
+    }
+
+    ChunkWorker workers[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    for (int t = 0; t < thread_count && result == 0; t++) {
+        memset(&workers[t], 0, sizeof(ChunkWorker));
+        workers[t].capacity = RUN_RECORDS / thread_count;
+        workers[t].column = COL_BIBNUMBER;
+        workers[t].pipeline = &pipeline;
+        workers[t].records = malloc(sizeof(SortRecord) * workers[t].capacity);
+        if (!workers[t].records) result = -1;
+    }
+    if (result < 0) {
+        perror("Error: Fallo al asignar memoria para juntar los archivos");
+        return -1;
+    }
+
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, write_blocks, &pipeline) != 0) {
+        perror("Error creando hilo");
+        return -1;
+    }
+    for (int t = 0; t < thread_count; t++) {
+        if (pthread_create(&threads[t], NULL, index_blocks, &workers[t]) != 0) {
+            perror("Error creando hilo");
+            return -1;
+        }
+    }
+
+    long csv_size = read_yearly_files(&pipeline, paths, path_count);
+
+    // Sin más bloques, las otras etapas terminan cuando vacían sus colas
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.parse_queue.closed = 1;
+    pipeline.write_queue.closed = 1;
+    pthread_cond_broadcast(&pipeline.parse_queue.ready);
+    pthread_cond_broadcast(&pipeline.write_queue.ready);
+    pthread_mutex_unlock(&pipeline.lock);
+
+    long total_rows = 0;
+    for (int t = 0; t < thread_count; t++) {
+        pthread_join(threads[t], NULL);
+        total_rows += workers[t].rows;
+    }
+    pthread_join(writer, NULL);
+    result = pipeline.error ? -1 : 0;
+    if (result == 0 && ftruncate(pipeline.out_fd, csv_size) < 0) {
+        perror("Error escribiendo el CSV combinado");
+        result = -1;
+    }
+    if (close(pipeline.out_fd) < 0) result = -1;
+
+    double read_time = now_seconds() - start_time;
+    if (result == 0) {
+        printf("Lectura y escritura: %ld filas, %.1f MB en %.2f s (%.0f filas/s)\n", total_rows,
+               csv_size / 1048576.0, read_time, read_time > 0 ? total_rows / read_time : 0.0);
+        if (run_count > 0) {
+            printf("Mezclando %d corridas ordenadas...\n", run_count);
+        }
+        result = merge_sources(workers, thread_count, NULL, index_file, key_list);
+    }
+
+    for (int t = 0; t < thread_count; t++) {
+        free(workers[t].records);
+    }
+    for (int b = 0; b < pipeline.block_count; b++) {
+        free(pipeline.blocks[b].buffer);
+    }
+    for (int q = 0; q < 3; q++) {
+        free(queues[q]->items);
+    }
+    free(pipeline.blocks);
+    if (result < 0) remove(out_path);
+    *total_rows_out = total_rows;
+    return result;
+}
+
+// Escribe "<archivo>.new" con el índice secundario de la columna de 'dict', cuyos valores ya
+// se juntaron. 'old', si no es NULL, es el índice anterior (mapeado) cuyas entradas se mezclan
+// con las filas desde 'data_begin'; sus valores tienen que ser los primeros del diccionario.
+// Devuelve 0 si todo salió bien y -1 en caso de error.
+int write_secondary_index(ValueDict *dict, const char *csv_data, size_t csv_size, size_t data_begin,
+                          long thread_count, const SecondaryHeader *old) {
+    char path[272];
+    snprintf(path, sizeof(path), "%s" UPDATE_SUFFIX, secondary_index_path(dict->column));
+
+    // La clave de cada valor es su posición en orden alfabético
+    long *order = malloc(sizeof(long) * (dict->count ? dict->count : 1));
+    if (!order) {
+        perror("Error: Fallo al asignar memoria para ordenar los valores");
+        return -1;
+    }
+    for (long i = 0; i < dict->count; i++) order[i] = i;
+    qsort_r(order, dict->count, sizeof(long), compare_values, dict);
+    for (long i = 0; i < dict->count; i++) dict->values[order[i]].code = i;
+
+    SecondaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SECONDARY_MAGIC, sizeof(header.magic));
+    header.column = dict->column;
+    header.value_count = dict->count;
+    header.entry_count = dict->rows;
+    header.strings_size = (dict->strings_size + 7) & ~7UL;
+
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        perror("Error creando índice secundario");
+        free(order);
+        return -1;
+    }
+    setvbuf(out, NULL, _IOFBF, MERGE_IO_BUFFER);
+
+    // Como ya sabemos cuántas filas tiene cada valor, los bloques se conocen antes de ordenar
+    fwrite(&header, sizeof(header), 1, out);
+    long start = 0, name_offset = 0;
+    for (long i = 0; i < dict->count; i++) {
+        const DictValue *value = &dict->values[order[i]];
+        ValueSlot slot = {start, value->rows, name_offset, value->name_len};
+        fwrite(&slot, sizeof(slot), 1, out);
+        start += value->rows;
+        name_offset += value->name_len;
+    }
+    for (long i = 0; i < dict->count; i++) {
+        const DictValue *value = &dict->values[order[i]];
+        fwrite(dict->strings + value->name_offset, 1, value->name_len, out);
+    }
+    static const char padding[8];
+    fwrite(padding, 1, header.strings_size - dict->strings_size, out);
+    free(order);
+
+    // Las claves del índice anterior se traducen a la posición que tiene ahora cada valor
+    BaseIndex base;
+    long *remap = NULL;
+    if (old) {
+        remap = malloc(sizeof(long) * (old->value_count ? old->value_count : 1));
+        if (!remap) {
+            perror("Error: Fallo al asignar memoria para las claves anteriores");
+            fclose(out);
+            remove(path);
+            return -1;
+        }
+        for (long i = 0; i < old->value_count; i++) remap[i] = dict->values[i].code;
+        const ValueSlot *old_values = (const ValueSlot *)(old + 1);
+        base.entries = (const SortRecord *)((const char *)(old_values + old->value_count) + old->strings_size);
+        base.count = old->entry_count;
+        base.remap = remap;
+    }
+
+    KeyList key_list;
+    memset(&key_list, 0, sizeof(key_list));
+    long rows = 0;
+    int result = ferror(out) ? -1 : 0;
+    if (result < 0) perror("Error escribiendo índice secundario");
+    if (result == 0) {
+        result = build_sorted_index(csv_data, csv_size, data_begin, thread_count, dict->column, dict,
+                                    old ? &base : NULL, out, &key_list, &rows);
+    }
+    free(remap);
+    // Las entradas tienen que coincidir con los bloques que ya se escribieron
+    if (result == 0 && (key_list.count != dict->count || key_list.entry_count != dict->rows)) {
+        fprintf(stderr, "Error: el CSV cambió mientras se construía el índice de %s\n", column_name(dict->column));
+        result = -1;
+    }
+    free(key_list.keys);
+    if (fclose(out) != 0 && result == 0) {
+        perror("Error escribiendo índice secundario");
+        result = -1;
+    }
+    if (result < 0) {
+        remove(path);
+        return -1;
+    }
+    printf("Índice de %s: %ld valores distintos\n", column_name(dict->column), dict->count);
+    return 0;
+}
+
+// Mapea el índice secundario 'path' de una columna si corresponde a un índice de
+// 'entry_count' entradas. Devuelve su cabecera (al inicio del mapeo) o NULL.
+const SecondaryHeader *map_secondary(const char *path, int column, long entry_count, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    const SecondaryHeader *header = NULL;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SecondaryHeader)) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            header = data;
+            *size = st.st_size;
+        }
+    }
+    close(fd);
+    if (header && (memcmp(header->magic, SECONDARY_MAGIC, sizeof(header->magic)) != 0 || header->column != column ||
+                   header->entry_count != entry_count ||
+                   *size != sizeof(*header) + header->value_count * sizeof(ValueSlot) + header->strings_size +
+                                header->entry_count * sizeof(IndexEntry))) {
+        munmap((void *)header, *size);
+        header = NULL;
+    }
+    return header;
+}
+
+// Construye los índices secundarios de ItemBarcode, ItemType, Collection y CallNumber.
+// 'expected_rows' son las filas de index.dat; todos los índices cubren las mismas filas.
+// En el modo de agregado ('append_begin' > 0 es la marca de agua anterior y 'old_rows' sus
+// filas) se indexan solo las filas nuevas y se mezclan con cada índice anterior; una columna
+// cuyo índice anterior falta o no corresponde se reconstruye completa.
+// Devuelve 0 si todo salió bien y -1 en caso de error.
+int build_secondary_indexes(const char *csv_data, size_t csv_size, size_t data_begin, size_t append_begin,
+                            long old_rows, long thread_count, long expected_rows) {
+    ValueDict dicts[SECONDARY_LAST_COLUMN + 1];
+    pthread_t threads[SECONDARY_LAST_COLUMN + 1];
+    const SecondaryHeader *old[SECONDARY_LAST_COLUMN + 1];
+    size_t old_size[SECONDARY_LAST_COLUMN + 1];
+    int result = 0;
+
+    // Primero un hilo por columna junta los valores distintos y cuántas filas tiene cada uno.
+    // Al agregar, el diccionario empieza con los valores del índice anterior, en su orden.
+    for (int column = SECONDARY_FIRST_COLUMN; column <= SECONDARY_LAST_COLUMN; column++) {
+        ValueDict *dict = &dicts[column];
+        memset(dict, 0, sizeof(*dict));
+        dict->column = column;
+        dict->csv_data = csv_data;
+        dict->begin = data_begin;
+        dict->end = csv_size;
+
+        old[column] = append_begin > 0 ? map_secondary(secondary_index_path(column), column, old_rows, &old_size[column]) : NULL;
+        if (append_begin > 0 && !old[column]) {
+            printf("El índice de %s no corresponde al anterior; se reconstruye completo\n", column_name(column));
+        }
+        if (old[column]) {
+            const ValueSlot *values = (const ValueSlot *)(old[column] + 1);
+            const char *strings = (const char *)(values + old[column]->value_count);
+            for (long i = 0; i < old[column]->value_count && result == 0; i++) {
+                if (dict_count_value(dict, strings + values[i].name_offset, values[i].name_len, values[i].count) < 0) {
+                    perror("Error: Fallo al asignar memoria para los valores de la columna");
+                    result = -1;
+                }
+            }
+            dict->rows = old_rows;
+            dict->begin = append_begin;
+        }
+    }
+    for (int column = SECONDARY_FIRST_COLUMN; column <= SECONDARY_LAST_COLUMN && result == 0; column++) {
+        if (pthread_create(&threads[column], NULL, collect_values, &dicts[column]) != 0) {
+            perror("Error creando hilo");
+            return -1;
+        }
+    }
+    for (int column = SECONDARY_FIRST_COLUMN; column <= SECONDARY_LAST_COLUMN && result == 0; column++) {
+        pthread_join(threads[column], NULL);
+    }
+    for (int column = SECONDARY_FIRST_COLUMN; column <= SECONDARY_LAST_COLUMN; column++) {
+        if (dicts[column].error || dicts[column].rows != expected_rows) result = -1;
+    }
+
+    // Después cada índice se ordena con todos los hilos, igual que index.dat
+    for (int column = SECONDARY_FIRST_COLUMN; column <= SECONDARY_LAST_COLUMN && result == 0; column++) {
+        result = write_secondary_index(&dicts[column], csv_data, csv_size, dicts[column].begin, thread_count,
+                                       old[column]);
+    }
+    for (int column = SECONDARY_FIRST_COLUMN; column <= SECONDARY_LAST_COLUMN; column++) {
+        free_dict(&dicts[column]);
+        if (old[column]) munmap((void *)old[column], old_size[column]);
+    }
+    return result;
+}
+
+// ---------------------- Agregados (aggregates.dat) ----------------------
+
+// 1 si 'a' va antes que 'b' en una lista de más prestados: más préstamos y, si empatan, la clave menor
+int top_before(const TopEntry *a, const TopEntry *b) {
+    if (a->rows != b->rows) return a->rows > b->rows;
+    return a->key < b->key;
+}
+
+int compare_top(const void *a, const void *b) {
+    return top_before(a, b) ? -1 : top_before(b, a) ? 1 : 0;
+}
+
+// Ofrece una clave a la lista de un período. La lista es un montículo cuya cima es la peor de
+// las AGG_TOP_STORED que se guardan, así que cada clave cuesta a lo sumo log(N).
+void top_offer(TopEntry *heap, long *size, const TopEntry *entry) {
+    long pos;
+    if (*size < AGG_TOP_STORED) {
+        // Sube desde el final mientras sea peor que su padre
+        pos = (*size)++;
+        while (pos > 0 && top_before(&heap[(pos - 1) / 2], entry)) {
+            heap[pos] = heap[(pos - 1) / 2];
+            pos = (pos - 1) / 2;
+        }
+        heap[pos] = *entry;
+        return;
+    }
+    if (!top_before(entry, &heap[0])) return;
+    // Reemplaza la cima y baja mientras algún hijo sea peor
+    pos = 0;
+    while (1) {
+        long worst = pos;
+        const TopEntry *worst_entry = entry;
+        for (long child = 2 * pos + 1; child <= 2 * pos + 2 && child < *size; child++) {
+            if (top_before(worst_entry, &heap[child])) {
+                worst = child;
+                worst_entry = &heap[child];
+            }
+        }
+        if (worst == pos) break;
+        heap[pos] = heap[worst];
+        pos = worst;
+    }
+    heap[pos] = *entry;
+}
+
+// Mapea un archivo ya escrito para leerlo de principio a fin. Devuelve NULL si no se pudo.
+const char *map_output(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    const char *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror(path);
+            data = NULL;
+        } else {
+            madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+            *size = st.st_size;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+// Escribe aggregates.dat a partir de index.dat ('index_path', ya ordenado por clave y fecha) y,
+// si 'with_rollups', de los índices secundarios de ItemType y Collection en 'rollup_paths'.
+// Se recorre cada archivo una sola vez de principio a fin, sin leer el CSV.
+// Devuelve 0 si todo salió bien y -1 en caso de error.
+int write_aggregates(const char *path, const char *index_path, long entry_count, const YearManifest *years,
+                     const char *const *rollup_paths) {
+    AggHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, AGG_MAGIC, sizeof(header.magic));
+    header.entry_count = entry_count;
+
+    // Los períodos van desde el primer hasta el último año del manifiesto con filas
+    for (long y = 0; y < YEARS_SPAN; y++) {
+        long rows = 0;
+        for (int m = 0; m < 12; m++) rows += years->month_rows[y][m];
+        if (rows == 0) continue;
+        if (header.first_year == 0) header.first_year = YEARS_FIRST + y;
+        header.last_year = YEARS_FIRST + y;
+    }
+    long year_count = header.first_year ? header.last_year - header.first_year + 1 : 0;
+    header.period_count = 1 + 13 * year_count;
+
+    size_t index_size = 0;
+    const IndexEntry *entries = entry_count > 0 ? (const IndexEntry *)map_output(index_path, &index_size) : NULL;
+    if (entry_count > 0 && (!entries || index_size != entry_count * sizeof(IndexEntry))) {
+        fprintf(stderr, "Error: no se pudo leer '%s' para los agregados\n", index_path);
+        return -1;
+    }
+
+    KeyList keys;
+    memset(&keys, 0, sizeof(keys));
+    MonthCount *series = NULL;
+    long series_capacity = 0;
+    TopEntry *heaps = malloc(sizeof(TopEntry) * AGG_TOP_STORED * header.period_count);
+    long *heap_sizes = calloc(header.period_count, sizeof(long));
+    int result = heaps && heap_sizes ? 0 : -1;
+
+    // Las entradas de cada clave están juntas y ordenadas por fecha, así que sus meses salen
+    // en orden y la serie se arma sumando en el último MonthCount
+    for (long i = 0; i < entry_count && result == 0;) {
+        long key = entries[i].key;
+        long key_start = header.series_count;
+        long total = 0;
+        for (; i < entry_count && entries[i].key == key; i++) {
+            total++;
+            long month = month_index(entries[i].checkout_time);
+            if (month < 0) continue;
+            if (header.series_count == key_start || series[header.series_count - 1].month != month) {
+                if (header.series_count == series_capacity) {
+                    series_capacity = series_capacity ? series_capacity * 2 : 1 << 16;
+                    MonthCount *grown = realloc(series, sizeof(MonthCount) * series_capacity);
+                    if (!grown) {
+                        result = -1;
+                        break;
+                    }
+                    series = grown;
+                }
+                series[header.series_count++] = (MonthCount){month, 0};
+            }
+            series[header.series_count - 1].rows++;
+        }
+        if (result < 0) break;
+
+        // La clave entra a la lista del dataset completo, de cada año y de cada mes que tiene
+        TopEntry candidate = {key, total, entries[i - 1].data_offset};
+        top_offer(heaps, &heap_sizes[0], &candidate);
+        long year_rows = 0;
+        for (long s = key_start; s < header.series_count; s++) {
+            long year = series[s].month / 12;
+            year_rows += series[s].rows;
+            long period = agg_period(&header, (int)year, (int)(series[s].month % 12) + 1);
+            if (period >= 0) {
+                candidate.rows = series[s].rows;
+                top_offer(heaps + period * AGG_TOP_STORED, &heap_sizes[period], &candidate);
+            }
+            if (s + 1 == header.series_count || series[s + 1].month / 12 != year) {
+                period = agg_period(&header, (int)year, 0);
+                if (period >= 0) {
+                    candidate.rows = year_rows;
+                    top_offer(heaps + period * AGG_TOP_STORED, &heap_sizes[period], &candidate);
+                }
+                year_rows = 0;
+            }
+        }
+
+        // La clave va a la tabla aunque no tenga meses (todas sus filas sin fecha)
+        if (keys.count == keys.capacity) {
+            keys.capacity = keys.capacity ? keys.capacity * 2 : 1 << 16;
+            KeySlot *grown = realloc(keys.keys, sizeof(KeySlot) * keys.capacity);
+            if (!grown) {
+                result = -1;
+                break;
+            }
+            keys.keys = grown;
+        }
+        keys.keys[keys.count++] = (KeySlot){key, key_start, header.series_count - key_start};
+    }
+    if (entries) munmap((void *)entries, index_size);
+    if (result < 0) perror("Error: Fallo al asignar memoria para los agregados");
+
+    KeySlot *table = result == 0 ? build_key_table(&keys, &header.table_size) : NULL;
+    if (!table) result = -1;
+    header.key_count = keys.count;
+    free(keys.keys);
+
+    // Cada lista queda de mayor a menor
+    AggPeriod *periods = calloc(header.period_count, sizeof(AggPeriod));
+    if (!periods) result = -1;
+    for (long p = 0; p < header.period_count && result == 0; p++) {
+        qsort(heaps + p * AGG_TOP_STORED, heap_sizes[p], sizeof(TopEntry), compare_top);
+        periods[p].start = header.top_count;
+        periods[p].count = heap_sizes[p];
+        header.top_count += heap_sizes[p];
+    }
+
+    // Rollups: el bloque de cada valor del índice secundario también está ordenado por fecha
+    const SecondaryHeader *secondary[AGG_ROLLUP_COLUMNS] = {NULL, NULL};
+    size_t secondary_size[AGG_ROLLUP_COLUMNS];
+    long *rollup_rows = NULL;
+    long row_width = year_count * 12;
+    long total_values = 0;
+    for (int g = 0; g < AGG_ROLLUP_COLUMNS && rollup_paths && result == 0; g++) {
+        secondary[g] = map_secondary(rollup_paths[g], rollup_column(g), entry_count, &secondary_size[g]);
+        if (!secondary[g]) {
+            fprintf(stderr, "Error: no se pudo leer '%s' para los agregados\n", rollup_paths[g]);
+            result = -1;
+            break;
+        }
+        header.rollup_values[g] = secondary[g]->value_count;
+        header.rollup_strings += secondary[g]->strings_size;
+        total_values += secondary[g]->value_count;
+    }
+    if (result == 0 && total_values > 0) {
+        rollup_rows = calloc(total_values * (row_width ? row_width : 1), sizeof(long));
+        if (!rollup_rows) {
+            perror("Error: Fallo al asignar memoria para los agregados");
+            result = -1;
+        }
+    }
+    long value_base = 0;
+    for (int g = 0; g < AGG_ROLLUP_COLUMNS && secondary[g] && result == 0; g++) {
+        const ValueSlot *values = (const ValueSlot *)(secondary[g] + 1);
+        const IndexEntry *value_entries =
+            (const IndexEntry *)((const char *)(values + secondary[g]->value_count) + secondary[g]->strings_size);
+        for (long v = 0; v < secondary[g]->value_count; v++) {
+            long *row = rollup_rows + (value_base + v) * row_width;
+            for (long e = values[v].start; e < values[v].start + values[v].count; e++) {
+                long month = month_index(value_entries[e].checkout_time);
+                long column = month - header.first_year * 12;
+                if (month >= 0 && column >= 0 && column < row_width) row[column]++;
+            }
+        }
+        value_base += secondary[g]->value_count;
+    }
+
+    FILE *out = result == 0 ? fopen(path, "wb") : NULL;
+    if (result == 0 && !out) {
+        perror("Error creando el archivo de agregados");
+        result = -1;
+    }
+    if (out) {
+        setvbuf(out, NULL, _IOFBF, MERGE_IO_BUFFER);
+        fwrite(&header, sizeof(header), 1, out);
+        fwrite(table, sizeof(KeySlot), header.table_size, out);
+        fwrite(series, sizeof(MonthCount), header.series_count, out);
+        fwrite(periods, sizeof(AggPeriod), header.period_count, out);
+        for (long p = 0; p < header.period_count; p++) {
+            fwrite(heaps + p * AGG_TOP_STORED, sizeof(TopEntry), heap_sizes[p], out);
+        }
+        // Valores de los rollups: start es su fila de conteos y el texto se copia tal cual
+        long name_base = 0;
+        value_base = 0;
+        for (int g = 0; g < AGG_ROLLUP_COLUMNS && secondary[g]; g++) {
+            const ValueSlot *values = (const ValueSlot *)(secondary[g] + 1);
+            for (long v = 0; v < secondary[g]->value_count; v++) {
+                ValueSlot slot = {value_base + v, values[v].count, name_base + values[v].name_offset, values[v].name_len};
+                fwrite(&slot, sizeof(slot), 1, out);
+            }
+            value_base += secondary[g]->value_count;
+            name_base += secondary[g]->strings_size;
+        }
+        for (int g = 0; g < AGG_ROLLUP_COLUMNS && secondary[g]; g++) {
+            const ValueSlot *values = (const ValueSlot *)(secondary[g] + 1);
+            fwrite(values + secondary[g]->value_count, 1, secondary[g]->strings_size, out);
+        }
+        if (rollup_rows) fwrite(rollup_rows, sizeof(long), total_values * row_width, out);
+        if (ferror(out)) result = -1;
+        if (fclose(out) != 0) result = -1;
+        if (result < 0) {
+            perror("Error escribiendo el archivo de agregados");
+            remove(path);
+        }
+    }
+
+    for (int g = 0; g < AGG_ROLLUP_COLUMNS; g++) {
+        if (secondary[g]) munmap((void *)secondary[g], secondary_size[g]);
+    }
+    free(rollup_rows);
+    free(periods);
+    free(table);
+    free(series);
+    free(heaps);
+    free(heap_sizes);
+    if (result == 0) {
+        printf("Agregados: %ld series mensuales, %ld períodos con los %d más prestados\n", header.series_count,
+               header.period_count, AGG_TOP_STORED);
+    }
+    return result;
+}
+
+// Lee la cabecera de un header.dat ya escrito. Devuelve 0 si es válida y -1 si no.
+int read_index_header(const char *path, IndexHeader *header) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return -1;
+    int ok = fread(header, sizeof(*header), 1, file) == 1 && memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) == 0;
+    fclose(file);
+    return ok ? 0 : -1;
+}
+
+// Escribe la cabecera y la tabla de claves. Devuelve 0 si todo salió bien y -1 si no.
+int write_index_header(const char *path, const IndexHeader *header, const KeySlot *key_table) {
+    FILE *header_file = fopen(path, "wb");
+    if (!header_file) {
+        perror("Error creando archivo de cabecera");
+        return -1;
+    }
+    if (fwrite(header, sizeof(*header), 1, header_file) != 1 ||
+        fwrite(key_table, sizeof(KeySlot), header->table_size, header_file) != (size_t)header->table_size) {
+        perror("Error escribiendo archivo de cabecera");
+        fclose(header_file);
+        return -1;
+    }
+    if (fclose(header_file) != 0) {
+        perror("Error escribiendo archivo de cabecera");
+        return -1;
+    }
+    return 0;
+}
+
+void print_usage(const char *program) {
+    fprintf(stderr, "Uso: %s [-t hilos] [-p tasa] [-S] [-a] [archivo.csv]\n", program);
+    fprintf(stderr, "     %s -j [-o salida.csv] [-t hilos] [-p tasa] [-S] [DataAAAA.csv ...]\n", program);
+    fprintf(stderr, "  -t hilos   número de hilos para leer el CSV (por defecto, uno por núcleo)\n");
+    fprintf(stderr, "  -p tasa    tasa de falsos positivos del filtro de Bloom, entre 0 y 1 (por defecto %g)\n",
+            BLOOM_DEFAULT_RATE);
+    fprintf(stderr, "  -S         no construir los índices secundarios (ItemBarcode, ItemType, Collection, CallNumber)\n");
+    fprintf(stderr, "  -a         agregar al índice solo las filas nuevas al final del CSV\n");
+    fprintf(stderr, "  -j         juntar los archivos anuales (por defecto Data%d.csv a Data%d.csv) e indexarlos\n"
+                    "             en la misma pasada\n", FIRST_YEAR, LAST_YEAR);
+    fprintf(stderr, "  -o salida  CSV combinado que genera -j (por defecto DataC.csv)\n");
+}
+
+// Mapea un CSV completo en memoria para leerlo en paralelo. Devuelve NULL si no se pudo.
+const char *map_csv(const char *path, size_t *size) {
+    int csv_fd = open(path, O_RDONLY);
+    if (csv_fd < 0) {
+        perror("Error abriendo archivo CSV");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(csv_fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: el archivo CSV '%s' está vacío o no se pudo leer\n", path);
+        close(csv_fd);
+        return NULL;
+    }
+    *size = st.st_size;
+    const char *csv_data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, csv_fd, 0);
+    close(csv_fd);
+    if (csv_data == MAP_FAILED) {
+        perror("Error al mapear el archivo CSV");
+        return NULL;
+    }
+    madvise((void *)csv_data, *size, MADV_SEQUENTIAL);
+    return csv_data;
+}
+
+int main(int argc, char **argv) {
 
     const char *csv_filepath = "DataC.csv"; // Archivo CSV de entrada
     const char *header_filepath = "header.dat"; // Archivo de cabecera de salida
     const char *index_filepath = "index.dat"; // Archivo de índice de salida
+    const char *bloom_filepath = "bloom.dat"; // Filtro de Bloom de las claves
+    const char *years_filepath = "years.dat"; // Filas por año y mes
+    const char *aggregates_filepath = "aggregates.dat"; // Conteos por clave y mes y listas de más prestados
+    double fp_rate = BLOOM_DEFAULT_RATE;
+    int build_secondary = 1;
+    int append = 0;
+    int fuse = 0;
 
-
-    // 1. Inicializar la tabla de cabecera en memoria
-    long header_table[HASH_TABLE_SIZE];
-    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-        header_table[i] = -1; // -1 significa que la lista está vacía
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "t:p:Sajo:h")) != -1) {
+        switch (opt) {
+        case 't':
+            thread_count = atol(optarg);
+            break;
+        case 'p':
+            fp_rate = atof(optarg);
+            if (fp_rate <= 0 || fp_rate >= 1) {
+                fprintf(stderr, "Error: la tasa de falsos positivos debe estar entre 0 y 1\n");
+                return 1;
+            }
+            break;
+        case 'S':
+            build_secondary = 0;
+            break;
+        case 'a':
+            append = 1;
+            break;
+        case 'j':
+            fuse = 1;
+            break;
+        case 'o':
+            csv_filepath = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (fuse && append) {
+        fprintf(stderr, "Error: -j genera el CSV completo y no se puede combinar con -a\n");
+        return 1;
+    }
+    if (optind < argc && !fuse) {
+        csv_filepath = argv[optind];
     }
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > MAX_THREADS) thread_count = MAX_THREADS;
 
-    FILE *csv_file = fopen(csv_filepath, "r");
-    if (!csv_file) {
-        perror("Error abriendo archivo CSV");
+    // Si una actualización anterior quedó confirmada pero a medias, se completa antes de empezar
+    if (finish_index_update() < 0) {
+        fprintf(stderr, "Error: no se pudo completar la actualización anterior del índice\n");
         return 1;
     }
 
-    // Usamos "wb" porque escribiremos datos binarios (structs)
-    FILE *index_file = fopen(index_filepath, "wb");
-    if (!index_file) {
-        perror("Error creando archivo de índice");
-        fclose(csv_file);
+    // 1. Las claves distintas se van anotando durante la mezcla; con ellas se arma header.dat
+    KeyList key_list;
+    memset(&key_list, 0, sizeof(key_list));
+    key_list.years = calloc(1, sizeof(YearManifest));
+    if (!key_list.years) {
+        perror("Error: Fallo al asignar memoria para el manifiesto de años");
         return 1;
     }
 
-    char line_buffer[MAX_LINE_LEN];
+    // Todos los archivos se escriben como .new y reemplazan a los anteriores al final, juntos
+    char new_path[272];
+    double start_time = now_seconds();
+    long total_rows = 0;
+    int result = 0;
+
+    // 2. Con -j, los archivos anuales se juntan en '<salida>.new' y index.dat se construye al
+    // mismo tiempo, así que no hace falta una segunda lectura del CSV combinado. El CSV nuevo
+    // se reemplaza junto con el índice.
+    char fused_path[272];
+    if (fuse) {
+        static char year_paths[LAST_YEAR - FIRST_YEAR + 1][20];
+        const char *paths[MAX_INPUT_FILES];
+        int path_count = 0;
+        for (int i = optind; i < argc && path_count < MAX_INPUT_FILES; i++) paths[path_count++] = argv[i];
+        for (int year = FIRST_YEAR; year <= LAST_YEAR && optind >= argc; year++) {
+            snprintf(year_paths[year - FIRST_YEAR], sizeof(year_paths[0]), "Data%d.csv", year);
+            paths[path_count++] = year_paths[year - FIRST_YEAR];
+        }
+
+        printf("Juntando %d archivos en '%s' e indexando con %ld hilos...\n", path_count, csv_filepath,
+               thread_count);
+        snprintf(fused_path, sizeof(fused_path), "%s" UPDATE_SUFFIX, csv_filepath);
+        snprintf(new_path, sizeof(new_path), "%s" UPDATE_SUFFIX, index_filepath);
+        FILE *index_file = fopen(new_path, "wb");
+        if (!index_file) {
+            perror("Error creando archivo de índice");
+            return 1;
+        }
+        setvbuf(index_file, NULL, _IOFBF, MERGE_IO_BUFFER);
+        result = fuse_yearly_files(paths, path_count, fused_path, thread_count, index_file, &key_list, &total_rows);
+        if (fclose(index_file) != 0) result = -1;
+        if (result < 0) {
+            remove(new_path);
+            fprintf(stderr, "Error: la construcción del índice no terminó\n");
+            return 1;
+        }
+    }
+
+    // Mapear el CSV completo; los hilos leen sus trozos directamente de la memoria. Con -j es
+    // el recién escrito, que sigue en la caché de páginas, para la cabecera y los índices secundarios.
+    size_t csv_size = 0;
+    const char *csv_data = map_csv(fuse ? fused_path : csv_filepath, &csv_size);
+    if (!csv_data) return 1;
+
     // Omitir la primera línea si es una cabecera
-    fgets(line_buffer, MAX_LINE_LEN, csv_file);
-
-    printf("Construyendo índice...\n");
-
-    // 2. Recorrer el archivo CSV línea por línea
-    long current_data_offset = ftell(csv_file);
-    while (fgets(line_buffer, MAX_LINE_LEN, csv_file) != NULL) {
-        
-        // Copiamos la línea para no modificarla con strtok
-        char line_copy[MAX_LINE_LEN];
-        strcpy(line_copy, line_buffer);
-        
-        // Extraer el ID (primera columna)
-        char *record_id = strtok(line_copy, ",");
-        if (record_id == NULL) {
-            current_data_offset = ftell(csv_file);
-            continue; // Línea vacía o mal formada
+    const char *first_newline = memchr(csv_data, '\n', csv_size);
+    size_t data_begin = first_newline ? (size_t)(first_newline - csv_data) + 1 : csv_size;
+
+    // 3. En el modo de agregado solo se leen los bytes después de la marca de agua, y el
+    // índice anterior (ya ordenado) entra a la mezcla como una fuente más
+    size_t index_begin = data_begin;
+    long old_rows = 0;
+    BaseIndex base;
+    const char *old_index = NULL;
+    size_t old_index_size = 0;
+    if (append) {
+        IndexHeader old_header;
+        if (read_index_header(header_filepath, &old_header) < 0) {
+            fprintf(stderr, "Error: no hay un índice anterior válido; ejecute ./constructor sin -a\n");
+            return 1;
+        }
+        // El CSV tiene que ser el mismo que se indexó, con filas agregadas solo al final
+        if (old_header.csv_size < (long)data_begin || old_header.csv_size > (long)csv_size ||
+            csv_data[old_header.csv_size - 1] != '\n' ||
+            tail_hash(csv_data, old_header.csv_size) != old_header.csv_tail_hash) {
+            fprintf(stderr, "Error: '%s' no es el CSV indexado con filas agregadas al final; ejecute ./constructor sin -a\n",
+                    csv_filepath);
+            return 1;
         }
+        if (old_header.csv_size == (long)csv_size) {
+            printf("No hay filas nuevas desde la última indexación (%ld filas).\n", old_header.entry_count);
+            return 0;
+        }
+        int index_fd = open(index_filepath, O_RDONLY);
+        struct stat index_st;
+        if (index_fd < 0 || fstat(index_fd, &index_st) < 0 ||
+            index_st.st_size != (off_t)(old_header.entry_count * sizeof(IndexEntry))) {
+            fprintf(stderr, "Error: '%s' no corresponde a '%s'; ejecute ./constructor sin -a\n", index_filepath,
+                    header_filepath);
+            return 1;
+        }
+        old_index_size = index_st.st_size;
+        old_index = old_index_size ? mmap(NULL, old_index_size, PROT_READ, MAP_PRIVATE, index_fd, 0) : NULL;
+        close(index_fd);
+        if (old_index == MAP_FAILED) {
+            perror("Error al mapear el índice anterior");
+            return 1;
+        }
+        base.entries = (const SortRecord *)old_index;
+        base.count = old_header.entry_count;
+        base.remap = NULL;
+        index_begin = old_header.csv_size;
+        old_rows = old_header.entry_count;
+        printf("Agregando las filas desde el byte %ld (%ld filas ya indexadas)\n", old_header.csv_size, old_rows);
+    }
+
+    // 4. Leer el CSV en paralelo y mezclar las corridas para escribir index.dat ya ordenado
+    if (!fuse) {
+        printf("Construyendo índice con %ld hilos...\n", thread_count);
+        start_time = now_seconds();
+        snprintf(new_path, sizeof(new_path), "%s" UPDATE_SUFFIX, index_filepath);
+        // Usamos "wb" porque escribiremos datos binarios (structs)
+        FILE *index_file = fopen(new_path, "wb");
+        if (!index_file) {
+            perror("Error creando archivo de índice");
+            return 1;
+        }
+        setvbuf(index_file, NULL, _IOFBF, MERGE_IO_BUFFER);
+
+        result = build_sorted_index(csv_data, csv_size, index_begin, thread_count, COL_BIBNUMBER, NULL,
+                                    append ? &base : NULL, index_file, &key_list, &total_rows);
+        if (fclose(index_file) != 0) result = -1;
+        if (old_index) munmap((void *)old_index, old_index_size);
+
+        if (result < 0) {
+            fprintf(stderr, "Error: la construcción del índice no terminó\n");
+            return 1;
+        }
+    }
 
-        // 3. Calcular el índice hash
-        unsigned int hash_index = hash_function(record_id) % HASH_TABLE_SIZE;
+    double total_time = now_seconds() - start_time;
+    printf("Proceso de indexación completado: %ld filas en %.2f s (%.0f filas/s)\n", total_rows, total_time,
+           total_time > 0 ? total_rows / total_time : 0.0);
 
-        // 4. Crear el nuevo nodo de índice
-        IndexNode new_node;
-        new_node.data_offset = current_data_offset;
-        // El nuevo nodo apuntará a la "cabeza" anterior de la lista
-        new_node.next_node_offset = header_table[hash_index]; 
-        
-        // 5. Escribir el nuevo nodo al final del archivo de índice
-        fseek(index_file, 0, SEEK_END); // Nos aseguramos de escribir al final del archivo
-        long new_node_offset = ftell(index_file); //ftell nos da la posición actual en el archivo
-        fwrite(&new_node, sizeof(IndexNode), 1, index_file);
+    // 5. Repartir las claves en la tabla, dimensionada según cuántas claves distintas hay
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    KeySlot *key_table = build_key_table(&key_list, &header.table_size);
+    if (!key_table) return 1;
+    header.key_count = key_list.count;
+    header.entry_count = key_list.entry_count;
+    header.csv_size = csv_size;
+    header.csv_tail_hash = tail_hash(csv_data, csv_size);
+    printf("%ld claves distintas en una tabla de %ld posiciones (%ld filas en total)\n", header.key_count,
+           header.table_size, header.entry_count);
 
-        // 6. Actualizar la tabla de cabecera para que apunte a este nuevo nodo
-        header_table[hash_index] = new_node_offset;
+    // 6. Guardar la cabecera y la tabla de claves en su propio archivo
+    snprintf(new_path, sizeof(new_path), "%s" UPDATE_SUFFIX, header_filepath);
+    if (write_index_header(new_path, &header, key_table) < 0) return 1;
+    free(key_table);
 
-        // Guardar la posición para la siguiente línea
-        current_data_offset = ftell(csv_file);
+    // 7. El filtro de Bloom permite descartar IDs inexistentes sin leer el índice
+    snprintf(new_path, sizeof(new_path), "%s" UPDATE_SUFFIX, bloom_filepath);
+    if (write_bloom_filter(new_path, &key_list, fp_rate) < 0) return 1;
+    free(key_list.keys);
+
+    // El manifiesto dice qué años y meses tienen filas, para descartar filtros sin resultados
+    snprintf(new_path, sizeof(new_path), "%s" UPDATE_SUFFIX, years_filepath);
+    if (write_year_manifest(new_path, key_list.years, header.entry_count) < 0) return 1;
+
+    // 8. Índices secundarios para consultar por las otras columnas
+    const char *outputs[6 + SECONDARY_LAST_COLUMN] = {header_filepath, index_filepath, bloom_filepath,
+                                                      years_filepath, aggregates_filepath};
+    int output_count = 5;
+    if (fuse) outputs[output_count++] = csv_filepath;
+    if (build_secondary) {
+        double secondary_start = now_seconds();
+        if (build_secondary_indexes(csv_data, csv_size, data_begin, append ? index_begin : 0, old_rows, thread_count,
+                                    header.entry_count) < 0) {
+            fprintf(stderr, "Error: la construcción de los índices secundarios no terminó\n");
+            return 1;
+        }
+        printf("Índices secundarios creados en %.2f s\n", now_seconds() - secondary_start);
+        for (int column = SECONDARY_FIRST_COLUMN; column <= SECONDARY_LAST_COLUMN; column++) {
+            outputs[output_count++] = secondary_index_path(column);
+        }
     }
-    
-    printf("Proceso de indexación completado.\n");
-    fclose(csv_file);
-    fclose(index_file);
+    munmap((void *)csv_data, csv_size);
 
-    // 7. Guardar la tabla de cabecera en su propio archivo
-    FILE *header_file = fopen(header_filepath, "wb");
-    if (!header_file) {
-        perror("Error creando archivo de cabecera");
+    // 9. Conteos ya calculados para las series por mes y las listas de más prestados. Se leen
+    // de los índices recién escritos, que ya están ordenados por clave (o valor) y fecha.
+    char index_new_path[272];
+    char rollup_new_paths[AGG_ROLLUP_COLUMNS][272];
+    const char *rollup_paths[AGG_ROLLUP_COLUMNS];
+    snprintf(index_new_path, sizeof(index_new_path), "%s" UPDATE_SUFFIX, index_filepath);
+    for (int g = 0; g < AGG_ROLLUP_COLUMNS; g++) {
+        snprintf(rollup_new_paths[g], sizeof(rollup_new_paths[g]), "%s" UPDATE_SUFFIX,
+                 secondary_index_path(rollup_column(g)));
+        rollup_paths[g] = rollup_new_paths[g];
+    }
+    snprintf(new_path, sizeof(new_path), "%s" UPDATE_SUFFIX, aggregates_filepath);
+    if (write_aggregates(new_path, index_new_path, header.entry_count, key_list.years,
+                         build_secondary ? rollup_paths : NULL) < 0) {
+        fprintf(stderr, "Error: la construcción de los agregados no terminó\n");
         return 1;
     }
-    fwrite(header_table, sizeof(long), HASH_TABLE_SIZE, header_file);
-    fclose(header_file);
+    free(key_list.years);
 
-    printf("Archivos de índice '%s' y '%s' creados exitosamente.\n", header_filepath, index_filepath);
+    // 10. Reemplazar los archivos anteriores de una sola vez
+    if (commit_index_files(outputs, output_count) < 0) {
+        fprintf(stderr, "Error: no se pudo reemplazar el índice; el anterior sigue en uso\n");
+        return 1;
+    }
+    printf("Archivos de índice '%s', '%s' y '%s' creados exitosamente.\n", header_filepath, index_filepath,
+           bloom_filepath);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,330 @@
+#define _GNU_SOURCE // memrchr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "indexer.h"
+#include "records.h"
+
+// Convierte DataC.csv en el almacén binario records.dat (ver records.h).
+// El backend arma las filas desde las columnas y solo vuelve al CSV para las filas
+// marcadas con RECORD_FLAG_RAW, así que las consultas ya no parsean texto.
+
+#define DICT_SLOTS 131072 // Potencia de 2 mayor que RECORD_DICT_MAX
+
+// Diccionario de cadenas cortas (ItemType, Collection) con direccionamiento abierto
+typedef struct {
+    char (*names)[RECORD_DICT_LEN];
+    long count;
+    int slots[DICT_SLOTS]; // Código + 1 de la cadena en cada posición, 0 si está libre
+} Dictionary;
+
+// Columnas del almacén mientras se construyen
+typedef struct {
+    long *csv_offset;
+    uint32_t *checkout_time;
+    uint64_t *item_barcode;
+    uint32_t *bib_number;
+    uint32_t *call_start;
+    uint16_t *item_type;
+    uint16_t *collection;
+    uint8_t *barcode_digits;
+    uint8_t *flags;
+    char *heap;
+    size_t heap_size;
+    size_t heap_capacity;
+} Columns;
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Devuelve el código de la cadena, agregándola si es nueva, o -1 si no cabe en el diccionario
+long dict_code(Dictionary *dict, const char *text, size_t len) {
+    if (len >= RECORD_DICT_LEN) return -1;
+
+    unsigned long hash = 5381;
+    for (size_t i = 0; i < len; i++) hash = hash * 33 + (unsigned char)text[i];
+
+    for (unsigned long slot = hash & (DICT_SLOTS - 1);; slot = (slot + 1) & (DICT_SLOTS - 1)) {
+        int code = dict->slots[slot] - 1;
+        if (code < 0) break;
+        if (strncmp(dict->names[code], text, len) == 0 && dict->names[code][len] == '\0') return code;
+    }
+
+    if (dict->count >= RECORD_DICT_MAX) return -1;
+    long code = dict->count++;
+    memset(dict->names[code], 0, RECORD_DICT_LEN);
+    memcpy(dict->names[code], text, len);
+
+    unsigned long slot = hash & (DICT_SLOTS - 1);
+    while (dict->slots[slot] != 0) slot = (slot + 1) & (DICT_SLOTS - 1);
+    dict->slots[slot] = (int)code + 1;
+    return code;
+}
+
+// Agrega el CallNumber al montón de cadenas. Devuelve 0 si todo salió bien y -1 si no hay memoria.
+int heap_append(Columns *columns, const char *text, size_t len) {
+    if (columns->heap_size + len > columns->heap_capacity) {
+        size_t capacity = columns->heap_capacity ? columns->heap_capacity : 1 << 20;
+        while (capacity < columns->heap_size + len) capacity *= 2;
+        char *grown = realloc(columns->heap, capacity);
+        if (!grown) return -1;
+        columns->heap = grown;
+        columns->heap_capacity = capacity;
+    }
+    memcpy(columns->heap + columns->heap_size, text, len);
+    columns->heap_size += len;
+    return 0;
+}
+
+// ItemBarcode a entero. Devuelve el número de dígitos (0 si está vacío) o -1 si no es un número.
+int parse_barcode(const char *text, size_t len, uint64_t *value) {
+    *value = 0;
+    if (len > 19) return -1; // No cabría en 64 bits
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] < '0' || text[i] > '9') return -1;
+        *value = *value * 10 + (text[i] - '0');
+    }
+    return (int)len;
+}
+
+// Convierte una fila del CSV en el registro 'record'. Si algún campo no tiene la forma
+// esperada, o la fila reconstruida no es idéntica a la original, se marca como RECORD_FLAG_RAW.
+// Devuelve 0 si todo salió bien y -1 si no hay memoria.
+int convert_row(Columns *columns, Dictionary *types, Dictionary *collections, long record,
+                const char *line, size_t line_len) {
+    const char *end = line + line_len;
+    const char *fields[4];
+    size_t lengths[4];
+    int raw = 0;
+
+    // Los cuatro primeros campos no llevan comas ni comillas
+    const char *cursor = line;
+    for (int f = 0; f < 4; f++) {
+        const char *comma = memchr(cursor, ',', end - cursor);
+        if (!comma) {
+            comma = end;
+            raw = 1;
+        }
+        fields[f] = cursor;
+        lengths[f] = comma - cursor;
+        if (memchr(cursor, '"', lengths[f])) raw = 1;
+        cursor = comma < end ? comma + 1 : end;
+    }
+
+    // La fecha es el último campo; lo que queda en medio es el CallNumber, tal como está
+    const char *last_comma = cursor < end ? memrchr(cursor, ',', end - cursor) : NULL;
+    if (!last_comma) {
+        last_comma = end;
+        raw = 1;
+    }
+    const char *call_number = cursor;
+    size_t call_len = last_comma - cursor;
+    char date[64] = "";
+    size_t date_len = last_comma < end ? (size_t)(end - last_comma - 1) : 0;
+    if (date_len < sizeof(date)) memcpy(date, last_comma + 1, date_len);
+
+    long bib = parse_bib_number(fields[0], lengths[0]);
+    uint64_t barcode;
+    int digits = parse_barcode(fields[1], lengths[1], &barcode);
+    long type_code = dict_code(types, fields[2], lengths[2]);
+    long collection_code = dict_code(collections, fields[3], lengths[3]);
+    long checkout_time = parse_checkout_datetime(date);
+    if (bib < 0 || digits < 0 || type_code < 0 || collection_code < 0 || checkout_time < 0 || checkout_time > UINT32_MAX) raw = 1;
+
+    columns->checkout_time[record] = checkout_time < 0 ? 0 : (uint32_t)checkout_time;
+    columns->bib_number[record] = bib < 0 ? 0 : (uint32_t)bib;
+    columns->item_barcode[record] = digits < 0 ? 0 : barcode;
+    columns->barcode_digits[record] = digits < 0 ? 0 : (uint8_t)digits;
+    columns->item_type[record] = type_code < 0 ? 0 : (uint16_t)type_code;
+    columns->collection[record] = collection_code < 0 ? 0 : (uint16_t)collection_code;
+    columns->call_start[record] = (uint32_t)columns->heap_size;
+
+    if (!raw) {
+        // Comprobamos que la fila se reconstruye exactamente; si no, se leerá del CSV
+        char rebuilt[RECORD_MAX_LINE];
+        size_t rebuilt_len = format_record_fields(rebuilt, sizeof(rebuilt), (uint32_t)bib, barcode, digits,
+                                                  types->names[type_code], collections->names[collection_code],
+                                                  call_number, call_len, checkout_time);
+        if (rebuilt_len != line_len || memcmp(rebuilt, line, line_len) != 0) raw = 1;
+    }
+
+    columns->flags[record] = raw ? RECORD_FLAG_RAW : 0;
+    if (raw) return 0; // Sin CallNumber en el montón: la fila se sirve desde el CSV
+    return heap_append(columns, call_number, call_len);
+}
+
+void print_usage(const char *program) {
+    fprintf(stderr, "Uso: %s [archivo.csv] [records.dat]\n", program);
+}
+
+int main(int argc, char **argv) {
+
+    const char *csv_filepath = "DataC.csv"; // Archivo CSV de entrada
+    const char *records_filepath = "records.dat"; // Almacén binario de salida
+
+    if (argc > 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (argc > 1) csv_filepath = argv[1];
+    if (argc > 2) records_filepath = argv[2];
+
+    // 1. Mapear el CSV completo
+    int csv_fd = open(csv_filepath, O_RDONLY);
+    if (csv_fd < 0) {
+        perror("Error abriendo archivo CSV");
+        return 1;
+    }
+    struct stat st;
+    if (fstat(csv_fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: el archivo CSV '%s' está vacío o no se pudo leer\n", csv_filepath);
+        close(csv_fd);
+        return 1;
+    }
+    size_t csv_size = st.st_size;
+    const char *csv_data = mmap(NULL, csv_size, PROT_READ, MAP_PRIVATE, csv_fd, 0);
+    close(csv_fd);
+    if (csv_data == MAP_FAILED) {
+        perror("Error al mapear el archivo CSV");
+        return 1;
+    }
+    madvise((void *)csv_data, csv_size, MADV_SEQUENTIAL);
+
+    // Omitir la primera línea si es una cabecera (igual que el constructor)
+    const char *first_newline = memchr(csv_data, '\n', csv_size);
+    size_t data_begin = first_newline ? (size_t)(first_newline - csv_data) + 1 : csv_size;
+
+    printf("Convirtiendo '%s' a '%s'...\n", csv_filepath, records_filepath);
+    double start_time = now_seconds();
+
+    // 2. Contar las filas para reservar cada columna de una vez
+    long record_count = 0;
+    for (const char *p = csv_data + data_begin; p < csv_data + csv_size;) {
+        const char *newline = memchr(p, '\n', csv_data + csv_size - p);
+        if (!newline) newline = csv_data + csv_size;
+        if (newline > p) record_count++;
+        p = newline + 1;
+    }
+
+    Columns columns;
+    memset(&columns, 0, sizeof(columns));
+    columns.csv_offset = malloc(sizeof(long) * (record_count + 1));
+    columns.checkout_time = malloc(sizeof(uint32_t) * (record_count + 1));
+    columns.item_barcode = malloc(sizeof(uint64_t) * (record_count + 1));
+    columns.bib_number = malloc(sizeof(uint32_t) * (record_count + 1));
+    columns.call_start = malloc(sizeof(uint32_t) * (record_count + 1));
+    columns.item_type = malloc(sizeof(uint16_t) * (record_count + 1));
+    columns.collection = malloc(sizeof(uint16_t) * (record_count + 1));
+    columns.barcode_digits = malloc(record_count + 1);
+    columns.flags = malloc(record_count + 1);
+    Dictionary *types = calloc(1, sizeof(Dictionary));
+    Dictionary *collections = calloc(1, sizeof(Dictionary));
+    if (types) types->names = malloc(RECORD_DICT_LEN * (size_t)RECORD_DICT_MAX);
+    if (collections) collections->names = malloc(RECORD_DICT_LEN * (size_t)RECORD_DICT_MAX);
+    if (!columns.csv_offset || !columns.checkout_time || !columns.item_barcode || !columns.bib_number ||
+        !columns.call_start || !columns.item_type || !columns.collection || !columns.barcode_digits ||
+        !columns.flags || !types || !collections || !types->names || !collections->names) {
+        perror("Error: Fallo al asignar memoria para las columnas");
+        return 1;
+    }
+
+    // 3. Convertir cada fila
+    long record = 0;
+    long raw_rows = 0;
+    for (const char *p = csv_data + data_begin; p < csv_data + csv_size;) {
+        const char *newline = memchr(p, '\n', csv_data + csv_size - p);
+        if (!newline) newline = csv_data + csv_size;
+        if (newline > p) {
+            if (convert_row(&columns, types, collections, record, p, newline - p) < 0) {
+                perror("Error: Fallo al asignar memoria para el montón de cadenas");
+                return 1;
+            }
+            columns.csv_offset[record] = p - csv_data;
+            if (columns.flags[record] & RECORD_FLAG_RAW) raw_rows++;
+            record++;
+        }
+        p = newline + 1;
+    }
+    if (columns.heap_size > UINT32_MAX) {
+        fprintf(stderr, "Error: los CallNumber ocupan más de 4 GB y no caben en el almacén\n");
+        return 1;
+    }
+    columns.call_start[record_count] = (uint32_t)columns.heap_size;
+    munmap((void *)csv_data, csv_size);
+
+    // 4. Escribir records.dat: cabecera y cada sección en la posición que indica records_layout
+    RecordStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORDS_MAGIC, sizeof(header.magic));
+    header.record_count = record_count;
+    header.csv_size = csv_size;
+    header.item_type_count = types->count;
+    header.collection_count = collections->count;
+    header.heap_size = columns.heap_size;
+    records_layout(&header);
+
+    // Se escribe aparte y se renombra al final: un backend en marcha tiene mapeado el
+    // records.dat actual, y truncarlo en el lugar haría fallar sus lecturas con SIGBUS
+    char new_path[272];
+    snprintf(new_path, sizeof(new_path), "%s" UPDATE_SUFFIX, records_filepath);
+    FILE *records_file = fopen(new_path, "wb");
+    if (!records_file) {
+        perror("Error creando el almacén de registros");
+        return 1;
+    }
+    // Las secciones van en el mismo orden que en records_layout
+    struct {
+        long pos;
+        const void *data;
+        size_t size;
+    } sections[] = {
+        {0, &header, sizeof(header)},
+        {header.csv_offset_pos, columns.csv_offset, sizeof(long) * record_count},
+        {header.item_barcode_pos, columns.item_barcode, sizeof(uint64_t) * record_count},
+        {header.checkout_time_pos, columns.checkout_time, sizeof(uint32_t) * record_count},
+        {header.bib_number_pos, columns.bib_number, sizeof(uint32_t) * record_count},
+        {header.call_start_pos, columns.call_start, sizeof(uint32_t) * (record_count + 1)},
+        {header.item_type_pos, columns.item_type, sizeof(uint16_t) * record_count},
+        {header.collection_pos, columns.collection, sizeof(uint16_t) * record_count},
+        {header.barcode_digits_pos, columns.barcode_digits, record_count},
+        {header.flags_pos, columns.flags, record_count},
+        {header.item_type_dict_pos, types->names, RECORD_DICT_LEN * types->count},
+        {header.collection_dict_pos, collections->names, RECORD_DICT_LEN * collections->count},
+        {header.heap_pos, columns.heap, columns.heap_size},
+    };
+    int result = 0;
+    long written = 0;
+    static const char padding[8];
+    for (size_t i = 0; i < sizeof(sections) / sizeof(sections[0]) && result == 0; i++) {
+        // Relleno de alineación entre secciones
+        if (sections[i].pos > written && fwrite(padding, 1, sections[i].pos - written, records_file) != (size_t)(sections[i].pos - written)) result = -1;
+        if (sections[i].size > 0 && fwrite(sections[i].data, 1, sections[i].size, records_file) != sections[i].size) result = -1;
+        written = sections[i].pos + sections[i].size;
+    }
+    if (fclose(records_file) != 0) result = -1;
+    if (result < 0) {
+        perror("Error escribiendo el almacén de registros");
+        unlink(new_path);
+        return 1;
+    }
+    if (commit_index_files(&records_filepath, 1) < 0) {
+        fprintf(stderr, "Error: no se pudo reemplazar '%s'; el anterior sigue en uso\n", records_filepath);
+        return 1;
+    }
+
+    double total_time = now_seconds() - start_time;
+    printf("Conversión completada: %ld filas en %.2f s (%.0f filas/s)\n", record_count, total_time,
+           total_time > 0 ? record_count / total_time : 0.0);
+    printf("%ld tipos de ítem, %ld colecciones, %ld filas se seguirán leyendo del CSV\n",
+           types->count, collections->count, raw_rows);
+    printf("Tamaño: %zu bytes de CSV -> %ld bytes en '%s'\n", csv_size, written, records_filepath);
+    return 0;
+}
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE // memrchr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "indexer.h"
+#include "csvscan.h"
+
+// Microbenchmark del recorrido del CSV. Lee el archivo completo a memoria y lo recorre varias
+// veces de dos formas, sacando de cada fila lo mismo que necesita el constructor (el largo del
+// ID, la fecha y el CallNumber):
+//  - memchr: como se hacía antes, un memchr por salto de línea y por cada una de las cuatro
+//    primeras comas, y un memrchr para la coma de la fecha;
+//  - csvscan: las máscaras de 64 bytes de csvscan.h, con cada variante que tenga el
+//    procesador (escalar, sse2, avx2).
+// Para cada una imprime la mejor vuelta en MB/s y filas/s (y cuántas filas tienen comillas,
+// que son las que pasan por el prefijo XOR), y comprueba que todas encuentren exactamente los
+// mismos campos.
+
+#define DEFAULT_REPEAT 5
+
+// Resumen de lo encontrado en una vuelta, para comparar las formas entre sí
+typedef struct
+{
+    long rows;
+    uint64_t checksum;
+} ScanResult;
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Suma a 'result' la posición y el largo de los campos de una fila
+void account_row(ScanResult *result, size_t line_offset, size_t id_len, size_t call_start, size_t call_len,
+                 size_t date_start)
+{
+    result->rows++;
+    result->checksum = result->checksum * 31 + line_offset;
+    result->checksum = result->checksum * 31 + id_len;
+    result->checksum = result->checksum * 31 + call_start;
+    result->checksum = result->checksum * 31 + call_len;
+    result->checksum = result->checksum * 31 + date_start;
+}
+
+ScanResult scan_memchr(const char *data, size_t size)
+{
+    ScanResult result = {0, 0};
+    size_t pos = 0;
+    while (pos < size)
+    {
+        const char *line = data + pos;
+        const char *newline = memchr(line, '\n', size - pos);
+        size_t line_len = newline ? (size_t)(newline - line) : size - pos;
+        const char *end = line + line_len;
+
+        // Las cuatro primeras columnas, una coma a la vez
+        const char *cursor = line;
+        size_t id_len = line_len;
+        for (int f = 0; f < COL_CALLNUMBER; f++)
+        {
+            const char *comma = memchr(cursor, ',', end - cursor);
+            if (f == 0 && comma)
+                id_len = comma - line;
+            cursor = comma ? comma + 1 : end;
+        }
+        // La fecha desde el final
+        const char *last_comma = cursor < end ? memrchr(cursor, ',', end - cursor) : NULL;
+        size_t call_start = cursor - line;
+        size_t call_len = last_comma ? (size_t)(last_comma - cursor) : 0;
+        size_t date_start = last_comma ? (size_t)(last_comma + 1 - line) : line_len;
+        account_row(&result, pos, id_len, call_start, call_len, date_start);
+        pos += line_len + 1;
+    }
+    return result;
+}
+
+ScanResult scan_csvscan(const char *data, size_t size)
+{
+    ScanResult result = {0, 0};
+    CsvScanner scanner;
+    CsvRow row;
+    FieldView fields[CSV_COLUMNS];
+    csv_scan_init(&scanner, data, size);
+    while (csv_scan_row(&scanner, &row))
+    {
+        int found = csv_row_fields(&row, fields, CSV_COLUMNS);
+        size_t id_len = fields[COL_BIBNUMBER].len;
+        size_t call_start = found > COL_CALLNUMBER ? (size_t)(fields[COL_CALLNUMBER].start - row.line) : row.len;
+        size_t call_len = found == CSV_COLUMNS ? fields[COL_CALLNUMBER].len : 0;
+        size_t date_start = found == CSV_COLUMNS ? (size_t)(fields[COL_CHECKOUTDATETIME].start - row.line) : row.len;
+        account_row(&result, row.line - data, id_len, call_start, call_len, date_start);
+    }
+    return result;
+}
+
+// Una forma de recorrer el CSV; 'kernel' es la variante de csvscan.h (NULL para memchr)
+typedef struct
+{
+    char name[32];
+    ScanResult (*scan)(const char *, size_t);
+    CsvMaskFn kernel;
+    double best;
+    ScanResult result;
+} Variant;
+
+// Corre todas las variantes 'repeat' veces, alternándolas en cada vuelta para que todas vean
+// las mismas condiciones de la máquina, y guarda la mejor vuelta de cada una
+void run_variants(Variant *variants, int count, const char *data, size_t size, int repeat)
+{
+    for (int i = 0; i < repeat; i++)
+    {
+        for (int v = 0; v < count; v++)
+        {
+            if (variants[v].kernel)
+                csv_scan_kernel = variants[v].kernel;
+            double start = now_seconds();
+            variants[v].result = variants[v].scan(data, size);
+            double elapsed = now_seconds() - start;
+            if (i == 0 || elapsed < variants[v].best)
+                variants[v].best = elapsed;
+        }
+    }
+}
+
+void print_result(const char *name, double seconds, size_t size, const ScanResult *result, double baseline)
+{
+    printf("%-16s %8.1f MB/s %12.0f filas/s %7.3f s  x%.2f\n", name, size / seconds / 1e6, result->rows / seconds,
+           seconds, baseline / seconds);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "DataC.csv";
+    int repeat = argc > 2 ? atoi(argv[2]) : DEFAULT_REPEAT;
+    if (repeat < 1)
+        repeat = 1;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+    size_t size = st.st_size;
+    char *data = malloc(size > 0 ? size : 1);
+    if (data == NULL)
+    {
+        perror("Error: Fallo al asignar memoria para el archivo");
+        return 1;
+    }
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = read(fd, data + done, size - done);
+        if (n <= 0)
+        {
+            perror(path);
+            return 1;
+        }
+        done += n;
+    }
+    close(fd);
+    printf("%s: %.1f MB, mejor de %d vueltas\n", path, size / 1e6, repeat);
+
+    Variant variants[4];
+    int count = 0;
+    variants[count++] = (Variant){"memchr", scan_memchr, NULL, 0, {0, 0}};
+    CsvMaskFn kernels[3];
+    int kernel_count = 0;
+    kernels[kernel_count++] = csv_masks_scalar;
+#ifdef CSV_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels[kernel_count++] = csv_masks_sse2;
+    if (__builtin_cpu_supports("avx2"))
+        kernels[kernel_count++] = csv_masks_avx2;
+#endif
+    for (int k = 0; k < kernel_count; k++)
+    {
+        variants[count] = (Variant){"", scan_csvscan, kernels[k], 0, {0, 0}};
+        snprintf(variants[count].name, sizeof(variants[count].name), "csvscan %s", csv_scan_kernel_name(kernels[k]));
+        count++;
+    }
+
+    long quoted_rows = 0;
+    for (const char *line = data, *end = data + size; line < end;)
+    {
+        const char *newline = memchr(line, '\n', end - line);
+        const char *line_end = newline ? newline : end;
+        quoted_rows += memchr(line, '"', line_end - line) != NULL;
+        line = line_end + 1;
+    }
+
+    csv_scan_select(); // Después de esto csv_scan_init usa csv_scan_kernel tal como quede
+    run_variants(variants, count, data, size, repeat);
+
+    const ScanResult *reference = &variants[0].result;
+    printf("%ld de %ld filas tienen comillas\n", quoted_rows, reference->rows);
+    int mismatch = 0;
+    for (int v = 0; v < count; v++)
+    {
+        print_result(variants[v].name, variants[v].best, size, &variants[v].result, variants[0].best);
+        if (variants[v].result.rows != reference->rows || variants[v].result.checksum != reference->checksum)
+        {
+            fprintf(stderr, "Error: %s no encontró los mismos campos que memchr (%ld filas contra %ld)\n",
+                    variants[v].name, variants[v].result.rows, reference->rows);
+            mismatch = 1;
+        }
+    }
+    free(data);
+    return mismatch;
+}
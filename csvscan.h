@@ -0,0 +1,313 @@
+#ifndef CSVSCAN_H
+#define CSVSCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "indexer.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CSV_SCAN_X86 1
+#endif
+
+// Recorrido del CSV por bloques de 64 bytes.
+//
+// En vez de buscar cada salto de línea y cada coma por separado (un memchr por campo, y
+// otro desde el final para la fecha), cada bloque se compara de una vez contra '\n', ',' y
+// '"' con instrucciones SIMD (AVX2 o SSE2, según lo que tenga el procesador; si no, un
+// recorrido byte a byte) y el resultado queda en tres máscaras de 64 bits. Las comas que
+// caen dentro de comillas (el CallNumber puede traerlas) se descartan con el prefijo XOR de
+// la máscara de comillas. Después las filas y sus separadores salen de las máscaras con
+// __builtin_ctzll, sin volver a leer los bytes.
+//
+// Un salto de línea siempre termina la fila, aunque haya una comilla sin cerrar: el CSV no
+// tiene campos de varias líneas y así una fila mal formada no se come a las siguientes.
+
+#define CSV_SCAN_BLOCK 64
+#define CSV_SCAN_FIRST_SEPARATORS COL_CALLNUMBER // Separadores que se guardan desde el inicio; del resto, solo el último
+
+// Un campo de una línea del CSV: apunta dentro de la misma línea, sin copiarla
+typedef struct {
+    const char *start;
+    size_t len;
+} FieldView;
+
+// Máscaras de un bloque: el bit i corresponde al byte i
+typedef struct {
+    uint64_t newlines;
+    uint64_t commas;
+    uint64_t quotes;
+} CsvMasks;
+
+typedef void (*CsvMaskFn)(const char *block, CsvMasks *masks);
+
+void csv_masks_scalar(const char *block, CsvMasks *masks) {
+    uint64_t newlines = 0, commas = 0, quotes = 0;
+    for (int i = 0; i < CSV_SCAN_BLOCK; i++) {
+        uint64_t bit = 1ULL << i;
+        if (block[i] == '\n') newlines |= bit;
+        else if (block[i] == ',') commas |= bit;
+        else if (block[i] == '"') quotes |= bit;
+    }
+    masks->newlines = newlines;
+    masks->commas = commas;
+    masks->quotes = quotes;
+}
+
+#ifdef CSV_SCAN_X86
+__attribute__((target("sse2")))
+void csv_masks_sse2(const char *block, CsvMasks *masks) {
+    const __m128i newline = _mm_set1_epi8('\n'), comma = _mm_set1_epi8(','), quote = _mm_set1_epi8('"');
+    uint64_t newlines = 0, commas = 0, quotes = 0;
+    for (int i = 0; i < CSV_SCAN_BLOCK; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(block + i));
+        newlines |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)) << i;
+        commas |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, comma)) << i;
+        quotes |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quote)) << i;
+    }
+    masks->newlines = newlines;
+    masks->commas = commas;
+    masks->quotes = quotes;
+}
+
+__attribute__((target("avx2")))
+void csv_masks_avx2(const char *block, CsvMasks *masks) {
+    const __m256i newline = _mm256_set1_epi8('\n'), comma = _mm256_set1_epi8(','), quote = _mm256_set1_epi8('"');
+    __m256i low = _mm256_loadu_si256((const __m256i *)block);
+    __m256i high = _mm256_loadu_si256((const __m256i *)(block + 32));
+    masks->newlines = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newline)) |
+                      (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newline)) << 32;
+    masks->commas = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, comma)) |
+                    (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, comma)) << 32;
+    masks->quotes = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, quote)) |
+                    (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, quote)) << 32;
+}
+#endif
+
+CsvMaskFn csv_scan_kernel = NULL;
+pthread_once_t csv_scan_once = PTHREAD_ONCE_INIT;
+
+// Nombre de la variante en uso: "avx2", "sse2" o "escalar"
+const char *csv_scan_kernel_name(CsvMaskFn kernel) {
+#ifdef CSV_SCAN_X86
+    if (kernel == csv_masks_avx2) return "avx2";
+    if (kernel == csv_masks_sse2) return "sse2";
+#endif
+    return "escalar";
+}
+
+// Elige la mejor variante que tenga el procesador. CSV_SCAN=escalar|sse2|avx2 en el entorno
+// fuerza una (si el procesador la tiene), para comparar.
+void csv_scan_choose(void) {
+    CsvMaskFn kernel = csv_masks_scalar;
+    const char *forced = getenv("CSV_SCAN");
+#ifdef CSV_SCAN_X86
+    __builtin_cpu_init();
+    int has_sse2 = __builtin_cpu_supports("sse2"), has_avx2 = __builtin_cpu_supports("avx2");
+    if (forced && strcmp(forced, "sse2") == 0) {
+        if (has_sse2) kernel = csv_masks_sse2;
+    } else if (forced && strcmp(forced, "avx2") == 0) {
+        if (has_avx2) kernel = csv_masks_avx2;
+    } else if (!forced || strcmp(forced, "escalar") != 0) {
+        kernel = has_avx2 ? csv_masks_avx2 : has_sse2 ? csv_masks_sse2 : csv_masks_scalar;
+    }
+#else
+    (void)forced;
+#endif
+    csv_scan_kernel = kernel;
+}
+
+// Devuelve la variante elegida. La elección se hace una sola vez, aunque varios hilos
+// empiecen a recorrer el CSV al mismo tiempo.
+CsvMaskFn csv_scan_select(void) {
+    pthread_once(&csv_scan_once, csv_scan_choose);
+    return csv_scan_kernel;
+}
+
+// Una fila: la línea sin el salto y las posiciones (desde el inicio de la línea) de las
+// comas que separan campos. Solo se guardan las que usa la regla de columnas: las primeras
+// CSV_SCAN_FIRST_SEPARATORS y la última.
+typedef struct {
+    const char *line;
+    size_t len;
+    int terminated;      // 1 si la línea terminó con '\n' (0 si es la última sin salto)
+    int separator_count; // Separadores de la fila, contados hasta CSV_SCAN_FIRST_SEPARATORS + 1
+    uint32_t separators[CSV_SCAN_FIRST_SEPARATORS];
+    uint32_t last_separator;
+} CsvRow;
+
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t block;        // Posición del bloque cuyas máscaras están cargadas
+    uint64_t newlines;   // Saltos de línea del bloque que todavía no se consumieron
+    uint64_t separators; // Comas fuera de comillas que todavía no se consumieron
+    int in_quotes;       // 1 si el bloque terminó dentro de comillas
+    size_t line_start;
+    CsvMaskFn kernel;
+} CsvScanner;
+
+// Bit i = XOR de los bits 0..i: marca los bytes que quedan entre una comilla que abre y la que cierra
+uint64_t csv_prefix_xor(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+// Calcula las máscaras del bloque que empieza en 'block' y deja las comas separadoras
+void csv_scan_load(CsvScanner *scanner, size_t block) {
+    CsvMasks masks;
+    size_t available = scanner->size - block;
+    if (available >= CSV_SCAN_BLOCK) {
+        scanner->kernel(scanner->data + block, &masks);
+    } else {
+        char tail[CSV_SCAN_BLOCK] = {0}; // Los ceros no son ni '\n' ni ',' ni '"'
+        memcpy(tail, scanner->data + block, available);
+        scanner->kernel(tail, &masks);
+    }
+    scanner->block = block;
+    scanner->newlines = masks.newlines;
+
+    if (masks.quotes == 0 && !scanner->in_quotes) {
+        scanner->separators = masks.commas; // Lo más común: un bloque sin comillas
+        return;
+    }
+    uint64_t inside = csv_prefix_xor(masks.quotes) ^ (scanner->in_quotes ? ~0ULL : 0);
+    if ((inside & masks.newlines) == 0) {
+        scanner->separators = masks.commas & ~inside;
+        scanner->in_quotes = inside >> 63;
+        return;
+    }
+
+    // Una comilla sin cerrar antes de un salto de línea: el salto la cierra. Es raro, así
+    // que se resuelve byte a byte.
+    const char *bytes = scanner->data + block;
+    int quoted = scanner->in_quotes;
+    uint64_t separators = 0;
+    for (size_t i = 0; i < CSV_SCAN_BLOCK && i < available; i++) {
+        if (bytes[i] == '\n') quoted = 0;
+        else if (bytes[i] == '"') quoted = !quoted;
+        else if (bytes[i] == ',' && !quoted) separators |= 1ULL << i;
+    }
+    scanner->separators = separators;
+    scanner->in_quotes = quoted;
+}
+
+void csv_scan_init(CsvScanner *scanner, const char *data, size_t size) {
+    scanner->data = data;
+    scanner->size = size;
+    scanner->in_quotes = 0;
+    scanner->line_start = 0;
+    scanner->kernel = csv_scan_select();
+    scanner->newlines = scanner->separators = 0;
+    scanner->block = 0;
+    if (size > 0) csv_scan_load(scanner, 0);
+}
+
+// Entrega la siguiente fila en 'row'. Devuelve 0 cuando ya no quedan.
+int csv_scan_row(CsvScanner *scanner, CsvRow *row) {
+    if (scanner->line_start >= scanner->size) return 0;
+    row->line = scanner->data + scanner->line_start;
+    row->separator_count = 0;
+
+    while (1) {
+        // Separadores de este bloque que van antes del próximo salto de línea
+        uint64_t before = scanner->separators;
+        if (scanner->newlines) before &= (scanner->newlines & -scanner->newlines) - 1;
+        scanner->separators &= ~before;
+        uint32_t offset = scanner->block - scanner->line_start;
+        while (before && row->separator_count < CSV_SCAN_FIRST_SEPARATORS) {
+            row->last_separator = offset + __builtin_ctzll(before);
+            row->separators[row->separator_count++] = row->last_separator;
+            before &= before - 1;
+        }
+        if (before) { // De los que siguen solo importa el último
+            row->last_separator = offset + 63 - __builtin_clzll(before);
+            row->separator_count = CSV_SCAN_FIRST_SEPARATORS + 1;
+        }
+
+        if (scanner->newlines) {
+            size_t newline = scanner->block + __builtin_ctzll(scanner->newlines);
+            scanner->newlines &= scanner->newlines - 1;
+            row->len = newline - scanner->line_start;
+            row->terminated = 1;
+            scanner->line_start = newline + 1;
+            return 1;
+        }
+        if (scanner->block + CSV_SCAN_BLOCK >= scanner->size) {
+            row->len = scanner->size - scanner->line_start; // Última línea, sin salto
+            row->terminated = 0;
+            scanner->line_start = scanner->size;
+            return 1;
+        }
+        csv_scan_load(scanner, scanner->block + CSV_SCAN_BLOCK);
+    }
+}
+
+// Separa las columnas de una fila ya recorrida. Las cuatro primeras van hasta los cuatro
+// primeros separadores; la fecha es lo que sigue al último y CallNumber lo que queda en medio
+// (con sus comillas, si las tiene). Llena hasta 'columns' columnas y devuelve cuántas se
+// encontraron. Sin la coma de la fecha, todo lo que sigue a la cuarta es CallNumber.
+int csv_row_fields(const CsvRow *row, FieldView *fields, int columns) {
+    const uint32_t *separators = row->separators;
+    if (columns >= CSV_COLUMNS && row->separator_count > COL_CALLNUMBER) { // Lo común: la fila completa
+        fields[0].start = row->line;
+        fields[0].len = separators[0];
+        for (int i = 1; i < COL_CALLNUMBER; i++) {
+            fields[i].start = row->line + separators[i - 1] + 1;
+            fields[i].len = separators[i] - separators[i - 1] - 1;
+        }
+        fields[COL_CALLNUMBER].start = row->line + separators[COL_CALLNUMBER - 1] + 1;
+        fields[COL_CALLNUMBER].len = row->last_separator - separators[COL_CALLNUMBER - 1] - 1;
+        fields[COL_CHECKOUTDATETIME].start = row->line + row->last_separator + 1;
+        fields[COL_CHECKOUTDATETIME].len = row->len - row->last_separator - 1;
+        return CSV_COLUMNS;
+    }
+
+    size_t start = 0;
+    int found = 0;
+    while (found < columns && found < COL_CALLNUMBER) {
+        int has_separator = found < row->separator_count;
+        size_t end = has_separator ? row->separators[found] : row->len;
+        fields[found].start = row->line + start;
+        fields[found].len = end - start;
+        found++;
+        if (!has_separator) return found;
+        start = end + 1;
+    }
+    if (found == columns) return found;
+
+    fields[found].start = row->line + start;
+    if (row->separator_count <= COL_CALLNUMBER) { // Sin coma de la fecha
+        fields[found].len = row->len - start;
+        return found + 1;
+    }
+    fields[found].len = row->last_separator - start;
+    if (++found == columns) return found;
+    fields[found].start = row->line + row->last_separator + 1;
+    fields[found].len = row->len - row->last_separator - 1;
+    return found + 1;
+}
+
+// Separa las primeras 'columns' columnas de una sola línea (sin el salto) sin modificarla ni
+// copiarla. Devuelve cuántas columnas se encontraron, hasta 'columns'.
+int csv_split_line(const char *line, size_t len, FieldView *fields, int columns) {
+    if (len == 0) {
+        fields[0].start = line;
+        fields[0].len = 0;
+        return columns > 0;
+    }
+    CsvScanner scanner;
+    CsvRow row;
+    csv_scan_init(&scanner, line, len);
+    csv_scan_row(&scanner, &row);
+    return csv_row_fields(&row, fields, columns);
+}
+
+#endif // CSVSCAN_H
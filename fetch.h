@@ -0,0 +1,518 @@
+#ifndef FETCH_H
+#define FETCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+// Lectura de filas del CSV con varias lecturas en vuelo.
+//
+// Con el CSV mapeado, cada fila que no está en memoria es una falla de página, y las fallas
+// de un mismo hilo se atienden de a una: en un disco frío, una consulta de cientos de filas
+// espera cientos de lecturas seguidas aunque el SSD podría hacerlas a la vez. Este lector
+// recibe los offsets de una tanda de filas, los ordena y los agrupa en tramos alineados a
+// FETCH_ALIGN (dos filas cercanas van en el mismo tramo), y pide todos los tramos juntos con
+// lecturas posicionales:
+//  - con io_uring, si el kernel lo permite: una sola llamada envía todas las lecturas;
+//  - si no, con un pool de hilos que hacen pread, uno por tramo.
+// Después el fin de cada fila se busca con memchr dentro del tramo leído. Una fila que no
+// quedó completa en su tramo (más larga que FETCH_ROW_MAX o al final del archivo) no se
+// entrega y quien llama la lee del mapeo como antes.
+// Solo se piden las filas cuyas páginas no están en memoria (según mincore sobre el mapeo):
+// con la caché del kernel caliente leer del mapeo es más barato que copiar con pread, y
+// una consulta no paga nada por este lector.
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define FETCH_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#define FETCH_ALIGN 4096
+#define FETCH_ROW_MAX 512             // Bytes que se leen a partir de cada fila; las más largas van por el mapeo
+#define FETCH_PROBE_PAGES 512          // Páginas que revisa cada llamada a mincore
+#define FETCH_MERGE_GAP (16 * 1024)   // Hueco máximo entre dos filas de un mismo tramo
+#define FETCH_MAX_SPAN (256 * 1024)   // Tamaño máximo de un tramo
+#define FETCH_MAX_ROWS 256            // Filas por tanda (y lecturas en vuelo por hilo)
+#define FETCH_THREADS 16              // Hilos del pool de pread
+
+// Un tramo del archivo que se lee de una vez
+typedef struct FetchSpan {
+    long start;             // Posición en el archivo (múltiplo de FETCH_ALIGN)
+    size_t len;
+    size_t buffer_pos;      // Dónde queda dentro del buffer de la tanda
+    ssize_t result;         // Bytes leídos, o -errno
+    struct RowFetch *owner; // Tanda a la que pertenece (para el pool)
+    struct FetchSpan *next; // Siguiente tramo en la cola del pool
+} FetchSpan;
+
+#ifdef FETCH_IO_URING
+// Anillos de io_uring mapeados (sin liburing, con las llamadas al sistema directas)
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+} FetchRing;
+#endif
+
+// Lector de un hilo: la última tanda leída y los buffers que se reutilizan entre tandas
+typedef struct RowFetch {
+    char *buffer;
+    size_t buffer_cap;
+    FetchSpan spans[FETCH_MAX_ROWS];
+    int span_count;
+
+    // Archivo del que lee la solicitud en curso (ver fetch_bind); fd < 0 desactiva el lector
+    int fd;
+    const char *data;  // El mismo archivo mapeado, para saber qué páginas ya están en memoria
+    long file_size;
+
+    // Filas de la tanda, ordenadas por offset
+    long offsets[FETCH_MAX_ROWS];
+    const char *lines[FETCH_MAX_ROWS]; // NULL si la fila no quedó completa en su tramo
+    size_t line_lens[FETCH_MAX_ROWS];  // Sin el salto de línea, que sigue en el buffer
+    int row_count;
+
+    // Tramos pendientes en el pool
+    int pending;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+
+#ifdef FETCH_IO_URING
+    int ring_state; // 0 = sin probar, 1 = en uso, -1 = no disponible (se usa el pool)
+    FetchRing ring;
+#endif
+} RowFetch;
+
+// Pool de hilos compartido por todos los lectores. Los tramos se encolan en una lista
+// enlazada dentro de las mismas tandas, así que encolar no reserva memoria.
+typedef struct {
+    int started;       // 1 si hay hilos en el pool
+    FetchSpan *head;
+    FetchSpan *tail;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} FetchPool;
+
+FetchPool fetch_pool = {0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+// Lee el tramo completo salvo que se llegue al final del archivo
+void fetch_read_span(RowFetch *fetch, FetchSpan *span)
+{
+    size_t done = 0;
+    while (done < span->len)
+    {
+        ssize_t n = pread(fetch->fd, fetch->buffer + span->buffer_pos + done, span->len - done,
+                          span->start + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            span->result = -errno;
+            return;
+        }
+        if (n == 0)
+            break;
+        done += n;
+    }
+    span->result = done;
+}
+
+void *fetch_pool_main(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        pthread_mutex_lock(&fetch_pool.lock);
+        while (fetch_pool.head == NULL)
+            pthread_cond_wait(&fetch_pool.ready, &fetch_pool.lock);
+        FetchSpan *span = fetch_pool.head;
+        fetch_pool.head = span->next;
+        if (fetch_pool.head == NULL)
+            fetch_pool.tail = NULL;
+        pthread_mutex_unlock(&fetch_pool.lock);
+
+        RowFetch *fetch = span->owner;
+        fetch_read_span(fetch, span);
+
+        pthread_mutex_lock(&fetch->lock);
+        if (--fetch->pending == 0)
+            pthread_cond_signal(&fetch->done);
+        pthread_mutex_unlock(&fetch->lock);
+    }
+    return NULL;
+}
+
+// Arranca el pool. Devuelve -1 si no se pudo; en ese caso fetch_rows no entrega filas y todo
+// se lee del mapeo.
+int fetch_start(int threads)
+{
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, fetch_pool_main, NULL) != 0)
+        {
+            perror("Error al crear hilo de lectura");
+            if (i == 0)
+                return -1;
+            break;
+        }
+        pthread_detach(thread);
+    }
+    fetch_pool.started = 1;
+    return 0;
+}
+
+// Indica de qué archivo lee 'fetch' en la solicitud que empieza: 'fd' abierto para lecturas
+// posicionales y el mismo archivo mapeado en 'data'. Cada generación del índice del backend
+// tiene su propio descriptor, así una solicitud que empezó con el índice anterior sigue
+// leyendo el CSV anterior aunque entretanto se haya cargado otro.
+void fetch_bind(RowFetch *fetch, int fd, const char *data, long file_size)
+{
+    fetch->fd = fetch_pool.started ? fd : -1;
+    fetch->data = data;
+    fetch->file_size = file_size;
+    fetch->row_count = 0;
+}
+
+RowFetch *fetch_create(void)
+{
+    RowFetch *fetch = calloc(1, sizeof(RowFetch));
+    if (fetch == NULL)
+    {
+        perror("Error: Fallo al asignar memoria para el lector de filas");
+        return NULL;
+    }
+    pthread_mutex_init(&fetch->lock, NULL);
+    pthread_cond_init(&fetch->done, NULL);
+    fetch->fd = -1;
+    return fetch;
+}
+
+#ifdef FETCH_IO_URING
+// Prepara un anillo con 'entries' lugares. Devuelve -1 si el kernel no tiene io_uring o no
+// lo permite (por ejemplo dentro de algunos contenedores).
+int fetch_ring_init(FetchRing *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0)
+        return -1;
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cq_size > sq_size)
+        sq_size = cq_size;
+
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    char *cq = sq;
+    if (!single)
+    {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+        {
+            munmap(sq, sq_size);
+            close(fd);
+            return -1;
+        }
+    }
+    void *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        if (!single)
+            munmap(cq, cq_size);
+        munmap(sq, sq_size);
+        close(fd);
+        return -1;
+    }
+
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->sqes = sqes;
+    return 0;
+}
+
+// Envía la lectura de todos los tramos y espera a que terminen. Devuelve -1 si el kernel no
+// acepta las lecturas; ningún tramo queda en vuelo en ese caso.
+int fetch_ring_read(RowFetch *fetch)
+{
+    FetchRing *ring = &fetch->ring;
+    unsigned tail = *ring->sq_tail;
+    for (int i = 0; i < fetch->span_count; i++)
+    {
+        FetchSpan *span = &fetch->spans[i];
+        unsigned index = tail & *ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fetch->fd;
+        sqe->addr = (unsigned long)(fetch->buffer + span->buffer_pos);
+        sqe->len = span->len;
+        sqe->off = span->start;
+        sqe->user_data = i;
+        ring->sq_array[index] = index;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    int submitted = 0, completed = 0, unsupported = 0;
+    while (completed < fetch->span_count)
+    {
+        int to_submit = fetch->span_count - submitted;
+        int r = syscall(__NR_io_uring_enter, ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            if (submitted == 0)
+            {
+                // Nada quedó en vuelo: se retiran las lecturas de la cola y se usa el pool
+                __atomic_store_n(ring->sq_tail, tail - to_submit, __ATOMIC_RELEASE);
+                return -1;
+            }
+            perror("Error en io_uring_enter");
+            r = 0;
+        }
+        if (r > 0)
+            submitted += r;
+
+        unsigned head = *ring->cq_head;
+        unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != cq_tail)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            FetchSpan *span = &fetch->spans[cqe->user_data];
+            span->result = cqe->res;
+            if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+                unsupported = 1; // Kernel sin IORING_OP_READ
+            else if (cqe->res >= 0 && (size_t)cqe->res < span->len &&
+                     span->start + cqe->res < fetch->file_size)
+                fetch_read_span(fetch, span); // Lectura corta: se completa con pread
+            head++;
+            completed++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return unsupported ? -1 : 0;
+}
+#endif
+
+// Lee con el pool todos los tramos de la tanda y espera a que terminen
+void fetch_pool_read(RowFetch *fetch)
+{
+    if (fetch->span_count == 1)
+    {
+        fetch_read_span(fetch, &fetch->spans[0]); // Un solo tramo: no vale la pena pasarlo a otro hilo
+        return;
+    }
+    fetch->pending = fetch->span_count;
+    pthread_mutex_lock(&fetch_pool.lock);
+    for (int i = 0; i < fetch->span_count; i++)
+    {
+        FetchSpan *span = &fetch->spans[i];
+        span->owner = fetch;
+        span->next = NULL;
+        if (fetch_pool.tail)
+            fetch_pool.tail->next = span;
+        else
+            fetch_pool.head = span;
+        fetch_pool.tail = span;
+    }
+    pthread_cond_broadcast(&fetch_pool.ready);
+    pthread_mutex_unlock(&fetch_pool.lock);
+
+    pthread_mutex_lock(&fetch->lock);
+    while (fetch->pending > 0)
+        pthread_cond_wait(&fetch->done, &fetch->lock);
+    pthread_mutex_unlock(&fetch->lock);
+}
+
+int compare_fetch_offsets(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+// Deja en 'offsets' (ordenados) solo los que tienen alguna página fuera de memoria y
+// devuelve cuántos quedan. Las filas cercanas se revisan con una sola llamada a mincore.
+int fetch_cold_rows(const RowFetch *fetch, long *offsets, int count)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned char resident[FETCH_PROBE_PAGES + 2];
+    int cold = 0;
+    for (int i = 0; i < count;)
+    {
+        long first_page = offsets[i] / page;
+        int j = i;
+        while (j < count && offsets[j] / page - first_page < FETCH_PROBE_PAGES)
+            j++;
+        long end = offsets[j - 1] + FETCH_ROW_MAX < fetch->file_size ? offsets[j - 1] + FETCH_ROW_MAX
+                                                                     : fetch->file_size;
+        long pages = (end - 1) / page - first_page + 1;
+        if (pages > FETCH_PROBE_PAGES + 2)
+            pages = FETCH_PROBE_PAGES + 2;
+        if (mincore((void *)(fetch->data + first_page * page), pages * page, resident) < 0)
+            memset(resident, 0, pages);
+        for (; i < j; i++)
+        {
+            // La fila cuenta como fría si la página donde empieza o la siguiente no está
+            long p = offsets[i] / page - first_page;
+            if (!(resident[p] & 1) || (p + 1 < pages && !(resident[p + 1] & 1) &&
+                                       (offsets[i] + FETCH_ROW_MAX - 1) / page > offsets[i] / page))
+                offsets[cold++] = offsets[i];
+        }
+    }
+    return cold;
+}
+
+// Lee las filas que empiezan en 'offsets' (hasta FETCH_MAX_ROWS) y que no están ya en
+// memoria. Después, fetch_lookup entrega cada una. Devuelve el número de filas leídas completas.
+int fetch_rows(RowFetch *fetch, const long *offsets, int count)
+{
+    fetch->row_count = 0;
+    fetch->span_count = 0;
+    if (fetch->fd < 0 || count <= 0)
+        return 0;
+    if (count > FETCH_MAX_ROWS)
+        count = FETCH_MAX_ROWS;
+
+    // Filas ordenadas y sin repetir
+    memcpy(fetch->offsets, offsets, count * sizeof(long));
+    qsort(fetch->offsets, count, sizeof(long), compare_fetch_offsets);
+    int rows = 0;
+    for (int i = 0; i < count; i++)
+        if (fetch->offsets[i] >= 0 && fetch->offsets[i] < fetch->file_size &&
+            (rows == 0 || fetch->offsets[i] != fetch->offsets[rows - 1]))
+            fetch->offsets[rows++] = fetch->offsets[i];
+    rows = fetch_cold_rows(fetch, fetch->offsets, rows);
+    if (rows == 0)
+        return 0;
+
+    // Tramos alineados: cada fila pide FETCH_ROW_MAX bytes; se junta con el tramo anterior
+    // si le queda cerca y el resultado no pasa de FETCH_MAX_SPAN
+    int span_of[FETCH_MAX_ROWS];
+    size_t total = 0;
+    for (int i = 0; i < rows; i++)
+    {
+        long start = fetch->offsets[i] & ~(long)(FETCH_ALIGN - 1);
+        long end = (fetch->offsets[i] + FETCH_ROW_MAX + FETCH_ALIGN - 1) & ~(long)(FETCH_ALIGN - 1);
+        FetchSpan *last = fetch->span_count ? &fetch->spans[fetch->span_count - 1] : NULL;
+        long last_end = last ? last->start + (long)last->len : 0;
+        if (last && start <= last_end + FETCH_MERGE_GAP && end - last->start <= FETCH_MAX_SPAN)
+        {
+            if (end > last_end)
+            {
+                total += end - last_end;
+                last->len = end - last->start;
+            }
+        }
+        else
+        {
+            FetchSpan *span = &fetch->spans[fetch->span_count++];
+            span->start = start;
+            span->len = end - start;
+            span->buffer_pos = total;
+            total += span->len;
+        }
+        span_of[i] = fetch->span_count - 1;
+    }
+    // La memoria de cada tramo se asigna en orden, así que al crecer el último tramo su
+    // buffer sigue siendo contiguo
+
+    if (total > fetch->buffer_cap)
+    {
+        char *buffer;
+        if (posix_memalign((void **)&buffer, FETCH_ALIGN, total) != 0)
+        {
+            perror("Error: Fallo al asignar memoria para la lectura de filas");
+            fetch->span_count = 0;
+            return 0;
+        }
+        free(fetch->buffer);
+        fetch->buffer = buffer;
+        fetch->buffer_cap = total;
+    }
+
+    int done = 0;
+#ifdef FETCH_IO_URING
+    if (fetch->ring_state == 0)
+        fetch->ring_state = fetch_ring_init(&fetch->ring, FETCH_MAX_ROWS) == 0 ? 1 : -1;
+    if (fetch->ring_state == 1)
+    {
+        if (fetch_ring_read(fetch) == 0)
+            done = 1;
+        else
+            fetch->ring_state = -1;
+    }
+#endif
+    if (!done)
+        fetch_pool_read(fetch);
+
+    // El fin de cada fila se busca dentro de lo que se leyó de su tramo
+    int complete = 0;
+    for (int i = 0; i < rows; i++)
+    {
+        const FetchSpan *span = &fetch->spans[span_of[i]];
+        fetch->lines[i] = NULL;
+        long skip = fetch->offsets[i] - span->start;
+        if (span->result <= skip)
+            continue;
+        const char *line = fetch->buffer + span->buffer_pos + skip;
+        const char *end = memchr(line, '\n', span->result - skip);
+        if (end == NULL)
+            continue; // Sin fin dentro del tramo (o última fila del archivo): se lee del mapeo
+        fetch->lines[i] = line;
+        fetch->line_lens[i] = end - line;
+        complete++;
+    }
+    fetch->row_count = rows;
+    return complete;
+}
+
+// Fila de la última tanda que empieza en 'offset', seguida de su salto de línea. Devuelve
+// NULL si no se leyó.
+const char *fetch_lookup(const RowFetch *fetch, long offset, size_t *len)
+{
+    if (fetch == NULL)
+        return NULL;
+    int lo = 0, hi = fetch->row_count;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (fetch->offsets[mid] < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == fetch->row_count || fetch->offsets[lo] != offset || fetch->lines[lo] == NULL)
+        return NULL;
+    *len = fetch->line_lens[lo];
+    return fetch->lines[lo];
+}
+
+#endif // FETCH_H
@@ -6,120 +6,471 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <signal.h>
-#include<sys/socket.h>
-#include<netinet/in.h>
-#include<arpa/inet.h>
+#include "indexer.h"
+#include "protocol.h"
 
 
 #define MAX_LINE_LEN 4096
 #define SERVER_IP "127.0.0.1" // IP del servidor (localhost)
 #define PORT 3550
+#define RESULT_COLUMNS 6      // BibNumber, ItemBarcode, ItemType, Collection, CallNumber, CheckoutDateTime
+#define PAGE_ROWS 1000        // Filas que se piden por página
 
 GtkWidget *entry_id;        // Aquí se ingresará el ID a buscar.
 GtkWidget *entry_year;      // Aquí se ingresará el año (opcional).
 GtkWidget *entry_month;     // Aquí se ingresará el mes (opcional, 1-12).
-GtkWidget *text_view;       // Aquí se mostrará el texto de los resultados.
-GtkTextBuffer *text_buffer; // Este es el "almacén" donde vive el texto que se muestra en text_view.
+GtkWidget *entry_from;      // Fecha inicial del rango (opcional, MM/DD/AAAA).
+GtkWidget *entry_to;        // Fecha final del rango, inclusiva (opcional, MM/DD/AAAA).
+GtkWidget *result_view;     // Tabla de resultados; solo dibuja las filas visibles.
+GtkWidget *status_label;    // Mensajes del servidor, errores y el número de filas recibidas.
+GtkWidget *button_cancel;   // Cancela la búsqueda en curso.
+GtkWidget *button_more;     // Pide la página siguiente de la última búsqueda.
+
+const char *result_titles[RESULT_COLUMNS] = {"BibNumber", "ItemBarcode", "ItemType", "Collection", "CallNumber", "CheckoutDateTime"};
+
+GSocketClient *socket_client;             // Abre las conexiones con el servidor sin bloquear la interfaz
+GSocketConnection *server_connection;     // Conexión persistente con el servidor (NULL = todavía no hay)
+uint32_t next_request_id = 1; // Id de la próxima solicitud binaria
+int use_text_protocol = 0;    // 1 si se pidió el formato de texto (SPL_PROTOCOLO=texto)
+
+SearchQuery last_query;       // Última búsqueda, con el cursor de su página siguiente
+int has_more_rows = 0;        // 1 si la última página trajo un cursor
+long shown_rows = 0;          // Filas que ya están en la tabla
+
+// Búsqueda en curso. Toda la red se hace con operaciones asíncronas de GIO que avisan en el
+// hilo de la interfaz, así la ventana nunca se bloquea esperando al servidor. Cada trama que
+// llega se parte en filas que se agregan a la tabla de inmediato.
+typedef struct {
+    GCancellable *cancellable;
+    GSocketConnection *connection;
+    GtkListStore *store;       // Filas de esta búsqueda (la tabla muestra la de la búsqueda actual)
+    unsigned char request[REQUEST_HEADER_SIZE + MAX_LINE_LEN];
+    size_t request_len;
+    uint32_t request_id;
+    unsigned char header[RESPONSE_HEADER_SIZE];
+    char frame_type;
+    uint32_t frame_request_id;
+    uint32_t payload_len;
+    char *payload;
+    GString *pending;          // Texto recibido después del último salto de línea
+    GString *message;          // Líneas que no son filas (encabezado, "no encontrado", errores)
+    long rows;                 // Filas en la tabla, contando las de las páginas anteriores
+    int has_next;              // 1 si la trama final trajo el cursor de otra página
+    PageCursor next;
+    int frames;
+    int attempt;
+} SearchState;
+
+SearchState *current_search = NULL;
+
+void start_attempt(SearchState *state);
+void read_frame_header(SearchState *state);
+
+// Muestra un mensaje en la barra de estado
+void set_status(const char *text)
+{
+    gtk_label_set_text(GTK_LABEL(status_label), text);
+}
+
+// Parte una fila CSV en sus columnas, sobre el mismo buffer. Respeta los campos entre
+// comillas (con "" como comilla escapada). Devuelve el número de columnas encontradas.
+int split_csv_row(char *line, char **fields, int max_fields)
+{
+    int count = 0;
+    char *read = line;
+    while (count < max_fields) {
+        char *write = read;
+        fields[count++] = write;
+        if (*read == '"') {
+            read++;
+            while (*read != '\0') {
+                if (*read == '"' && read[1] == '"') {
+                    *write++ = '"';
+                    read += 2;
+                } else if (*read == '"') {
+                    read++;
+                    break;
+                } else {
+                    *write++ = *read++;
+                }
+            }
+        }
+        while (*read != '\0' && *read != ',')
+            *write++ = *read++;
+        if (*read == '\0') {
+            *write = '\0';
+            return count;
+        }
+        *write = '\0';
+        read++;
+    }
+    return count + 1; // Sobraron columnas: no es una fila de resultados
+}
+
+// Agrega una línea completa de la respuesta: las filas van a la tabla y lo demás al mensaje
+void add_result_line(SearchState *state, char *line)
+{
+    char row[MAX_LINE_LEN];
+    char *fields[RESULT_COLUMNS];
+    if (strncmp(line, "BibNumber,", 10) == 0)
+        return; // Encabezado de las columnas; la tabla ya tiene los títulos
+
+    // Se parte una copia: si no resulta ser una fila, la línea sigue entera para el mensaje
+    size_t len = strlen(line);
+    if (len < sizeof(row) && split_csv_row(memcpy(row, line, len + 1), fields, RESULT_COLUMNS) == RESULT_COLUMNS) {
+        gtk_list_store_insert_with_values(state->store, NULL, -1,
+                                          0, fields[0], 1, fields[1], 2, fields[2],
+                                          3, fields[3], 4, fields[4], 5, fields[5], -1);
+        state->rows++;
+        return;
+    }
+    if (state->message->len > 0)
+        g_string_append_c(state->message, '\n');
+    g_string_append(state->message, line);
+}
+
+// Procesa la carga útil de una trama de datos. Las tramas llevan filas completas, pero por
+// si acaso lo que quede después del último salto se guarda para la próxima.
+void add_result_text(SearchState *state, const char *text, size_t len)
+{
+    g_string_append_len(state->pending, text, len);
+    char *start = state->pending->str;
+    char *newline;
+    while ((newline = memchr(start, '\n', state->pending->str + state->pending->len - start)) != NULL) {
+        *newline = '\0';
+        if (newline > start && newline[-1] == '\r')
+            newline[-1] = '\0';
+        add_result_line(state, start);
+        start = newline + 1;
+    }
+    g_string_erase(state->pending, 0, start - state->pending->str);
+}
+
+// Termina la búsqueda. 'error' es NULL si la respuesta llegó completa.
+void finish_search(SearchState *state, const char *error)
+{
+    // Si la respuesta quedó a medias no se sabe dónde empieza la próxima: se abre otra conexión
+    if (error != NULL || use_text_protocol) {
+        if (state->connection == server_connection)
+            g_clear_object(&server_connection);
+    }
+
+    if (state == current_search) {
+        current_search = NULL;
+        if (state->pending->len > 0)
+            add_result_line(state, state->pending->str);
+
+        GString *status = g_string_new(NULL);
+        if (state->message->len > 0)
+            g_string_append(status, state->message->str);
+        if (state->rows > 0)
+            g_string_append_printf(status, "%s%ld filas%s", status->len > 0 ? "\n" : "", state->rows,
+                                   state->has_next && error == NULL ? "; hay más resultados." : ".");
+        if (error != NULL)
+            g_string_append_printf(status, "%s%s", status->len > 0 ? "\n" : "", error);
+        set_status(status->str);
+        g_string_free(status, TRUE);
+
+        // La página siguiente sigue desde el cursor que devolvió el servidor
+        shown_rows = state->rows;
+        has_more_rows = state->has_next && error == NULL;
+        if (has_more_rows) {
+            last_query.has_cursor = 1;
+            last_query.cursor = state->next;
+        }
+        gtk_widget_set_sensitive(button_cancel, FALSE);
+        gtk_widget_set_sensitive(button_more, has_more_rows);
+    }
+
+    g_clear_object(&state->connection);
+    g_object_unref(state->cancellable);
+    g_object_unref(state->store);
+    g_string_free(state->pending, TRUE);
+    g_string_free(state->message, TRUE);
+    g_free(state->payload);
+    g_free(state);
+}
+
+// La conexión falló. Si no había llegado nada de la respuesta se reintenta una vez en una
+// conexión nueva (por ejemplo, si el servidor se reinició y cerró la conexión persistente).
+void connection_failed(SearchState *state, GError *error)
+{
+    int cancelled = g_cancellable_is_cancelled(state->cancellable);
+    if (error != NULL)
+        g_error_free(error);
+    if (cancelled) {
+        finish_search(state, "Búsqueda cancelada.");
+        return;
+    }
+    if (state->frames == 0 && state->attempt == 0) {
+        state->attempt++;
+        if (state->connection == server_connection)
+            g_clear_object(&server_connection);
+        g_clear_object(&state->connection);
+        start_attempt(state);
+        return;
+    }
+    finish_search(state, "Error: la conexión con el servidor se cerró antes de terminar la respuesta.");
+}
+
+void on_payload_read(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    SearchState *state = user_data;
+    GError *error = NULL;
+    gsize bytes_read = 0;
+    if (!g_input_stream_read_all_finish(G_INPUT_STREAM(source), result, &bytes_read, &error) ||
+        bytes_read < state->payload_len || g_cancellable_is_cancelled(state->cancellable)) {
+        connection_failed(state, error);
+        return;
+    }
+    state->frames++;
+
+    // Con una sola solicitud en vuelo no debería llegar otra cosa; si llega, se descarta
+    if (state->frame_request_id != state->request_id) {
+        read_frame_header(state);
+        return;
+    }
+    if (state->frame_type == FRAME_END) {
+        // Después del número de filas puede venir el cursor de la página siguiente
+        if (!use_text_protocol && state->payload_len >= 8 + PAGE_CURSOR_SIZE) {
+            page_cursor_decode((const unsigned char *)state->payload + 8, &state->next);
+            state->has_next = 1;
+        }
+        finish_search(state, NULL);
+        return;
+    }
+    if (state->frame_type == FRAME_DATA || state->frame_type == FRAME_ERROR) {
+        add_result_text(state, state->payload, state->payload_len);
+        if (state == current_search) {
+            char status[64];
+            snprintf(status, sizeof(status), "Recibiendo... %ld filas", state->rows);
+            set_status(status);
+        }
+    }
+    read_frame_header(state);
+}
+
+void on_header_read(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    SearchState *state = user_data;
+    GError *error = NULL;
+    gsize bytes_read = 0;
+    size_t header_size = use_text_protocol ? FRAME_HEADER_SIZE : RESPONSE_HEADER_SIZE;
+    if (!g_input_stream_read_all_finish(G_INPUT_STREAM(source), result, &bytes_read, &error) ||
+        bytes_read < header_size || g_cancellable_is_cancelled(state->cancellable)) {
+        connection_failed(state, error);
+        return;
+    }
+
+    state->frame_request_id = state->request_id;
+    if (use_text_protocol)
+        frame_header_decode(state->header, &state->frame_type, &state->payload_len);
+    else
+        response_header_decode(state->header, &state->frame_type, &state->frame_request_id, &state->payload_len);
+    if (state->payload_len > FRAME_MAX_PAYLOAD) {
+        state->frames++; // No tiene sentido reintentar con una respuesta inválida
+        connection_failed(state, NULL);
+        return;
+    }
+    // La carga útil se lee aunque esté vacía, así todas las tramas pasan por el mismo lugar
+    g_input_stream_read_all_async(G_INPUT_STREAM(source), state->payload, state->payload_len,
+                                  G_PRIORITY_DEFAULT_IDLE, state->cancellable, on_payload_read, state);
+}
+
+// Lee la cabecera de la próxima trama. Las lecturas tienen una prioridad menor que los
+// eventos y el redibujado de GTK, así una respuesta grande no congela la ventana.
+void read_frame_header(SearchState *state)
+{
+    GInputStream *input = g_io_stream_get_input_stream(G_IO_STREAM(state->connection));
+    size_t header_size = use_text_protocol ? FRAME_HEADER_SIZE : RESPONSE_HEADER_SIZE;
+    g_input_stream_read_all_async(input, state->header, header_size, G_PRIORITY_DEFAULT_IDLE,
+                                  state->cancellable, on_header_read, state);
+}
+
+void on_request_sent(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    SearchState *state = user_data;
+    GError *error = NULL;
+    if (!g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, NULL, &error) ||
+        g_cancellable_is_cancelled(state->cancellable)) {
+        connection_failed(state, error);
+        return;
+    }
+    read_frame_header(state);
+}
+
+void send_request(SearchState *state)
+{
+    GOutputStream *output = g_io_stream_get_output_stream(G_IO_STREAM(state->connection));
+    g_output_stream_write_all_async(output, state->request, state->request_len, G_PRIORITY_DEFAULT,
+                                    state->cancellable, on_request_sent, state);
+}
+
+void on_connected(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    SearchState *state = user_data;
+    GError *error = NULL;
+    GSocketConnection *connection = g_socket_client_connect_to_host_finish(G_SOCKET_CLIENT(source), result, &error);
+    if (connection == NULL || g_cancellable_is_cancelled(state->cancellable)) {
+        int cancelled = g_cancellable_is_cancelled(state->cancellable);
+        if (error != NULL)
+            g_error_free(error);
+        if (connection != NULL)
+            g_object_unref(connection);
+        if (cancelled) {
+            finish_search(state, "Búsqueda cancelada.");
+        } else {
+            char error_msg[256];
+            snprintf(error_msg, sizeof(error_msg), "Error de conexión: No se pudo conectar a %s:%d. El servidor no se esta ejecutando", SERVER_IP, PORT);
+            finish_search(state, error_msg);
+        }
+        return;
+    }
+
+    state->connection = connection;
+    // En texto el servidor cierra después de cada respuesta; en binario la conexión se reutiliza
+    if (!use_text_protocol)
+        server_connection = g_object_ref(connection);
+    send_request(state);
+}
+
+// Envía la solicitud por la conexión persistente o, si no hay, abre una
+void start_attempt(SearchState *state)
+{
+    if (server_connection != NULL && !use_text_protocol) {
+        state->connection = g_object_ref(server_connection);
+        send_request(state);
+        return;
+    }
+    g_socket_client_connect_to_host_async(socket_client, SERVER_IP, PORT, state->cancellable, on_connected, state);
+}
+
+// Cancela la búsqueda en curso, si hay una. Sus operaciones pendientes terminan solas con
+// un error de cancelación; la conexión que usaba se descarta porque quedó a mitad de una respuesta.
+void cancel_search(void)
+{
+    if (current_search == NULL)
+        return;
+    g_cancellable_cancel(current_search->cancellable);
+    if (current_search->connection == server_connection)
+        g_clear_object(&server_connection);
+}
+
+void cancel_clicked(GtkWidget *widget, gpointer data)
+{
+    cancel_search();
+}
+
+SearchState *new_search(void)
+{
+    SearchState *state = g_new0(SearchState, 1);
+    state->cancellable = g_cancellable_new();
+    state->payload = g_malloc(FRAME_MAX_PAYLOAD + 1);
+    state->pending = g_string_new(NULL);
+    state->message = g_string_new(NULL);
+    return state;
+}
+
+// Arma la solicitud de una página de 'query' (la primera o, con cursor, la siguiente)
+void encode_page_request(SearchState *state, const SearchQuery *query)
+{
+    state->request_id = next_request_id++;
+    size_t payload_len = page_payload_encode(state->request + REQUEST_HEADER_SIZE, query);
+    request_header_encode(state->request, REQ_PAGE, state->request_id, payload_len);
+    state->request_len = REQUEST_HEADER_SIZE + payload_len;
+}
+
+// Deja 'state' como la búsqueda actual y empieza a enviarla
+void run_search(SearchState *state)
+{
+    current_search = state;
+    has_more_rows = 0;
+    set_status("Buscando, por favor espere...");
+    gtk_widget_set_sensitive(button_cancel, TRUE);
+    gtk_widget_set_sensitive(button_more, FALSE);
+    start_attempt(state);
+}
 
 void search_id(GtkWidget *widget, gpointer data)
 {
     const char *id_to_find = gtk_entry_get_text(GTK_ENTRY(entry_id));
     const char *year_str = gtk_entry_get_text(GTK_ENTRY(entry_year));
     const char *month_str = gtk_entry_get_text(GTK_ENTRY(entry_month));
+    const char *from_str = gtk_entry_get_text(GTK_ENTRY(entry_from));
+    const char *to_str = gtk_entry_get_text(GTK_ENTRY(entry_to));
+    SearchQuery query;
 
+    memset(&query, 0, sizeof(query));
     if (strlen(id_to_find) == 0) {
-        gtk_text_buffer_set_text(text_buffer, "Error: El campo ID no puede estar vacío.", -1);
+        set_status("Error: El campo ID no puede estar vacío.");
+        return;
+    }
+    if (strlen(id_to_find) >= sizeof(query.id)) {
+        set_status("Error: El ID es demasiado largo.");
         return;
     }
+    strcpy(query.id, id_to_find);
+    query.year = atoi(year_str);
+
     // Validate month input
     if (strlen(month_str) > 0)
     {
         int month = atoi(month_str);
         if (month < 1 || month > 12)
         {
-            // Si el mes no es valido, mostramos un mensaje de error en el área de texto.
-            gtk_text_buffer_set_text(text_buffer, "Error: El mes debe ser un número entre 1 y 12.", -1);
+            // Si el mes no es valido, mostramos un mensaje de error en la barra de estado.
+            set_status("Error: El mes debe ser un número entre 1 y 12.");
             return;
         }
+        query.month = month;
+    }
+
+    // Validate date range input (MM/DD/AAAA). "Hasta" incluye el día completo.
+    if (strlen(from_str) > 0)
+        query.date_from = parse_checkout_datetime(from_str);
+    if (strlen(to_str) > 0)
+        query.date_to = parse_checkout_datetime(to_str);
+    if (query.date_from < 0 || query.date_to < 0)
+    {
+        set_status("Error: Las fechas del rango deben tener el formato MM/DD/AAAA.");
+        return;
+    }
+    if (query.date_to > 0)
+        query.date_to += 86400;
+
+    // Una búsqueda nueva reemplaza a la anterior
+    cancel_search();
+
+    //--------------Armar la solicitud-------------------
+    SearchState *state = new_search();
+    if (use_text_protocol) {
+        // Formato de texto: una conexión nueva por búsqueda y sin páginas
+        state->request_len = snprintf((char *)state->request, sizeof(state->request), "%s|%s|%s|%s|%s", id_to_find, year_str, month_str, from_str, to_str);
+    } else {
+        query.limit = PAGE_ROWS;
+        last_query = query;
+        encode_page_request(state, &query);
     }
 
-    gtk_text_buffer_set_text(text_buffer, "Buscando, por favor espere...", -1);
-    
-    // GTK necesita procesar eventos pendientes para redibujar la pantalla.
-    // Esta línea fuerza a GTK a actualizar la interfaz y mostrar el mensaje "Buscando..."
-    // antes de que nos bloqueemos en la red. Es un truco muy útil.
-    while (gtk_events_pending()) {
-        gtk_main_iteration();
-    }
-
-    // Configuro la conexión al servidor y envío la solicitud. Tengo que configurar la estructura de tipo sockaddr_in
-
-    int socket_fd;
-    struct sockaddr_in server;
-    char request[MAX_LINE_LEN];
-
-    // Crear el socket
-    socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (socket_fd < 0) {
-        gtk_text_buffer_set_text(text_buffer, "Error: No se pudo crear el socket.", -1);
-        return;
-    }
-
-    //--------------Configurar la estructura del servidor -------------------
-    
-    server.sin_family = AF_INET; //indica las familias de direcciones (IPv4)
-    server.sin_port = htons(PORT);//asigna el puerto al que se va a conectar pero lo pasa a formato de red
-    //client.sin_addr.s_addr = INET_ADDRSTRLEN; 
-    inet_pton(AF_INET, SERVER_IP, &server.sin_addr);//asigna la direccion IP del servidor al que se va a conectar(local)
-    //Direccion local  127.0.0.1
-    //25.32.50.226 de la red de juan de hamachi
-    //Esa es la IP del servidor al que se va a conectar a travez de hamachi
-    //La puedo cambiar por la IP del servidor al que quiero conectarme como por ejemplo la IP local 
-    //memset(client.sin_zero, 0, sizeof(client.sin_zero));
-    bzero(server.sin_zero, sizeof(server.sin_zero));
-
-    //------------------Conectar al servidor-------------------
-    if (connect(socket_fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
-        char error_msg[256];
-        snprintf(error_msg, sizeof(error_msg), "Error de conexión: No se pudo conectar a %s:%d. El servidor no se esta ejecutando", SERVER_IP, PORT);
-        gtk_text_buffer_set_text(text_buffer, error_msg, -1);
-        close(socket_fd);
-        return;
-    }
-
-    //--------------Enviar solicitud al servidor-------------------
-    snprintf(request, sizeof(request), "%s|%s|%s", id_to_find, year_str, month_str);
-    int r = send(socket_fd, request, strlen(request), 0);
-    if (r < 0) {
-        perror("Error al enviar datos al servidor");
-        close(socket_fd);
-        return;
-    }
-
-     // C.5: Recibir la respuesta (usando lógica de búfer dinámico)
-
-     size_t buffer_size = 4096;
-     char *response_buffer = malloc(buffer_size);
-     size_t total_bytes_read = 0;
-     ssize_t bytes_in_chunk;
- 
-     while ((bytes_in_chunk = recv(socket_fd, response_buffer + total_bytes_read, buffer_size - total_bytes_read - 1, 0)) > 0) {
-         total_bytes_read += bytes_in_chunk;
-         if (total_bytes_read >= buffer_size - 1) {
-             buffer_size *= 2;
-             response_buffer = realloc(response_buffer, buffer_size);
-         }
-     }
- 
-     // C.6: Cerrar la conexión
-     close(socket_fd);
-     
-     // C.7: Mostrar el resultado
-     response_buffer[total_bytes_read] = '\0';
-     gtk_text_buffer_set_text(text_buffer, response_buffer, -1);
- 
-     // C.8: Liberar memoria
-     free(response_buffer);
+    // Cada búsqueda llena una lista nueva. Cambiar el modelo de la tabla descarta la anterior
+    // de una vez, sin avisar fila por fila como lo haría vaciarla.
+    state->store = gtk_list_store_new(RESULT_COLUMNS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
+                                      G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+    gtk_tree_view_set_model(GTK_TREE_VIEW(result_view), GTK_TREE_MODEL(state->store));
+    shown_rows = 0;
+    run_search(state);
+}
+
+// Pide la página siguiente de la última búsqueda; sus filas se agregan al final de la tabla
+void more_clicked(GtkWidget *widget, gpointer data)
+{
+    if (!has_more_rows || current_search != NULL)
+        return;
+    SearchState *state = new_search();
+    encode_page_request(state, &last_query);
+    state->store = g_object_ref(GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(result_view))));
+    state->rows = shown_rows;
+    run_search(state);
 }
 
 static void activate(GtkApplication *app, gpointer user_data)
@@ -127,6 +478,7 @@ static void activate(GtkApplication *app, gpointer user_data)
     GtkWidget *window;
     GtkWidget *grid;
     GtkWidget *label_prompt_id, *label_prompt_year, *label_prompt_month;
+    GtkWidget *label_prompt_from, *label_prompt_to;
     GtkWidget *button_search;
 
     //Configuracion general de la ventana
@@ -172,11 +524,49 @@ static void activate(GtkApplication *app, gpointer user_data)
     gtk_grid_attach(GTK_GRID(grid), entry_month, 1, 2, 2, 1);
     gtk_widget_set_hexpand(entry_month, TRUE);
 
+    //Configuracion de los widgets para el rango de fechas
+    label_prompt_from = gtk_label_new("Desde (MM/DD/AAAA, opcional):");
+    gtk_grid_attach(GTK_GRID(grid), label_prompt_from, 0, 3, 1, 1);
+    gtk_widget_set_halign(label_prompt_from, GTK_ALIGN_END);
+
+    entry_from = gtk_entry_new();
+    gtk_entry_set_max_length(GTK_ENTRY(entry_from), 10);
+    gtk_grid_attach(GTK_GRID(grid), entry_from, 1, 3, 2, 1);
+    gtk_widget_set_hexpand(entry_from, TRUE);
+
+    label_prompt_to = gtk_label_new("Hasta (MM/DD/AAAA, opcional):");
+    gtk_grid_attach(GTK_GRID(grid), label_prompt_to, 0, 4, 1, 1);
+    gtk_widget_set_halign(label_prompt_to, GTK_ALIGN_END);
+
+    entry_to = gtk_entry_new();
+    gtk_entry_set_max_length(GTK_ENTRY(entry_to), 10);
+    gtk_grid_attach(GTK_GRID(grid), entry_to, 1, 4, 2, 1);
+    gtk_widget_set_hexpand(entry_to, TRUE);
+
     // Botón para buscar y filtrar
     button_search = gtk_button_new_with_label("Buscar y Filtrar");
-    gtk_grid_attach(GTK_GRID(grid), button_search, 1, 3, 1, 1);
+    gtk_grid_attach(GTK_GRID(grid), button_search, 1, 5, 1, 1);
     g_signal_connect(button_search, "clicked", G_CALLBACK(search_id), NULL);
 
+    // Botón para cancelar la búsqueda en curso
+    button_cancel = gtk_button_new_with_label("Cancelar");
+    gtk_grid_attach(GTK_GRID(grid), button_cancel, 2, 5, 1, 1);
+    gtk_widget_set_sensitive(button_cancel, FALSE);
+    g_signal_connect(button_cancel, "clicked", G_CALLBACK(cancel_clicked), NULL);
+
+    // Botón para traer la página siguiente de resultados
+    button_more = gtk_button_new_with_label("Más resultados");
+    gtk_grid_attach(GTK_GRID(grid), button_more, 0, 5, 1, 1);
+    gtk_widget_set_sensitive(button_more, FALSE);
+    g_signal_connect(button_more, "clicked", G_CALLBACK(more_clicked), NULL);
+
+    // Barra de estado: mensajes del servidor, errores y número de filas
+    status_label = gtk_label_new("Resultados aparecerán aquí.");
+    gtk_label_set_xalign(GTK_LABEL(status_label), 0);
+    gtk_label_set_line_wrap(GTK_LABEL(status_label), TRUE);
+    gtk_label_set_selectable(GTK_LABEL(status_label), TRUE);
+    gtk_grid_attach(GTK_GRID(grid), status_label, 0, 6, 3, 1);
+
     // 1. Crear una ventana con barras de desplazamiento.
     GtkWidget *scrolled_window = gtk_scrolled_window_new(NULL, NULL);
     // Le decimos que muestre las barras de desplazamiento solo cuando sea necesario.
@@ -184,26 +574,24 @@ static void activate(GtkApplication *app, gpointer user_data)
     // Le decimos al grid que esta ventana debe expandirse para llenar el espacio.
     gtk_widget_set_hexpand(scrolled_window, TRUE);
     gtk_widget_set_vexpand(scrolled_window, TRUE);
-    // La añadimos al grid en la misma posición donde estaba la etiqueta.
-    gtk_grid_attach(GTK_GRID(grid), scrolled_window, 0, 4, 3, 1);
-
-    // 2. Crear el área de texto 
-    text_view = gtk_text_view_new();
-
-    // 3. Obtener el "buffer" del texto. El buffer es donde se guarda el texto.
-    // Siempre modificamos el buffer, no la vista directamente.
-    text_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
-    gtk_text_buffer_set_text(text_buffer, "Resultados aparecerán aquí.", -1);
-
-    // 4. Configurar el área de texto para que sea de solo lectura.
-    gtk_text_view_set_editable(GTK_TEXT_VIEW(text_view), FALSE);
-    // Opcional: Oculta el cursor parpadeante de texto.
-    gtk_text_view_set_cursor_visible(GTK_TEXT_VIEW(text_view), FALSE);
-    // Opcional: Hace que el texto se ajuste a la ventana (word wrap).
-    gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(text_view), GTK_WRAP_WORD_CHAR);
+    gtk_grid_attach(GTK_GRID(grid), scrolled_window, 0, 7, 3, 1);
+
+    // 2. Crear la tabla de resultados. Con altura fija por fila la tabla no mide cada fila:
+    // calcula su tamaño a partir de la cantidad y solo arma las que están a la vista, así
+    // que agregar o desplazarse por cien mil filas cuesta lo mismo que por cien.
+    result_view = gtk_tree_view_new();
+    for (int i = 0; i < RESULT_COLUMNS; i++) {
+        GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+        GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes(result_titles[i], renderer, "text", i, NULL);
+        gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+        gtk_tree_view_column_set_fixed_width(column, i == 4 ? 200 : 110);
+        gtk_tree_view_column_set_resizable(column, TRUE);
+        gtk_tree_view_append_column(GTK_TREE_VIEW(result_view), column);
+    }
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(result_view), TRUE);
 
-    // 5.Añadimos el área de texto DENTRO de la ventana con scroll.
-    gtk_container_add(GTK_CONTAINER(scrolled_window), text_view);
+    // 3. Añadimos la tabla DENTRO de la ventana con scroll.
+    gtk_container_add(GTK_CONTAINER(scrolled_window), result_view);
 
     gtk_widget_show_all(window);
 }
@@ -213,9 +601,15 @@ int main(int argc, char **argv)
 {
     GtkApplication *app;
     int status;
+    // Compatibilidad con servidores que solo entienden el formato de texto
+    const char *protocol = getenv("SPL_PROTOCOLO");
+    use_text_protocol = protocol != NULL && strcmp(protocol, "texto") == 0;
+    socket_client = g_socket_client_new();
+
     app = gtk_application_new("org.gtk.example", G_APPLICATION_DEFAULT_FLAGS);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
     status = g_application_run(G_APPLICATION(app), argc, argv);
     g_object_unref(app);
+    g_object_unref(socket_client);
     return status;
 }
\ No newline at end of file
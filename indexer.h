@@ -1,15 +1,381 @@
 #ifndef INDEXER_H
 #define INDEXER_H
 
-// Tamaño de nuestra tabla hash principal. Un número primo suele ser una buena elección.
-#define HASH_TABLE_SIZE 65536
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Formato del índice:
+//  - index.dat es un arreglo contiguo de IndexEntry ordenado por (clave, fecha, data_offset),
+//    así que todas las entradas de un BibNumber quedan juntas y se leen con una sola lectura secuencial.
+//  - header.dat es un IndexHeader seguido de una tabla de KeySlot con direccionamiento abierto
+//    (sondeo lineal) que dice dónde empiezan las entradas de cada clave. El constructor la
+//    dimensiona según las claves distintas que encontró: es la potencia de 2 que deja la
+//    tabla a lo sumo a la mitad de su capacidad, así que una búsqueda toca muy pocas posiciones.
+//
+// La clave de un BibNumber numérico es el propio número, así que una clave encontrada en la
+// tabla ya identifica exactamente al ID y no hace falta leer el CSV para descartar otros.
+// Los IDs que no son un número canónico (con ceros a la izquierda, letras, etc.) usan una
+// clave derivada del hash del texto, marcada con KEY_HASHED_FLAG; solo esas filas se
+// comprueban contra el CSV.
+//
+// La cabecera guarda también hasta qué byte del CSV se indexó (la marca de agua), para que
+// ./constructor -a indexe solo las filas agregadas después al final del archivo.
+
+#define INDEX_MAGIC "SPLIDX3"
+#define KEY_EMPTY (-1L)             // Posición libre en la tabla de claves
+#define KEY_HASHED_FLAG (1L << 62)  // La clave viene del hash del texto, no del número
+#define KEY_MAX_DIGITS 18           // Cualquier número de 18 dígitos es menor que KEY_HASHED_FLAG
+
+typedef struct {
+    char magic[8];
+    long table_size;  // Posiciones de la tabla de claves (potencia de 2)
+    long key_count;   // Claves distintas
+    long entry_count; // Entradas en index.dat (una por fila indexada)
+    long csv_size;    // Marca de agua: bytes del CSV ya indexados
+    unsigned long csv_tail_hash; // Hash de los últimos bytes indexados, para notar si el CSV se reemplazó
+} IndexHeader;
+
+// Una posición de la tabla: las entradas de 'key' son [start, start + count) en index.dat
+typedef struct {
+    long key;
+    long start;
+    long count;
+} KeySlot;
+
+// Estructura para cada entrada del arreglo de postings en index.dat.
+// Dentro de cada clave las entradas están ordenadas por (checkout_time, data_offset),
+// así que un filtro de año, mes o rango de fechas es una búsqueda binaria sobre el bloque.
+typedef struct {
+    long key;           // Clave del BibNumber (ver index_key)
+    long checkout_time; // CheckoutDateTime en segundos desde la época (UTC), -1 si no se pudo leer
+    long data_offset;   // Posición del registro en dataset.csv
+} IndexEntry;
+
+// Índices secundarios (uno por columna, en SECONDARY_INDEX_PATH): cada archivo es un
+// SecondaryHeader, los ValueSlot de los valores distintos de la columna ordenados por su
+// texto, el texto de esos valores (sin comillas) y el arreglo de IndexEntry. La clave de cada
+// entrada es la posición de su valor en ese orden, así que el bloque de un valor se
+// encuentra con una búsqueda binaria sobre el texto y los valores que empiezan con un
+// prefijo quedan en posiciones consecutivas. Dentro de cada valor las entradas van
+// ordenadas por (fecha, offset), igual que en index.dat, y así dos listas de cualquier
+// índice se intersecan recorriéndolas en orden.
+
+#define SECONDARY_MAGIC "SPLSEC1"
+
+// Columnas del CSV; los índices secundarios y las consultas las identifican por este número
+#define COL_BIBNUMBER 0
+#define COL_ITEMBARCODE 1
+#define COL_ITEMTYPE 2
+#define COL_COLLECTION 3
+#define COL_CALLNUMBER 4
+#define COL_CHECKOUTDATETIME 5
+#define CSV_COLUMNS 6
+#define SECONDARY_FIRST_COLUMN COL_ITEMBARCODE
+#define SECONDARY_LAST_COLUMN COL_CALLNUMBER
+
+typedef struct {
+    char magic[8];
+    long column;       // Columna del CSV indexada
+    long value_count;  // Valores distintos
+    long entry_count;  // Entradas (una por fila del CSV)
+    long strings_size; // Bytes del texto de los valores, ya redondeado a múltiplo de 8
+} SecondaryHeader;
+
+// Un valor distinto: su texto es strings[name_offset, name_offset + name_len) y sus
+// entradas son [start, start + count) dentro del arreglo de IndexEntry
+typedef struct {
+    long start;
+    long count;
+    long name_offset;
+    long name_len;
+} ValueSlot;
+
+// Manifiesto de años (years.dat): cuántas filas del índice caen en cada mes de cada año. Las
+// entradas de cada clave ya están ordenadas por fecha, así que el filtro de fecha es una
+// búsqueda binaria dentro del bloque; el manifiesto permite además responder sin tocar la
+// tabla de claves cuando el año o mes pedido no tiene ninguna fila en todo el dataset.
+
+#define YEARS_MAGIC "SPLYRS1"
+#define YEARS_FIRST 1900 // Primer año del manifiesto
+#define YEARS_SPAN 256   // Años que cubre desde YEARS_FIRST
+
+typedef struct {
+    char magic[8];
+    long entry_count;  // Entradas de index.dat, para detectar un manifiesto de otro índice
+    long undated_rows; // Filas sin fecha válida
+    long outside_rows; // Filas con fecha fuera de los años del manifiesto
+    long first_year;   // Primer y último año con filas (0 si no hay ninguna)
+    long last_year;
+    long month_rows[YEARS_SPAN][12]; // Filas de cada mes, desde enero de YEARS_FIRST
+} YearManifest;
+
+// Agregados (aggregates.dat): conteos de préstamos ya calculados a partir del índice, para
+// contestar "cuántas veces se prestó X por mes" o "los N títulos más prestados de un período"
+// sin leer filas. Después de la AggHeader vienen:
+//  - una tabla de KeySlot (como la de header.dat) que da el bloque de cada clave dentro de
+//  - las series: MonthCount de cada clave, ordenados por mes, solo los meses con préstamos;
+//  - las listas de más prestados: AggPeriod de cada período (todo el dataset y, por cada año
+//    desde first_year, el año completo y sus 12 meses) y después sus TopEntry, de mayor a menor;
+//  - los rollups de ItemType y Collection: un ValueSlot por valor (start es la posición de su
+//    fila de conteos, count la suma), el texto de los valores y, por cada valor, los préstamos
+//    de cada mes desde enero de first_year.
+// Los meses se numeran como año * 12 + (mes - 1); las filas sin fecha solo cuentan en el total.
+
+#define AGG_MAGIC "SPLAGG1"
+#define AGG_TOP_STORED 1000 // Claves que se guardan por período
+#define AGG_ROLLUP_COLUMNS 2
+
+typedef struct {
+    char magic[8];
+    long entry_count;   // Entradas de index.dat que se contaron
+    long table_size;    // Posiciones de la tabla de claves (potencia de 2)
+    long key_count;
+    long series_count;  // MonthCount en total
+    long first_year;    // Años con filas (0 si no hay ninguna con fecha)
+    long last_year;
+    long period_count;  // 1 + 13 por cada año
+    long top_count;     // TopEntry en total
+    long rollup_values[AGG_ROLLUP_COLUMNS]; // Valores de ItemType y de Collection (0 sin índices secundarios)
+    long rollup_strings; // Bytes del texto de los valores, ya redondeado a múltiplo de 8
+} AggHeader;
+
+typedef struct {
+    long month; // año * 12 + (mes - 1)
+    long rows;
+} MonthCount;
+
+typedef struct {
+    long start; // Primera TopEntry del período
+    long count;
+} AggPeriod;
 
-// Estructura para cada nodo en nuestro archivo index.dat
-// Cada nodo es un eslabón de una lista enlazada.
 typedef struct {
-    long data_offset;      // Posición del registro en dataset.csv
-    long next_node_offset; // Posición del siguiente IndexNode en index.dat (-1 si es el final)
-} IndexNode;
+    long key;
+    long rows;
+    long data_offset; // Una fila de la clave, para leer el ID si la clave viene de un hash
+} TopEntry;
+
+// Columna de cada grupo de rollups
+int rollup_column(int rollup) {
+    return rollup == 0 ? COL_ITEMTYPE : COL_COLLECTION;
+}
+
+// Posición de un período en las listas de más prestados: 0 es todo el dataset, y para cada
+// año el año completo (month == 0) y después sus meses. Devuelve -1 si no hay datos del año.
+long agg_period(const AggHeader *header, int year, int month) {
+    if (year == 0) return month == 0 ? 0 : -1;
+    if (header->first_year == 0 || year < header->first_year || year > header->last_year) return -1;
+    return 1 + (year - header->first_year) * 13 + month;
+}
+
+// ---------------------- Reemplazo seguro de los archivos del índice ----------------------
+// El constructor nunca escribe sobre los archivos en uso: genera cada uno como "<nombre>.new"
+// y, cuando todos están en disco, escribe la lista en UPDATE_COMMIT_FILE. Ese archivo aparece
+// de una sola vez (se crea con otro nombre y se renombra) y es el punto de confirmación:
+//  - si el proceso se corta antes, los archivos anteriores siguen intactos y los .new se ignoran;
+//  - si se corta después, la lista dice qué falta renombrar y finish_index_update lo completa
+//    (lo llaman el constructor y el backend al arrancar).
+
+#define UPDATE_COMMIT_FILE "index.commit"
+#define UPDATE_SUFFIX ".new"
+
+// Escribe en disco el contenido de un archivo o directorio. Devuelve 0 si todo salió bien y -1 si no.
+int sync_path(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+// Completa una actualización confirmada que quedó a medias. Devuelve 0 si el índice quedó
+// consistente (o no había nada pendiente) y -1 si no se pudo terminar.
+int finish_index_update(void) {
+    FILE *commit_file = fopen(UPDATE_COMMIT_FILE, "r");
+    if (!commit_file) return 0;
+
+    char path[256], new_path[272];
+    while (fgets(path, sizeof(path), commit_file)) {
+        path[strcspn(path, "\n")] = '\0';
+        if (path[0] == '\0') continue;
+        snprintf(new_path, sizeof(new_path), "%s" UPDATE_SUFFIX, path);
+        // Si el .new ya no está, ese archivo se renombró antes del corte
+        if (access(new_path, F_OK) == 0 && rename(new_path, path) < 0) {
+            perror(new_path);
+            fclose(commit_file);
+            return -1;
+        }
+    }
+    fclose(commit_file);
+    sync_path(".");
+    unlink(UPDATE_COMMIT_FILE);
+    sync_path(".");
+    return 0;
+}
+
+// Reemplaza cada archivo de 'paths' por su versión .new (ver arriba).
+// Devuelve 0 si todo salió bien y -1 si no; en ese caso el índice anterior sigue en uso.
+int commit_index_files(const char *const *paths, int count) {
+    for (int i = 0; i < count; i++) {
+        char new_path[272];
+        snprintf(new_path, sizeof(new_path), "%s" UPDATE_SUFFIX, paths[i]);
+        if (sync_path(new_path) < 0) {
+            perror(new_path);
+            return -1;
+        }
+    }
+
+    FILE *commit_file = fopen(UPDATE_COMMIT_FILE ".tmp", "w");
+    if (!commit_file) {
+        perror("Error creando " UPDATE_COMMIT_FILE);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) fprintf(commit_file, "%s\n", paths[i]);
+    if (fflush(commit_file) != 0 || fsync(fileno(commit_file)) != 0) {
+        perror("Error escribiendo " UPDATE_COMMIT_FILE);
+        fclose(commit_file);
+        return -1;
+    }
+    fclose(commit_file);
+    if (rename(UPDATE_COMMIT_FILE ".tmp", UPDATE_COMMIT_FILE) < 0) {
+        perror("Error confirmando la actualización del índice");
+        return -1;
+    }
+    sync_path(".");
+
+    // Desde aquí la actualización está confirmada
+    return finish_index_update();
+}
+
+// Archivo del índice secundario de una columna, o NULL si la columna no tiene
+const char *secondary_index_path(int column) {
+    switch (column) {
+    case COL_ITEMBARCODE: return "index_barcode.dat";
+    case COL_ITEMTYPE: return "index_itemtype.dat";
+    case COL_COLLECTION: return "index_collection.dat";
+    case COL_CALLNUMBER: return "index_callnumber.dat";
+    default: return NULL;
+    }
+}
+
+// Nombre de la columna como aparece en la cabecera del CSV
+const char *column_name(int column) {
+    static const char *names[] = {"BibNumber", "ItemBarcode", "ItemType", "Collection", "CallNumber"};
+    return column >= 0 && column <= COL_CALLNUMBER ? names[column] : "?";
+}
+
+// Días transcurridos desde 1970-01-01 hasta la fecha dada (calendario gregoriano)
+long days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long year_of_era = year - era * 400;
+    long day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+// Año (calendario gregoriano) al que pertenece un instante en segundos desde la época
+int year_from_epoch(long seconds) {
+    long days = seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400;
+    days += 719468;
+    long era = (days >= 0 ? days : days - 146096) / 146097;
+    long day_of_era = days - era * 146097;
+    long year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    long day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    long month_index = (5 * day_of_year + 2) / 153;
+    return (int)(year_of_era + era * 400 + (month_index >= 10));
+}
+
+// Convierte una fecha "MM/DD/YYYY hh:mm:ss AM/PM" (la hora es opcional) a segundos desde la época.
+// Devuelve -1 si la cadena no tiene ese formato.
+long parse_checkout_datetime(const char *str) {
+    int month, day, year, hour = 0, minute = 0, second = 0;
+    char meridian[3] = "";
+
+    int fields = sscanf(str, "%d/%d/%d %d:%d:%d %2s", &month, &day, &year, &hour, &minute, &second, meridian);
+    if (fields < 3 || month < 1 || month > 12 || day < 1 || day > 31) {
+        return -1;
+    }
+    // Formato de 12 horas: 12 AM es medianoche y 12 PM es mediodía
+    if (hour == 12 && meridian[0] == 'A') hour = 0;
+    else if (hour < 12 && meridian[0] == 'P') hour += 12;
+
+    return days_from_civil(year, month, day) * 86400L + hour * 3600L + minute * 60L + second;
+}
+
+// Fecha del calendario gregoriano correspondiente a un número de días desde 1970-01-01
+void civil_from_days(long days, int *year, int *month, int *day) {
+    days += 719468;
+    long era = (days >= 0 ? days : days - 146096) / 146097;
+    long day_of_era = days - era * 146097;
+    long year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    long day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    long month_index = (5 * day_of_year + 2) / 153;
+    *day = (int)(day_of_year - (153 * month_index + 2) / 5 + 1);
+    *month = (int)(month_index < 10 ? month_index + 3 : month_index - 9);
+    *year = (int)(year_of_era + era * 400 + (*month <= 2));
+}
+
+// Inverso de parse_checkout_datetime: escribe "MM/DD/YYYY hh:mm:ss AM/PM" en 'out'
+// (al menos 32 bytes) y devuelve el largo del texto
+int format_checkout_datetime(long seconds, char *out) {
+    long days = seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400;
+    long rest = seconds - days * 86400;
+    int year, month, day;
+    civil_from_days(days, &year, &month, &day);
+
+    int hour = (int)(rest / 3600);
+    int hour12 = hour % 12 == 0 ? 12 : hour % 12;
+    return snprintf(out, 32, "%02d/%02d/%04d %02d:%02d:%02d %s", month, day, year, hour12,
+                    (int)(rest / 60 % 60), (int)(rest % 60), hour < 12 ? "AM" : "PM");
+}
+
+// Cuenta una fila con fecha 'checkout_time' (o -1) en el manifiesto de años
+void manifest_add(YearManifest *manifest, long checkout_time) {
+    if (checkout_time < 0) {
+        manifest->undated_rows++;
+        return;
+    }
+    int year, month, day;
+    civil_from_days(checkout_time / 86400, &year, &month, &day);
+    if (manifest->first_year == 0 || year < manifest->first_year) manifest->first_year = year;
+    if (year > manifest->last_year) manifest->last_year = year;
+    if (year < YEARS_FIRST || year >= YEARS_FIRST + YEARS_SPAN) manifest->outside_rows++;
+    else manifest->month_rows[year - YEARS_FIRST][month - 1]++;
+}
+
+// Filas de un año (month == 0) o de un mes de ese año según el manifiesto, o -1 si el año
+// está fuera de los que cubre y no se sabe
+long manifest_rows(const YearManifest *manifest, int year, int month) {
+    if (year < manifest->first_year || year > manifest->last_year) return 0;
+    if (year < YEARS_FIRST || year >= YEARS_FIRST + YEARS_SPAN) return -1;
+    const long *months = manifest->month_rows[year - YEARS_FIRST];
+    if (month > 0) return months[month - 1];
+    long rows = 0;
+    for (int m = 0; m < 12; m++) rows += months[m];
+    return rows;
+}
+
+// Mes (año * 12 + mes - 1) de una fecha en segundos desde la época, o -1 si no hay fecha
+long month_index(long checkout_time) {
+    if (checkout_time < 0) return -1;
+    int year, month, day;
+    civil_from_days(checkout_time / 86400, &year, &month, &day);
+    return year * 12L + month - 1;
+}
+
+// Calcula el rango semiabierto [from, to) que cubre un año completo o, si month > 0, un mes de ese año
+void month_range(int year, int month, long *from, long *to) {
+    if (month > 0) {
+        *from = days_from_civil(year, month, 1) * 86400L;
+        *to = (month == 12 ? days_from_civil(year + 1, 1, 1) : days_from_civil(year, month + 1, 1)) * 86400L;
+    } else {
+        *from = days_from_civil(year, 1, 1) * 86400L;
+        *to = days_from_civil(year + 1, 1, 1) * 86400L;
+    }
+}
 
 // Función Hash (djb2, una de las más simples y efectivas para strings)
 // Toma una cadena (el ID) y devuelve un entero sin signo.
@@ -24,4 +390,61 @@ unsigned long hash_function(const char *str) {
     return hash;
 }
 
-#endif // INDEXER_H
\ No newline at end of file
+// djb2 sobre 'len' bytes que no terminan en '\0'
+unsigned long value_hash(const char *text, size_t len) {
+    unsigned long hash = 5381;
+    for (size_t i = 0; i < len; i++) hash = hash * 33 + (unsigned char)text[i];
+    return hash;
+}
+
+#define TAIL_HASH_BYTES 4096 // Bytes del final de lo indexado que se comparan con IndexHeader.csv_tail_hash
+
+// Hash de los últimos TAIL_HASH_BYTES bytes antes de 'size'. Si coincide con el guardado en la
+// cabecera, el CSV es el mismo que se indexó (con o sin filas agregadas al final). Lo usan el
+// constructor al agregar filas y el backend al cargar el índice.
+unsigned long tail_hash(const char *data, size_t size) {
+    size_t begin = size > TAIL_HASH_BYTES ? size - TAIL_HASH_BYTES : 0;
+    return value_hash(data + begin, size - begin);
+}
+
+// Clave de índice de un BibNumber de 'len' caracteres (ver el comentario del formato)
+long index_key(const char *id, size_t len) {
+    int canonical = len > 0 && len <= KEY_MAX_DIGITS && (id[0] != '0' || len == 1);
+    long value = 0;
+    for (size_t i = 0; canonical && i < len; i++) {
+        if (id[i] < '0' || id[i] > '9') canonical = 0;
+        else value = value * 10 + (id[i] - '0');
+    }
+    if (canonical) return value;
+
+    unsigned long hash = 5381;
+    for (size_t i = 0; i < len; i++) hash = ((hash << 5) + hash) + (unsigned char)id[i];
+    return KEY_HASHED_FLAG | (long)(hash & (KEY_HASHED_FLAG - 1));
+}
+
+// 1 si la clave identifica exactamente al ID (no es un hash que puede compartirse)
+int key_is_exact(long key) {
+    return (key & KEY_HASHED_FLAG) == 0;
+}
+
+// Posición inicial de una clave en una tabla de 'table_size' posiciones. Mezclamos los bits
+// porque los BibNumber son consecutivos y, tomados tal cual, se amontonarían en la tabla.
+unsigned long key_slot(long key, long table_size) {
+    unsigned long x = (unsigned long)key;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdUL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53UL;
+    x ^= x >> 33;
+    return x & (unsigned long)(table_size - 1);
+}
+
+// Busca una clave en la tabla. Devuelve su posición o NULL si la clave no está en el índice.
+const KeySlot *find_key(const KeySlot *table, long table_size, long key) {
+    for (unsigned long slot = key_slot(key, table_size);; slot = (slot + 1) & (unsigned long)(table_size - 1)) {
+        if (table[slot].key == key) return &table[slot];
+        if (table[slot].key == KEY_EMPTY) return NULL;
+    }
+}
+
+#endif // INDEXER_H
@@ -1,72 +1,383 @@
+#define _GNU_SOURCE // copy_file_range
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include "csvscan.h"
+
+// Junta los CSV anuales (Data2005.csv ... Data2017.csv) en un solo archivo.
+//
+// Primero se calcula dónde va el cuerpo de cada archivo (todo menos su cabecera) dentro del
+// archivo de salida, que se reserva completo de una vez. Después varios hilos copian los
+// cuerpos a sus regiones en paralelo con copy_file_range, así los datos no pasan por la
+// memoria del proceso. La cabecera se escribe una sola vez, al principio.
+//
+// Sin -a se genera el archivo completo con otro nombre y se renombra al terminar; con -a los
+// años se agregan al final del archivo existente (para luego usar ./constructor -a).
+
 #define MAX_LINE_LEN 4096
+#define MAX_FILES 64
+#define MAX_THREADS 16
+#define FIRST_YEAR 2005
+#define LAST_YEAR 2017
+#define COPY_CHUNK (64L * 1024 * 1024) // Bytes por llamada a copy_file_range
+#define FALLBACK_BUFFER (1 << 20)      // Búfer de pread/pwrite si copy_file_range no está disponible
 
-void hacer_combinacion(char *archivo_csv)
+// Un archivo de entrada y la región de la salida donde va su cuerpo
+typedef struct
 {
-    
-    const char *csv_filepath = archivo_csv;
-    const char *combinado_filepath = "combinado.csv";
+    const char *path;
+    int fd;
+    off_t body_start;  // Primer byte después de la cabecera
+    off_t body_size;
+    off_t out_offset;  // Dónde empieza su cuerpo en la salida
+    int add_newline;   // 1 si el archivo no termina en salto de línea y hay que agregarlo
+} InputFile;
+
+typedef struct
+{
+    InputFile *files;
+    int file_count;
+    int next_file; // Siguiente archivo sin copiar; lo comparten los hilos
+    int out_fd;
+    int error;
+    pthread_mutex_t lock;
+} MergeJob;
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    FILE *csv_file = fopen(csv_filepath, "r");
-    if (!csv_file)
+// Lee la primera línea (la cabecera) de 'fd' en 'header'. Devuelve su largo con el salto de
+// línea, 0 si el archivo está vacío o -1 si la línea no termina antes de MAX_LINE_LEN.
+long read_header(int fd, char *header)
+{
+    ssize_t n = pread(fd, header, MAX_LINE_LEN, 0);
+    if (n <= 0)
+        return 0;
+    CsvScanner scanner;
+    CsvRow row;
+    csv_scan_init(&scanner, header, n);
+    csv_scan_row(&scanner, &row);
+    if (!row.terminated)
+        return n < MAX_LINE_LEN ? n : -1; // Un archivo de una sola línea sin salto: es todo cabecera
+    return row.len + 1;
+}
+
+// Copia 'size' bytes de 'in_fd' desde 'in_offset' a 'out_fd' en 'out_offset'. Usa
+// copy_file_range (el kernel copia, o incluso comparte bloques en sistemas que lo permiten)
+// y, si no se puede entre estos archivos, pread/pwrite. Devuelve 0 si todo salió bien y -1 si no.
+int copy_region(int in_fd, off_t in_offset, int out_fd, off_t out_offset, off_t size)
+{
+    while (size > 0)
     {
-        perror("Error abriendo archivo CSV");
-        return;
+        ssize_t copied = copy_file_range(in_fd, &in_offset, out_fd, &out_offset,
+                                         size < COPY_CHUNK ? size : COPY_CHUNK, 0);
+        if (copied > 0)
+        {
+            size -= copied;
+            continue;
+        }
+        if (copied == 0)
+        {
+            errno = EIO; // El archivo de entrada se achicó mientras copiábamos
+            return -1;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+            return -1;
+
+        // Sin copy_file_range, copiamos por bloques grandes con lecturas y escrituras posicionales
+        char *buffer = malloc(FALLBACK_BUFFER);
+        if (!buffer)
+            return -1;
+        while (size > 0)
+        {
+            ssize_t n = pread(in_fd, buffer, size < FALLBACK_BUFFER ? size : FALLBACK_BUFFER, in_offset);
+            if (n <= 0 || pwrite(out_fd, buffer, n, out_offset) != n)
+            {
+                if (n == 0)
+                    errno = EIO;
+                free(buffer);
+                return -1;
+            }
+            in_offset += n;
+            out_offset += n;
+            size -= n;
+        }
+        free(buffer);
     }
+    return 0;
+}
 
-    FILE *combinado_file = fopen(combinado_filepath, "ab");
-    if (!combinado_file)
+// Cada hilo toma el siguiente archivo sin copiar y copia su cuerpo a su región de la salida.
+// Las regiones no se solapan, así que no hace falta coordinar las escrituras.
+void *copy_worker(void *arg)
+{
+    MergeJob *job = arg;
+    while (1)
     {
-        fclose(csv_file);
-        perror("Error creando archivo combinado");
-        return;
+        pthread_mutex_lock(&job->lock);
+        int index = job->error ? job->file_count : job->next_file++;
+        pthread_mutex_unlock(&job->lock);
+        if (index >= job->file_count)
+            return NULL;
+
+        InputFile *file = &job->files[index];
+        int failed = copy_region(file->fd, file->body_start, job->out_fd, file->out_offset, file->body_size) < 0;
+        if (!failed && file->add_newline)
+            failed = pwrite(job->out_fd, "\n", 1, file->out_offset + file->body_size) != 1;
+        if (failed)
+        {
+            fprintf(stderr, "Error copiando '%s': %s\n", file->path, strerror(errno));
+            pthread_mutex_lock(&job->lock);
+            job->error = 1;
+            pthread_mutex_unlock(&job->lock);
+            return NULL;
+        }
+        printf("Copiado: %s (%lld bytes)\n", file->path, (long long)file->body_size);
     }
+}
 
-    fseek(combinado_file, 0, SEEK_END);
+void print_usage(const char *program)
+{
+    fprintf(stderr, "Uso: %s [-a] [-t hilos] [-o salida.csv] [archivo.csv ...]\n", program);
+    fprintf(stderr, "  -a           agregar los archivos al final de la salida en lugar de generarla de nuevo\n");
+    fprintf(stderr, "  -t hilos     archivos que se copian a la vez (por defecto, uno por núcleo)\n");
+    fprintf(stderr, "  -o salida    archivo combinado (por defecto combinado.csv)\n");
+    fprintf(stderr, "Sin archivos, se juntan Data%d.csv a Data%d.csv.\n", FIRST_YEAR, LAST_YEAR);
+}
 
+// Deshace la salida cuando la combinación falla: con -a el CSV vuelve a su tamaño original
+// (sin la cola reservada ni filas a medias) y sin -a se borra el archivo temporal.
+// Devuelve 1, el código de salida del programa en ese caso.
+int discard_output(int out_fd, int append, off_t original_size, const char *out_path)
+{
+    if (append && ftruncate(out_fd, original_size) < 0)
+        perror("Error restaurando el archivo combinado");
+    close(out_fd);
+    if (!append)
+        unlink(out_path);
+    return 1;
+}
 
-    char *line_buffer = NULL; // Puntero para la línea
-    size_t line_size = 0;     // Tamaño de la línea
+int main(int argc, char **argv)
+{
+    const char *combinado_filepath = "combinado.csv";
+    int append = 0;
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
 
+    int opt;
+    while ((opt = getopt(argc, argv, "at:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            append = 1;
+            break;
+        case 't':
+            thread_count = atol(optarg);
+            break;
+        case 'o':
+            combinado_filepath = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (thread_count < 1)
+        thread_count = 1;
+    if (thread_count > MAX_THREADS)
+        thread_count = MAX_THREADS;
 
-    if(getline(&line_buffer, &line_size, csv_file) == -1 && ftell(combinado_file) != 0)
+    // 1. Archivos de entrada: los de la línea de comandos o los años de siempre
+    static char year_paths[LAST_YEAR - FIRST_YEAR + 1][20];
+    const char *paths[MAX_FILES];
+    int path_count = 0;
+    if (optind < argc)
     {
-        // Si getline falla, significa que el archivo CSV está vacío o hubo un error
-        fclose(csv_file);
-        fclose(combinado_file);
-        perror("Error leyendo la primera línea del CSV");
-        return;
+        for (int i = optind; i < argc && path_count < MAX_FILES; i++)
+            paths[path_count++] = argv[i];
     }
-    // Leer línea por línea usando getline
-    while (getline(&line_buffer, &line_size, csv_file) != -1)
+    else
     {
-        // Escribir la línea en el archivo combinado
-        fprintf(combinado_file, "%s", line_buffer);
+        for (int year = FIRST_YEAR; year <= LAST_YEAR; year++) // Iterar desde 2005 hasta 2017
+        {
+            char *archivo_csv = year_paths[year - FIRST_YEAR];
+            sprintf(archivo_csv, "Data%d.csv", year); // Construir el nombre dinámicamente
+            paths[path_count++] = archivo_csv;
+        }
     }
 
-    // Liberar memoria y cerrar archivos
-    free(line_buffer);
-    fclose(csv_file);
-    fclose(combinado_file);
+    // 2. Abrir la salida. Sin -a se escribe con otro nombre para no dejar un archivo a medias
+    char out_path[512];
+    if (append)
+        snprintf(out_path, sizeof(out_path), "%s", combinado_filepath);
+    else
+        snprintf(out_path, sizeof(out_path), "%s.tmp", combinado_filepath);
+    int out_fd = open(out_path, append ? O_RDWR | O_CREAT : O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0)
+    {
+        perror("Error creando archivo combinado");
+        return 1;
+    }
+    struct stat out_st;
+    if (fstat(out_fd, &out_st) < 0)
+    {
+        perror("Error leyendo archivo combinado");
+        close(out_fd);
+        if (!append)
+            unlink(out_path);
+        return 1;
+    }
+    off_t original_size = out_st.st_size;
 
-    printf("Archivo combinado creado exitosamente.\n");
-}
+    // 3. Leer la cabecera de cada archivo y calcular la región de su cuerpo en la salida.
+    // La cabecera solo se escribe si la salida está vacía, y se toma del primer archivo.
+    InputFile files[MAX_FILES];
+    int file_count = 0;
+    char header[MAX_LINE_LEN];
+    long header_len = 0;
+    off_t out_offset = original_size;
+    if (append && original_size > 0)
+    {
+        // Si lo anterior no termina en salto de línea, la primera fila nueva quedaría pegada
+        char last;
+        if (pread(out_fd, &last, 1, original_size - 1) != 1 || last != '\n')
+        {
+            fprintf(stderr, "Error: '%s' no termina en un salto de línea\n", combinado_filepath);
+            return discard_output(out_fd, append, original_size, out_path);
+        }
+    }
+
+    for (int i = 0; i < path_count; i++)
+    {
+        InputFile *file = &files[file_count];
+        file->path = paths[i];
+        printf("Procesando archivo: %s\n", file->path);
+        file->fd = open(file->path, O_RDONLY);
+        if (file->fd < 0)
+        {
+            perror(file->path);
+            continue;
+        }
+        struct stat st;
+        char file_header[MAX_LINE_LEN];
+        long file_header_len = fstat(file->fd, &st) == 0 ? read_header(file->fd, file_header) : -1;
+        if (file_header_len < 0)
+        {
+            fprintf(stderr, "Error: no se pudo leer la cabecera de '%s'\n", file->path);
+            close(file->fd);
+            continue;
+        }
+        if (file_header_len == 0)
+        {
+            close(file->fd);
+            continue; // Archivo vacío
+        }
+        if (header_len == 0)
+        {
+            memcpy(header, file_header, file_header_len);
+            header_len = file_header_len;
+        }
+        else if (file_header_len != header_len || memcmp(file_header, header, header_len) != 0)
+        {
+            fprintf(stderr, "Aviso: la cabecera de '%s' no coincide con la del primer archivo\n", file->path);
+        }
 
-int main()
+        file->body_start = file_header_len;
+        file->body_size = st.st_size - file_header_len;
+        file->add_newline = 0;
+        if (file->body_size > 0)
+        {
+            char last;
+            file->add_newline = pread(file->fd, &last, 1, st.st_size - 1) == 1 && last != '\n';
+        }
+        file_count++;
+    }
+    if (file_count == 0)
+    {
+        fprintf(stderr, "Error: no hay archivos para juntar\n");
+        return discard_output(out_fd, append, original_size, out_path);
+    }
 
-{
-    for (int year = 2005; year <= 2017; year++) // Iterar desde 2005 hasta 2017
+    int write_header = original_size == 0;
+    if (write_header)
+        out_offset = header_len;
+    for (int i = 0; i < file_count; i++)
+    {
+        files[i].out_offset = out_offset;
+        out_offset += files[i].body_size + files[i].add_newline;
+    }
+
+    // 4. Reservar la salida completa de una vez; cada hilo escribe en su propia región
+    double start_time = now_seconds();
+    int result = posix_fallocate(out_fd, original_size, out_offset - original_size);
+    if (result != 0 && result != EOPNOTSUPP && result != EINVAL)
+    {
+        fprintf(stderr, "Error reservando espacio para '%s': %s\n", out_path, strerror(result));
+        return discard_output(out_fd, append, original_size, out_path);
+    }
+    if (ftruncate(out_fd, out_offset) < 0)
+    {
+        perror("Error reservando espacio para el archivo combinado");
+        return discard_output(out_fd, append, original_size, out_path);
+    }
+    if (write_header && pwrite(out_fd, header, header_len, 0) != header_len)
+    {
+        perror("Error escribiendo la cabecera");
+        return discard_output(out_fd, append, original_size, out_path);
+    }
+
+    // 5. Copiar los cuerpos en paralelo
+    MergeJob job = {files, file_count, 0, out_fd, 0, PTHREAD_MUTEX_INITIALIZER};
+    if (thread_count > file_count)
+        thread_count = file_count;
+    pthread_t threads[MAX_THREADS];
+    int started = 0;
+    for (; started < thread_count; started++)
     {
-        char archivo_csv[20]; // Buffer para el nombre del archivo
-        sprintf(archivo_csv, "Data%d.csv", year); // Construir el nombre dinámicamente
+        if (pthread_create(&threads[started], NULL, copy_worker, &job) != 0)
+        {
+            perror("Error creando hilo");
+            break;
+        }
+    }
+    if (started == 0)
+        copy_worker(&job);
+    for (int t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+    for (int i = 0; i < file_count; i++)
+        close(files[i].fd);
 
-        printf("Procesando archivo: %s\n", archivo_csv);
-        hacer_combinacion(archivo_csv); // Llamar a la función con el nombre dinámico
+    // 6. Dejar los datos en disco y, sin -a, reemplazar el archivo anterior
+    if (!job.error && fsync(out_fd) < 0)
+    {
+        perror("Error escribiendo el archivo combinado");
+        job.error = 1;
     }
+    if (job.error)
+        return discard_output(out_fd, append, original_size, out_path);
+    close(out_fd);
+    if (!append && rename(out_path, combinado_filepath) < 0)
+    {
+        perror("Error reemplazando el archivo combinado");
+        return 1;
+    }
+
+    double elapsed = now_seconds() - start_time;
+    off_t copied = out_offset - original_size;
+    printf("Archivo combinado creado exitosamente: %d archivos, %.1f MB en %.2f s (%.0f MB/s)\n", file_count,
+           copied / 1048576.0, elapsed, elapsed > 0 ? copied / 1048576.0 / elapsed : 0.0);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,441 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+// Protocolo entre el frontend y el backend.
+//
+// Hay dos formatos. El binario (versión 1) es el principal: la conexión se mantiene
+// abierta y puede llevar muchas solicitudes seguidas, incluso sin esperar la respuesta
+// de la anterior. El de texto ("id|año|mes|desde|hasta") se mantiene por compatibilidad
+// mientras migran los clientes: una solicitud por conexión y respuesta en tramas cortas.
+// El backend distingue uno de otro por los 4 primeros bytes (PROTOCOL_MAGIC).
+//
+// Todos los enteros viajan en orden de red (big endian).
+
+// ---------------------- Formato de texto (compatibilidad) ----------------------
+// Cada trama de la respuesta es:
+//   1 byte  tipo de trama
+//   4 bytes largo de la carga útil
+//   N bytes carga útil
+// La respuesta termina siempre con una trama FRAME_END y después se cierra la conexión.
+
+#define FRAME_HEADER_SIZE 5
+#define FRAME_MAX_PAYLOAD (64 * 1024) // Tamaño máximo de la carga útil de una trama
+
+#define FRAME_DATA 'D'  // Texto de resultados (o mensaje para el usuario)
+#define FRAME_END 'E'   // Fin de resultados; en texto la carga útil es el número de filas
+#define FRAME_ERROR 'X' // Solo en binario: mensaje de error; le sigue la trama FRAME_END
+
+// ---------------------- Formato binario (versión 1) ----------------------
+// Cabecera de solicitud (REQUEST_HEADER_SIZE bytes):
+//   4 bytes magic, 1 byte versión, 1 byte tipo, 2 bytes reservados,
+//   4 bytes id de solicitud (lo elige el cliente), 4 bytes largo de la carga útil
+// Cabecera de cada trama de respuesta (RESPONSE_HEADER_SIZE bytes):
+//   1 byte tipo de trama, 1 byte versión, 2 bytes reservados,
+//   4 bytes id de la solicitud a la que responde, 4 bytes largo de la carga útil
+// Las respuestas de una conexión llegan en el mismo orden que las solicitudes.
+// La trama FRAME_END de una respuesta binaria lleva el número de filas como entero de 8 bytes.
+
+#define PROTOCOL_MAGIC 0x53504C31u // "SPL1"
+#define PROTOCOL_VERSION 1
+#define REQUEST_HEADER_SIZE 16
+#define RESPONSE_HEADER_SIZE 12
+#define MAX_REQUEST_PAYLOAD (1 << 20)
+
+#define REQ_SEARCH 1 // Búsqueda por BibNumber con filtros opcionales de fecha
+#define REQ_CACHE_STATS 2 // Contadores de la caché de resultados (sin carga útil), como texto
+#define REQ_QUERY 3 // Búsqueda que combina predicados sobre varias columnas (ver query_payload_encode)
+#define REQ_SERIES 4 // Préstamos por mes de un ID, o de un valor de ItemType o Collection (carga útil de REQ_QUERY)
+#define REQ_TOP 5 // Los N IDs más prestados de un año o mes (ver top_payload_encode)
+#define REQ_STATS 6 // Métricas de las búsquedas y de la caché (sin carga útil), como texto
+#define REQ_PAGE 7 // Una página de una búsqueda o consulta, retomable con un cursor (ver page_payload_encode)
+#define REQ_BATCH 8 // Muchos BibNumber con los mismos filtros de fecha (ver batch_payload_encode)
+
+#define MAX_PREDICATES 8
+#define PREDICATE_VALUE_LEN 128
+
+#define PRED_EQUALS 0 // La columna es exactamente el valor
+#define PRED_PREFIX 1 // La columna empieza con el valor
+
+// Condición sobre una columna con índice secundario (ver COL_* en indexer.h)
+typedef struct {
+    uint8_t column;
+    uint8_t op;
+    char value[PREDICATE_VALUE_LEN]; // Sin las comillas del CSV
+} Predicate;
+
+// Dónde retomar una búsqueda paginada: la posición de la próxima entrada a revisar en el
+// bloque que se recorre y la fecha y el offset de la última revisada. Para el cliente es opaco.
+typedef struct {
+    long position;
+    long checkout_time;
+    long data_offset;
+} PageCursor;
+
+typedef struct {
+    uint8_t version;
+    uint8_t type;
+    uint32_t request_id;
+    uint32_t payload_len;
+} RequestHeader;
+
+// Parámetros de una búsqueda, ya interpretados
+typedef struct {
+    char id[256];    // BibNumber a buscar (vacío = cualquiera, solo con predicados)
+    int year;        // Año (0 = sin filtro)
+    int month;       // Mes 1-12 (0 = sin filtro)
+    long date_from;  // Inicio del rango de fechas en epoch (0 = sin límite)
+    long date_to;    // Fin del rango de fechas (exclusivo) en epoch (0 = sin límite)
+    int predicate_count;                 // Condiciones adicionales; todas deben cumplirse
+    Predicate predicates[MAX_PREDICATES];
+    long limit;        // Filas por página (0 = todas, sin paginar)
+    int has_cursor;    // 1 si la página sigue a una anterior
+    PageCursor cursor; // Dónde retomar (solo con has_cursor)
+} SearchQuery;
+
+void put_u16(unsigned char *out, uint16_t value) {
+    out[0] = value >> 8;
+    out[1] = value;
+}
+
+void put_u32(unsigned char *out, uint32_t value) {
+    for (int i = 3; i >= 0; i--, value >>= 8) out[i] = value & 0xff;
+}
+
+void put_u64(unsigned char *out, uint64_t value) {
+    for (int i = 7; i >= 0; i--, value >>= 8) out[i] = value & 0xff;
+}
+
+uint16_t get_u16(const unsigned char *in) {
+    return (uint16_t)(in[0] << 8 | in[1]);
+}
+
+uint32_t get_u32(const unsigned char *in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value = value << 8 | in[i];
+    return value;
+}
+
+uint64_t get_u64(const unsigned char *in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value = value << 8 | in[i];
+    return value;
+}
+
+// Escribe la cabecera de una trama de texto en 'out' (FRAME_HEADER_SIZE bytes)
+void frame_header_encode(unsigned char *out, char type, uint32_t payload_len) {
+    out[0] = (unsigned char)type;
+    put_u32(out + 1, payload_len);
+}
+
+// Lee el tipo y el largo de la carga útil de una cabecera de trama de texto
+void frame_header_decode(const unsigned char *in, char *type, uint32_t *payload_len) {
+    *type = (char)in[0];
+    *payload_len = get_u32(in + 1);
+}
+
+void request_header_encode(unsigned char *out, uint8_t type, uint32_t request_id, uint32_t payload_len) {
+    put_u32(out, PROTOCOL_MAGIC);
+    out[4] = PROTOCOL_VERSION;
+    out[5] = type;
+    put_u16(out + 6, 0);
+    put_u32(out + 8, request_id);
+    put_u32(out + 12, payload_len);
+}
+
+// Devuelve -1 si los bytes no empiezan con PROTOCOL_MAGIC
+int request_header_decode(const unsigned char *in, RequestHeader *header) {
+    if (get_u32(in) != PROTOCOL_MAGIC) {
+        return -1;
+    }
+    header->version = in[4];
+    header->type = in[5];
+    header->request_id = get_u32(in + 8);
+    header->payload_len = get_u32(in + 12);
+    return 0;
+}
+
+void response_header_encode(unsigned char *out, char type, uint32_t request_id, uint32_t payload_len) {
+    out[0] = (unsigned char)type;
+    out[1] = PROTOCOL_VERSION;
+    put_u16(out + 2, 0);
+    put_u32(out + 4, request_id);
+    put_u32(out + 8, payload_len);
+}
+
+void response_header_decode(const unsigned char *in, char *type, uint32_t *request_id, uint32_t *payload_len) {
+    *type = (char)in[0];
+    *request_id = get_u32(in + 4);
+    *payload_len = get_u32(in + 8);
+}
+
+// Carga útil de REQ_SEARCH:
+//   2 bytes año, 1 byte mes, 1 byte reservado, 8 bytes desde, 8 bytes hasta,
+//   2 bytes largo del ID, ID sin terminador
+#define SEARCH_PAYLOAD_FIXED 22
+
+// Devuelve el número de bytes escritos en 'out' (debe tener espacio para SEARCH_PAYLOAD_FIXED + 255)
+size_t search_payload_encode(unsigned char *out, const SearchQuery *query) {
+    size_t id_len = strnlen(query->id, sizeof(query->id) - 1);
+    put_u16(out, (uint16_t)query->year);
+    out[2] = (unsigned char)query->month;
+    out[3] = 0;
+    put_u64(out + 4, (uint64_t)query->date_from);
+    put_u64(out + 12, (uint64_t)query->date_to);
+    put_u16(out + 20, (uint16_t)id_len);
+    memcpy(out + SEARCH_PAYLOAD_FIXED, query->id, id_len);
+    return SEARCH_PAYLOAD_FIXED + id_len;
+}
+
+// Lee la parte común de REQ_SEARCH y REQ_QUERY. Devuelve los bytes leídos o -1 si no es válida.
+long search_fields_decode(const unsigned char *in, size_t len, SearchQuery *query) {
+    memset(query, 0, sizeof(*query));
+    if (len < SEARCH_PAYLOAD_FIXED) {
+        return -1;
+    }
+    size_t id_len = get_u16(in + 20);
+    if (id_len >= sizeof(query->id) || SEARCH_PAYLOAD_FIXED + id_len > len) {
+        return -1;
+    }
+    query->year = get_u16(in);
+    query->month = in[2];
+    query->date_from = (long)get_u64(in + 4);
+    query->date_to = (long)get_u64(in + 12);
+    memcpy(query->id, in + SEARCH_PAYLOAD_FIXED, id_len);
+    query->id[id_len] = '\0';
+    if (query->month > 12) {
+        return -1;
+    }
+    return SEARCH_PAYLOAD_FIXED + id_len;
+}
+
+// Devuelve 0 si la carga útil es válida y -1 si no
+int search_payload_decode(const unsigned char *in, size_t len, SearchQuery *query) {
+    long used = search_fields_decode(in, len, query);
+    if (used < 0 || (size_t)used != len || query->id[0] == '\0') {
+        return -1;
+    }
+    return 0;
+}
+
+// Carga útil de REQ_QUERY: la de REQ_SEARCH (el ID puede estar vacío), seguida de
+//   1 byte número de predicados y, por cada uno,
+//   1 byte columna, 1 byte operación (PRED_*), 2 bytes largo del valor, valor sin terminador
+// Devuelve el número de bytes escritos en 'out' (debe tener espacio para
+// SEARCH_PAYLOAD_FIXED + 256 + MAX_PREDICATES * (4 + PREDICATE_VALUE_LEN)).
+size_t query_payload_encode(unsigned char *out, const SearchQuery *query) {
+    size_t len = search_payload_encode(out, query);
+    out[len++] = (unsigned char)query->predicate_count;
+    for (int i = 0; i < query->predicate_count; i++) {
+        const Predicate *predicate = &query->predicates[i];
+        size_t value_len = strnlen(predicate->value, sizeof(predicate->value) - 1);
+        out[len] = predicate->column;
+        out[len + 1] = predicate->op;
+        put_u16(out + len + 2, (uint16_t)value_len);
+        memcpy(out + len + 4, predicate->value, value_len);
+        len += 4 + value_len;
+    }
+    return len;
+}
+
+// Lee los predicados de REQ_QUERY a partir de 'pos'. Pide al menos un ID o un predicado.
+// Devuelve la posición siguiente o -1 si no son válidos.
+long query_predicates_decode(const unsigned char *in, size_t len, long pos, SearchQuery *query) {
+    if (pos < 0 || (size_t)pos >= len) {
+        return -1;
+    }
+    query->predicate_count = in[pos++];
+    if (query->predicate_count > MAX_PREDICATES || (query->predicate_count == 0 && query->id[0] == '\0')) {
+        return -1;
+    }
+    for (int i = 0; i < query->predicate_count; i++) {
+        Predicate *predicate = &query->predicates[i];
+        if ((size_t)pos + 4 > len) {
+            return -1;
+        }
+        predicate->column = in[pos];
+        predicate->op = in[pos + 1];
+        size_t value_len = get_u16(in + pos + 2);
+        pos += 4;
+        if (value_len >= sizeof(predicate->value) || (size_t)pos + value_len > len ||
+            (predicate->op != PRED_EQUALS && predicate->op != PRED_PREFIX)) {
+            return -1;
+        }
+        memcpy(predicate->value, in + pos, value_len);
+        predicate->value[value_len] = '\0';
+        pos += value_len;
+    }
+    return pos;
+}
+
+// Devuelve 0 si la carga útil es válida y -1 si no. Que la columna tenga índice lo revisa el backend.
+int query_payload_decode(const unsigned char *in, size_t len, SearchQuery *query) {
+    long pos = query_predicates_decode(in, len, search_fields_decode(in, len, query), query);
+    return pos >= 0 && (size_t)pos == len ? 0 : -1;
+}
+
+// Cursor de REQ_PAGE: 8 bytes posición, 8 bytes fecha, 8 bytes offset
+#define PAGE_CURSOR_SIZE 24
+#define PAGE_MAX_ROWS 100000 // Filas que se pueden pedir en una página
+
+size_t page_cursor_encode(unsigned char *out, const PageCursor *cursor) {
+    put_u64(out, (uint64_t)cursor->position);
+    put_u64(out + 8, (uint64_t)cursor->checkout_time);
+    put_u64(out + 16, (uint64_t)cursor->data_offset);
+    return PAGE_CURSOR_SIZE;
+}
+
+void page_cursor_decode(const unsigned char *in, PageCursor *cursor) {
+    cursor->position = (long)get_u64(in);
+    cursor->checkout_time = (long)get_u64(in + 8);
+    cursor->data_offset = (long)get_u64(in + 16);
+}
+
+// Carga útil de REQ_PAGE: la de REQ_QUERY, seguida de
+//   4 bytes filas por página, 1 byte largo del cursor (0 en la primera página o PAGE_CURSOR_SIZE),
+//   cursor tal como llegó en la respuesta anterior
+// La trama FRAME_END de la respuesta lleva, después del número de filas, el cursor de la
+// página siguiente; si no lo lleva, no hay más filas.
+size_t page_payload_encode(unsigned char *out, const SearchQuery *query) {
+    size_t len = query_payload_encode(out, query);
+    put_u32(out + len, (uint32_t)query->limit);
+    out[len + 4] = query->has_cursor ? PAGE_CURSOR_SIZE : 0;
+    len += 5;
+    if (query->has_cursor) {
+        len += page_cursor_encode(out + len, &query->cursor);
+    }
+    return len;
+}
+
+// Devuelve 0 si la carga útil es válida y -1 si no
+int page_payload_decode(const unsigned char *in, size_t len, SearchQuery *query) {
+    long pos = query_predicates_decode(in, len, search_fields_decode(in, len, query), query);
+    if (pos < 0 || (size_t)pos + 5 > len) {
+        return -1;
+    }
+    query->limit = get_u32(in + pos);
+    size_t cursor_len = in[pos + 4];
+    pos += 5;
+    if (query->limit < 1 || query->limit > PAGE_MAX_ROWS || (cursor_len != 0 && cursor_len != PAGE_CURSOR_SIZE) ||
+        (size_t)pos + cursor_len != len) {
+        return -1;
+    }
+    query->has_cursor = cursor_len != 0;
+    if (query->has_cursor) {
+        page_cursor_decode(in + pos, &query->cursor);
+        if (query->cursor.position < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Carga útil de REQ_BATCH: la de REQ_SEARCH con el ID vacío (solo los filtros de fecha),
+// seguida de 4 bytes número de IDs y, por cada uno, 2 bytes largo y el ID sin terminador.
+// La respuesta trae las filas agrupadas por ID, en el orden de la solicitud.
+#define MAX_BATCH_IDS 10000
+
+// Devuelve el número de bytes escritos en 'out' (debe tener espacio para
+// SEARCH_PAYLOAD_FIXED + 4 + count * (2 + 255)).
+size_t batch_payload_encode(unsigned char *out, const SearchQuery *filters, const char *const *ids, uint32_t count) {
+    SearchQuery dates = *filters;
+    dates.id[0] = '\0';
+    size_t len = search_payload_encode(out, &dates);
+    put_u32(out + len, count);
+    len += 4;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t id_len = strnlen(ids[i], sizeof(filters->id) - 1);
+        put_u16(out + len, (uint16_t)id_len);
+        memcpy(out + len + 2, ids[i], id_len);
+        len += 2 + id_len;
+    }
+    return len;
+}
+
+// Revisa la carga útil completa y deja en 'ids_pos' dónde empieza la lista de IDs (se recorre
+// con batch_next_id). Devuelve 0 si es válida y -1 si no.
+int batch_payload_decode(const unsigned char *in, size_t len, SearchQuery *filters, uint32_t *count, long *ids_pos) {
+    long pos = search_fields_decode(in, len, filters);
+    if (pos < 0 || filters->id[0] != '\0' || (size_t)pos + 4 > len) {
+        return -1;
+    }
+    *count = get_u32(in + pos);
+    pos += 4;
+    *ids_pos = pos;
+    if (*count == 0 || *count > MAX_BATCH_IDS) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < *count; i++) {
+        if ((size_t)pos + 2 > len) {
+            return -1;
+        }
+        size_t id_len = get_u16(in + pos);
+        if (id_len == 0 || id_len >= sizeof(filters->id) || (size_t)pos + 2 + id_len > len) {
+            return -1;
+        }
+        pos += 2 + id_len;
+    }
+    return (size_t)pos == len ? 0 : -1;
+}
+
+// Copia en 'id' (de al menos 256 bytes) el ID que empieza en 'pos' de una carga útil ya
+// validada con batch_payload_decode. Devuelve la posición del siguiente.
+long batch_next_id(const unsigned char *in, long pos, char *id) {
+    size_t id_len = get_u16(in + pos);
+    memcpy(id, in + pos + 2, id_len);
+    id[id_len] = '\0';
+    return pos + 2 + id_len;
+}
+
+// Carga útil de REQ_TOP:
+//   2 bytes año (0 = todo el dataset), 1 byte mes (0 = el año completo), 1 byte reservado,
+//   4 bytes cuántos IDs devolver
+#define TOP_PAYLOAD_SIZE 8
+
+typedef struct {
+    int year;
+    int month;
+    long limit;
+} TopQuery;
+
+size_t top_payload_encode(unsigned char *out, const TopQuery *query) {
+    put_u16(out, (uint16_t)query->year);
+    out[2] = (unsigned char)query->month;
+    out[3] = 0;
+    put_u32(out + 4, (uint32_t)query->limit);
+    return TOP_PAYLOAD_SIZE;
+}
+
+// Devuelve 0 si la carga útil es válida y -1 si no
+int top_payload_decode(const unsigned char *in, size_t len, TopQuery *query) {
+    if (len != TOP_PAYLOAD_SIZE) {
+        return -1;
+    }
+    query->year = get_u16(in);
+    query->month = in[2];
+    query->limit = get_u32(in + 4);
+    if (query->month > 12 || (query->month > 0 && query->year == 0) || query->limit == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Recibe exactamente 'len' bytes. Devuelve 0 si llegaron todos y -1 si la conexión se cerró antes.
+int recv_all(int fd, void *buffer, size_t len) {
+    char *out = buffer;
+    while (len > 0) {
+        ssize_t received = recv(fd, out, len, 0);
+        if (received <= 0) {
+            return -1;
+        }
+        out += received;
+        len -= received;
+    }
+    return 0;
+}
+
+#endif // PROTOCOL_H
@@ -0,0 +1,199 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "indexer.h"
+
+// Almacén binario de registros (records.dat), generado por ./convertir a partir de DataC.csv.
+//
+// Guarda las mismas filas del CSV, en el mismo orden, separadas por columnas:
+//  - csv_offset:     posición de la fila en el CSV (creciente). Las entradas de index.dat
+//                    apuntan al CSV, así que con una búsqueda binaria se llega al registro.
+//  - checkout_time:  CheckoutDateTime en segundos desde la época (32 bits sin signo)
+//  - item_barcode:   ItemBarcode como entero de 64 bits, con su número de dígitos para
+//                    conservar los ceros a la izquierda
+//  - bib_number:     BibNumber como entero
+//  - call_start:     inicio del CallNumber de cada fila dentro del montón de cadenas
+//                    (record_count + 1 valores; el de la fila i termina donde empieza el de i + 1)
+//  - item_type, collection: códigos de diccionario (tablas de cadenas de RECORD_DICT_LEN bytes)
+//  - flags:          RECORD_FLAG_RAW si la fila no se puede reconstruir exactamente desde las
+//                    columnas; esas pocas filas se siguen leyendo del CSV
+// El CallNumber se guarda tal cual aparece en el CSV (con comillas si las tenía), así que
+// format_record produce exactamente la línea original.
+
+#define RECORDS_MAGIC "SPLREC1"
+#define RECORD_DICT_LEN 32
+#define RECORD_DICT_MAX 65535
+#define RECORD_FLAG_RAW 1
+#define RECORD_MAX_LINE 4096
+
+// Cabecera de records.dat. Las posiciones de cada sección son desde el inicio del archivo.
+typedef struct {
+    char magic[8];
+    long record_count;
+    long csv_size;         // Tamaño del CSV del que se generó, para detectar si ya no corresponde
+    long item_type_count;
+    long collection_count;
+    long heap_size;
+    long csv_offset_pos;
+    long checkout_time_pos;
+    long item_barcode_pos;
+    long bib_number_pos;
+    long call_start_pos;
+    long item_type_pos;
+    long collection_pos;
+    long barcode_digits_pos;
+    long flags_pos;
+    long item_type_dict_pos;
+    long collection_dict_pos;
+    long heap_pos;
+} RecordStoreHeader;
+
+// Vista de un records.dat mapeado en memoria
+typedef struct {
+    long record_count;
+    long csv_size;
+    const long *csv_offset;
+    const uint32_t *checkout_time;
+    const uint64_t *item_barcode;
+    const uint32_t *bib_number;
+    const uint32_t *call_start;
+    const uint16_t *item_type;
+    const uint16_t *collection;
+    const uint8_t *barcode_digits;
+    const uint8_t *flags;
+    const char (*item_type_dict)[RECORD_DICT_LEN];
+    const char (*collection_dict)[RECORD_DICT_LEN];
+    const char *heap;
+} RecordStore;
+
+// Redondea una posición del archivo al siguiente múltiplo de 8
+long records_align(long pos)
+{
+    return (pos + 7) & ~7L;
+}
+
+// Calcula dónde va cada sección a partir de los tamaños que ya tiene la cabecera
+void records_layout(RecordStoreHeader *header)
+{
+    long n = header->record_count;
+    long pos = records_align(sizeof(RecordStoreHeader));
+    header->csv_offset_pos = pos;        pos = records_align(pos + n * sizeof(long));
+    header->item_barcode_pos = pos;      pos = records_align(pos + n * sizeof(uint64_t));
+    header->checkout_time_pos = pos;     pos = records_align(pos + n * sizeof(uint32_t));
+    header->bib_number_pos = pos;        pos = records_align(pos + n * sizeof(uint32_t));
+    header->call_start_pos = pos;        pos = records_align(pos + (n + 1) * sizeof(uint32_t));
+    header->item_type_pos = pos;         pos = records_align(pos + n * sizeof(uint16_t));
+    header->collection_pos = pos;        pos = records_align(pos + n * sizeof(uint16_t));
+    header->barcode_digits_pos = pos;    pos = records_align(pos + n);
+    header->flags_pos = pos;             pos = records_align(pos + n);
+    header->item_type_dict_pos = pos;    pos = records_align(pos + header->item_type_count * RECORD_DICT_LEN);
+    header->collection_dict_pos = pos;   pos = records_align(pos + header->collection_count * RECORD_DICT_LEN);
+    header->heap_pos = pos;
+}
+
+// Prepara la vista sobre un records.dat ya mapeado. Devuelve 0 si el archivo es válido y -1 si no.
+int record_store_open(RecordStore *store, const char *data, size_t size)
+{
+    memset(store, 0, sizeof(*store));
+    if (size < sizeof(RecordStoreHeader))
+        return -1;
+
+    RecordStoreHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, RECORDS_MAGIC, sizeof(header.magic)) != 0 || header.record_count < 0)
+        return -1;
+
+    // Recalculamos la disposición para no confiar en posiciones fuera del archivo
+    RecordStoreHeader expected = header;
+    records_layout(&expected);
+    if (memcmp(&expected, &header, sizeof(header)) != 0 || (size_t)(header.heap_pos + header.heap_size) != size)
+        return -1;
+
+    store->record_count = header.record_count;
+    store->csv_size = header.csv_size;
+    store->csv_offset = (const long *)(data + header.csv_offset_pos);
+    store->checkout_time = (const uint32_t *)(data + header.checkout_time_pos);
+    store->item_barcode = (const uint64_t *)(data + header.item_barcode_pos);
+    store->bib_number = (const uint32_t *)(data + header.bib_number_pos);
+    store->call_start = (const uint32_t *)(data + header.call_start_pos);
+    store->item_type = (const uint16_t *)(data + header.item_type_pos);
+    store->collection = (const uint16_t *)(data + header.collection_pos);
+    store->barcode_digits = (const uint8_t *)(data + header.barcode_digits_pos);
+    store->flags = (const uint8_t *)(data + header.flags_pos);
+    store->item_type_dict = (const char (*)[RECORD_DICT_LEN])(data + header.item_type_dict_pos);
+    store->collection_dict = (const char (*)[RECORD_DICT_LEN])(data + header.collection_dict_pos);
+    store->heap = data + header.heap_pos;
+    return 0;
+}
+
+// Número de registro de la fila que empieza en 'csv_offset', o -1 si no hay ninguna
+long record_find(const RecordStore *store, long csv_offset)
+{
+    long lo = 0, hi = store->record_count;
+    while (lo < hi)
+    {
+        long mid = lo + (hi - lo) / 2;
+        if (store->csv_offset[mid] < csv_offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < store->record_count && store->csv_offset[lo] == csv_offset ? lo : -1;
+}
+
+// Arma la línea CSV de una fila a partir de sus campos ya decodificados. Devuelve el largo
+// (sin salto de línea) o 0 si no cabe en 'out'.
+size_t format_record_fields(char *out, size_t cap, uint32_t bib_number, uint64_t barcode, int barcode_digits,
+                            const char *item_type, const char *collection,
+                            const char *call_number, size_t call_len, long checkout_time)
+{
+    char date[32];
+    format_checkout_datetime(checkout_time, date);
+
+    char barcode_text[24] = "";
+    if (barcode_digits > 0)
+        snprintf(barcode_text, sizeof(barcode_text), "%0*llu", barcode_digits, (unsigned long long)barcode);
+
+    int prefix = snprintf(out, cap, "%u,%s,%s,%s,", bib_number, barcode_text, item_type, collection);
+    if (prefix < 0 || (size_t)prefix + call_len + 1 + strlen(date) >= cap)
+        return 0;
+    size_t len = prefix;
+    memcpy(out + len, call_number, call_len);
+    len += call_len;
+    out[len++] = ',';
+    strcpy(out + len, date);
+    return len + strlen(date);
+}
+
+// Arma la línea CSV del registro 'record'. Devuelve el largo o 0 si no cabe en 'out'.
+size_t format_record(const RecordStore *store, long record, char *out, size_t cap)
+{
+    uint32_t call_start = store->call_start[record];
+    return format_record_fields(out, cap, store->bib_number[record], store->item_barcode[record],
+                                store->barcode_digits[record],
+                                store->item_type_dict[store->item_type[record]],
+                                store->collection_dict[store->collection[record]],
+                                store->heap + call_start, store->call_start[record + 1] - call_start,
+                                store->checkout_time[record]);
+}
+
+// Convierte un BibNumber en texto a entero. Devuelve -1 si no tiene la forma que produce
+// format_record (solo dígitos, sin ceros a la izquierda y dentro de 32 bits).
+long parse_bib_number(const char *text, size_t len)
+{
+    if (len == 0 || len > 10 || (text[0] == '0' && len > 1))
+        return -1;
+    long value = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (text[i] < '0' || text[i] > '9')
+            return -1;
+        value = value * 10 + (text[i] - '0');
+    }
+    return value <= UINT32_MAX ? value : -1;
+}
+
+#endif // RECORDS_H